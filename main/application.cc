@@ -9,6 +9,7 @@
 #include "mcp_server.h"
 #include "assets.h"
 #include "settings.h"
+#include "network_context.h"
 
 #include <cstring>
 #include <esp_log.h>
@@ -223,7 +224,8 @@ void Application::ShowActivationCode(const std::string& code, const std::string&
         auto it = std::find_if(digit_sounds.begin(), digit_sounds.end(),
             [digit](const digit_sound& ds) { return ds.digit == digit; });
         if (it != digit_sounds.end()) {
-            audio_service_.PlaySound(it->sound);
+            // Same priority as the alert above, so the digits play after it
+            audio_service_.PlaySound(it->sound, true);
         }
     }
 }
@@ -235,7 +237,7 @@ void Application::Alert(const char* status, const char* message, const char* emo
     display->SetEmotion(emotion);
     display->SetChatMessage("system", message);
     if (!sound.empty()) {
-        audio_service_.PlaySound(sound);
+        audio_service_.PlaySound(sound, true);
     }
 }
 
@@ -268,18 +270,13 @@ void Application::ToggleChatState() {
     }
 
     if (device_state_ == kDeviceStateIdle) {
+        connection_.OnTurnTriggered("button");
+        // The codec input settles while the audio channel opens
+        audio_service_.PrepareInput();
         Schedule([this]() {
-            if (!protocol_->IsAudioChannelOpened()) {
-                SetDeviceState(kDeviceStateConnecting);
-                if (!protocol_->OpenAudioChannel()) {
-                    // 连接失败，回滚状态到Idle，避免状态卡死
-                    ESP_LOGW(TAG, "OpenAudioChannel失败，回滚状态到Idle");
-                    SetDeviceState(kDeviceStateIdle);
-                    return;
-                }
-            }
-
-            SetListeningMode(aec_mode_ == kAecOff ? kListeningModeAutoStop : kListeningModeRealtime);
+            OpenAudioChannelThen([this]() {
+                SetListeningMode(aec_mode_ == kAecOff ? kListeningModeAutoStop : kListeningModeRealtime);
+            });
         });
     } else if (device_state_ == kDeviceStateSpeaking) {
         Schedule([this]() {
@@ -287,7 +284,7 @@ void Application::ToggleChatState() {
         });
     } else if (device_state_ == kDeviceStateListening) {
         Schedule([this]() {
-            protocol_->CloseAudioChannel();
+            connection_.CloseAudioChannel();
         });
     }
 }
@@ -308,20 +305,16 @@ void Application::StartListening() {
     }
     
     if (device_state_ == kDeviceStateIdle) {
+        connection_.OnTurnTriggered("button");
+        // The codec input settles while the audio channel opens
+        audio_service_.PrepareInput();
         Schedule([this]() {
-            if (!protocol_->IsAudioChannelOpened()) {
-                SetDeviceState(kDeviceStateConnecting);
-                if (!protocol_->OpenAudioChannel()) {
-                    // 连接失败，回滚状态到Idle，避免状态卡死
-                    ESP_LOGW(TAG, "OpenAudioChannel失败，回滚状态到Idle");
-                    SetDeviceState(kDeviceStateIdle);
-                    return;
-                }
-            }
-
-            SetListeningMode(kListeningModeManualStop);
+            OpenAudioChannelThen([this]() {
+                SetListeningMode(kListeningModeManualStop);
+            });
         });
     } else if (device_state_ == kDeviceStateSpeaking) {
+        audio_service_.PrepareInput();
         Schedule([this]() {
             AbortSpeaking(kAbortReasonNone);
             SetListeningMode(kListeningModeManualStop);
@@ -368,17 +361,28 @@ void Application::Start() {
     auto codec = board.GetAudioCodec();
     audio_service_.Initialize(codec);
     audio_service_.Start();
+    // Cache the most frequent prompts on the decode task now, so they start without decoding later
+    audio_service_.PreloadSound(Lang::Sounds::OGG_POPUP);
+    audio_service_.PreloadSound(Lang::Sounds::OGG_SUCCESS);
+    audio_service_.PreloadSound(Lang::Sounds::OGG_VIBRATION);
 
     AudioServiceCallbacks callbacks;
     callbacks.on_send_queue_available = [this]() {
         xEventGroupSetBits(event_group_, MAIN_EVENT_SEND_AUDIO);
     };
     callbacks.on_wake_word_detected = [this](const std::string& wake_word) {
+        if (device_state_ == kDeviceStateIdle) {
+            // Start connecting before the main task gets to the wake word
+            connection_.OnTurnTriggered("wake word");
+        }
         xEventGroupSetBits(event_group_, MAIN_EVENT_WAKE_WORD_DETECTED);
     };
     callbacks.on_vad_change = [this](bool speaking) {
         xEventGroupSetBits(event_group_, MAIN_EVENT_VAD_CHANGE);
     };
+    callbacks.on_end_of_speech = [this]() {
+        xEventGroupSetBits(event_group_, MAIN_EVENT_END_OF_SPEECH);
+    };
     audio_service_.SetCallbacks(callbacks);
 
     // Start the main event loop task with priority 3
@@ -420,25 +424,40 @@ void Application::Start() {
         ESP_LOGW(TAG, "No protocol specified in the OTA config, using MQTT");
         protocol_ = std::make_unique<MqttProtocol>();
     }
+    connection_.Initialize(protocol_.get(), [this](std::function<void()> callback) {
+        Schedule(std::move(callback));
+    });
 
     protocol_->OnConnected([this]() {
         DismissAlert();
     });
 
     protocol_->OnNetworkError([this](const std::string& message) {
-        last_error_message_ = message;
-        xEventGroupSetBits(event_group_, MAIN_EVENT_ERROR);
+        // The warm-up task and the network tasks report errors too, the message is only touched on the main task
+        Schedule([this, message]() {
+            last_error_message_ = message;
+            xEventGroupSetBits(event_group_, MAIN_EVENT_ERROR);
+        });
     });
-    protocol_->OnIncomingAudio([this](std::unique_ptr<AudioStreamPacket> packet) {
+    protocol_->OnIncomingAudio([this](AudioStreamPacketPtr packet) {
         if (device_state_ == kDeviceStateSpeaking) {
             audio_service_.PushPacketToDecodeQueue(std::move(packet));
         }
     });
     protocol_->OnAudioChannelOpened([this, codec, &board]() {
-        board.SetPowerSaveMode(false);
-        if (protocol_->server_sample_rate() != codec->output_sample_rate()) {
-            ESP_LOGW(TAG, "Server sample rate %d does not match device output sample rate %d, resampling may cause distortion",
-                protocol_->server_sample_rate(), codec->output_sample_rate());
+        // May fire on the warm-up task, this runs on the main task before the turn goes on
+        auto on_opened = [this, codec, &board]() {
+            board.SetPowerSaveMode(false);
+            audio_service_.SetUplinkFrameDuration(protocol_->uplink_frame_duration());
+            if (protocol_->server_sample_rate() != codec->output_sample_rate()) {
+                ESP_LOGW(TAG, "Server sample rate %d does not match device output sample rate %d, resampling may cause distortion",
+                    protocol_->server_sample_rate(), codec->output_sample_rate());
+            }
+        };
+        if (xTaskGetCurrentTaskHandle() == main_event_loop_task_handle_) {
+            on_opened();
+        } else {
+            Schedule(on_opened);
         }
     });
     protocol_->OnAudioChannelClosed([this, &board]() {
@@ -462,6 +481,10 @@ void Application::Start() {
                     }
                 });
             } else if (strcmp(state->valuestring, "stop") == 0) {
+                if (listening_mode_ != kListeningModeManualStop) {
+                    // Listening follows the TTS, get the input ready before the state change
+                    audio_service_.PrepareInput();
+                }
                 Schedule([this]() {
                     if (device_state_ == kDeviceStateSpeaking) {
                         if (listening_mode_ == kListeningModeManualStop) {
@@ -539,6 +562,8 @@ void Application::Start() {
         }
     });
     bool protocol_started = protocol_->Start();
+    // Resolve the server hosts now, the first turn does not wait for the lookup
+    NetworkContext::GetInstance().Prefetch();
 
     SystemInfo::PrintHeapStats();
     SetDeviceState(kDeviceStateIdle);
@@ -576,6 +601,7 @@ void Application::MainEventLoop() {
             MAIN_EVENT_SEND_AUDIO |
             MAIN_EVENT_WAKE_WORD_DETECTED |
             MAIN_EVENT_VAD_CHANGE |
+            MAIN_EVENT_END_OF_SPEECH |
             MAIN_EVENT_CLOCK_TICK |
             MAIN_EVENT_ERROR, pdTRUE, pdFALSE, portMAX_DELAY);
 
@@ -586,9 +612,39 @@ void Application::MainEventLoop() {
 
         if (bits & MAIN_EVENT_SEND_AUDIO) {
             while (auto packet = audio_service_.PopPacketFromSendQueue()) {
+                // The link fell behind, send the backlog in fewer and larger messages
+                if (protocol_ && protocol_->audio_batch_supported() && audio_service_.GetSendQueueSize() >= AUDIO_BATCH_QUEUE_THRESHOLD) {
+                    send_batch_.push_back(std::move(packet));
+                    while (send_batch_.size() < AUDIO_BATCH_MAX_FRAMES) {
+                        auto next = audio_service_.PopPacketFromSendQueue();
+                        if (!next) {
+                            break;
+                        }
+                        send_batch_.push_back(std::move(next));
+                    }
+                    bool sent = protocol_->SendAudioBatch(send_batch_);
+#if CONFIG_USE_AUDIO_LATENCY_TRACE
+                    for (auto& batched : send_batch_) {
+                        LATENCY_TRACE_END(batched->trace, kLatencyStageSend, kLatencyStageUplink);
+                    }
+#endif
+                    send_batch_.clear();
+                    if (!sent) {
+                        audio_service_.ReportSendFailure();
+                        break;
+                    }
+                    connection_.OnAudioSent();
+                    continue;
+                }
+#if CONFIG_USE_AUDIO_LATENCY_TRACE
+                auto trace = packet->trace;
+#endif
                 if (protocol_ && !protocol_->SendAudio(std::move(packet))) {
+                    audio_service_.ReportSendFailure();
                     break;
                 }
+                connection_.OnAudioSent();
+                LATENCY_TRACE_END(trace, kLatencyStageSend, kLatencyStageUplink);
             }
         }
 
@@ -603,6 +659,10 @@ void Application::MainEventLoop() {
             }
         }
 
+        if (bits & MAIN_EVENT_END_OF_SPEECH) {
+            OnEndOfSpeech();
+        }
+
         if (bits & MAIN_EVENT_SCHEDULE) {
             std::unique_lock<std::mutex> lock(mutex_);
             auto tasks = std::move(main_tasks_);
@@ -616,6 +676,16 @@ void Application::MainEventLoop() {
             clock_ticks_++;
             auto display = Board::GetInstance().GetDisplay();
             display->UpdateStatusBar();
+
+            if (end_of_speech_tick_ >= 0 && clock_ticks_ - end_of_speech_tick_ >= END_OF_SPEECH_RESPONSE_TIMEOUT_S) {
+                ESP_LOGW(TAG, "No response after the end of speech, back to idle");
+                SetDeviceState(kDeviceStateIdle);
+            }
+            connection_.CollectWarmUp();
+            if (device_state_ == kDeviceStateIdle) {
+                connection_.CloseIfIdle();
+                NetworkContext::GetInstance().PrefetchIfDue();
+            }
         
             // Print the debug info every 10 seconds
             if (clock_ticks_ % 10 == 0) {
@@ -623,6 +693,11 @@ void Application::MainEventLoop() {
                 // SystemInfo::PrintTaskList();
                 SystemInfo::PrintHeapStats();
             }
+#if CONFIG_USE_AUDIO_LATENCY_TRACE
+            if (clock_ticks_ % 30 == 0) {
+                LatencyTracer::GetInstance().PrintStats();
+            }
+#endif
         }
     }
 }
@@ -633,34 +708,28 @@ void Application::OnWakeWordDetected() {
     }
 
     if (device_state_ == kDeviceStateIdle) {
+        audio_service_.PrepareInput();
         audio_service_.EncodeWakeWord();
 
-        if (!protocol_->IsAudioChannelOpened()) {
-            SetDeviceState(kDeviceStateConnecting);
-            if (!protocol_->OpenAudioChannel()) {
-                // 连接失败，回滚状态到Idle，重新启用唤醒词检测
-                ESP_LOGW(TAG, "OpenAudioChannel失败，回滚状态到Idle");
-                SetDeviceState(kDeviceStateIdle);
-                audio_service_.EnableWakeWordDetection(true);
-                return;
-            }
-        }
-
-        auto wake_word = audio_service_.GetLastWakeWord();
-        ESP_LOGI(TAG, "Wake word detected: %s", wake_word.c_str());
+        OpenAudioChannelThen([this]() {
+            auto wake_word = audio_service_.GetLastWakeWord();
+            ESP_LOGI(TAG, "Wake word detected: %s", wake_word.c_str());
 #if CONFIG_SEND_WAKE_WORD_DATA
-        // Encode and send the wake word data to the server
-        while (auto packet = audio_service_.PopWakeWordPacket()) {
-            protocol_->SendAudio(std::move(packet));
-        }
-        // Set the chat state to wake word detected
-        protocol_->SendWakeWordDetected(wake_word);
-        SetListeningMode(aec_mode_ == kAecOff ? kListeningModeAutoStop : kListeningModeRealtime);
+            // Encode and send the wake word data to the server
+            while (auto packet = audio_service_.PopWakeWordPacket()) {
+                if (protocol_->SendAudio(std::move(packet))) {
+                    connection_.OnAudioSent();
+                }
+            }
+            // Set the chat state to wake word detected
+            protocol_->SendWakeWordDetected(wake_word);
+            SetListeningMode(aec_mode_ == kAecOff ? kListeningModeAutoStop : kListeningModeRealtime);
 #else
-        SetListeningMode(aec_mode_ == kAecOff ? kListeningModeAutoStop : kListeningModeRealtime);
-        // Play the pop up sound to indicate the wake word is detected
-        audio_service_.PlaySound(Lang::Sounds::OGG_POPUP);
+            SetListeningMode(aec_mode_ == kAecOff ? kListeningModeAutoStop : kListeningModeRealtime);
+            // Play the pop up sound to indicate the wake word is detected
+            audio_service_.PlaySound(Lang::Sounds::OGG_POPUP);
 #endif
+        }, true);
     } else if (device_state_ == kDeviceStateSpeaking) {
         AbortSpeaking(kAbortReasonWakeWordDetected);
     } else if (device_state_ == kDeviceStateActivating) {
@@ -668,6 +737,41 @@ void Application::OnWakeWordDetected() {
     }
 }
 
+void Application::OpenAudioChannelThen(std::function<void()> on_ready, bool restart_wake_word) {
+    if (connection_.IsAudioChannelOpened()) {
+        on_ready();
+        return;
+    }
+    SetDeviceState(kDeviceStateConnecting);
+    // A warm-up in progress finishes in the background, the main loop keeps running meanwhile
+    connection_.OpenAudioChannel([this, on_ready = std::move(on_ready), restart_wake_word](bool opened) {
+        if (device_state_ != kDeviceStateConnecting) {
+            // An error or the user left the turn while the channel was opening
+            return;
+        }
+        if (!opened) {
+            // 连接失败，回滚状态到Idle，避免状态卡死
+            ESP_LOGW(TAG, "OpenAudioChannel失败，回滚状态到Idle");
+            SetDeviceState(kDeviceStateIdle);
+            if (restart_wake_word) {
+                audio_service_.EnableWakeWordDetection(true);
+            }
+            return;
+        }
+        on_ready();
+    });
+}
+
+void Application::OnEndOfSpeech() {
+    if (device_state_ != kDeviceStateListening || listening_mode_ != kListeningModeAutoStop || end_of_speech_tick_ >= 0) {
+        return;
+    }
+    // Stop the uplink and wait in listening state for the reply, as if the server VAD had ended the turn
+    protocol_->SendStopListening();
+    audio_service_.EnableVoiceProcessing(false);
+    end_of_speech_tick_ = clock_ticks_;
+}
+
 void Application::AbortSpeaking(AbortReason reason) {
     ESP_LOGI(TAG, "Abort speaking");
     aborted_ = true;
@@ -687,6 +791,7 @@ void Application::SetDeviceState(DeviceState state) {
     }
     
     clock_ticks_ = 0;
+    end_of_speech_tick_ = -1;
     auto previous_state = device_state_;
     device_state_ = state;
     ESP_LOGI(TAG, "STATE: %s", STATE_STRINGS[device_state_]);
@@ -703,6 +808,7 @@ void Application::SetDeviceState(DeviceState state) {
         case kDeviceStateIdle:
             display->SetStatus(Lang::Strings::STANDBY);
             display->SetEmotion("neutral");
+            connection_.OnIdle();
             audio_service_.EnableVoiceProcessing(false);
             audio_service_.EnableWakeWordDetection(true);
             break;
@@ -719,6 +825,7 @@ void Application::SetDeviceState(DeviceState state) {
             if (!audio_service_.IsAudioProcessorRunning()) {
                 // Send the start listening command
                 protocol_->SendStartListening(listening_mode_);
+                audio_service_.EnableEndpointing(listening_mode_ == kListeningModeAutoStop);
                 audio_service_.EnableVoiceProcessing(true);
                 audio_service_.EnableWakeWordDetection(false);
             }
@@ -742,8 +849,8 @@ void Application::SetDeviceState(DeviceState state) {
 void Application::Reboot() {
     ESP_LOGI(TAG, "Rebooting...");
     // Disconnect the audio channel
-    if (protocol_ && protocol_->IsAudioChannelOpened()) {
-        protocol_->CloseAudioChannel();
+    if (connection_.IsAudioChannelOpened()) {
+        connection_.CloseAudioChannel();
     }
     protocol_.reset();
     audio_service_.Stop();
@@ -761,9 +868,9 @@ bool Application::UpgradeFirmware(Ota& ota, const std::string& url) {
     std::string version_info = url.empty() ? ota.GetFirmwareVersion() : "(Manual upgrade)";
     
     // Close audio channel if it's open
-    if (protocol_ && protocol_->IsAudioChannelOpened()) {
+    if (connection_.IsAudioChannelOpened()) {
         ESP_LOGI(TAG, "Closing audio channel before firmware upgrade");
-        protocol_->CloseAudioChannel();
+        connection_.CloseAudioChannel();
     }
     ESP_LOGI(TAG, "Starting firmware upgrade from URL: %s", upgrade_url.c_str());
     
@@ -811,42 +918,35 @@ void Application::WakeWordInvoke(const std::string& wake_word) {
     }
 
     if (device_state_ == kDeviceStateIdle) {
+        connection_.OnTurnTriggered("wake word");
+        audio_service_.PrepareInput();
         audio_service_.EncodeWakeWord();
 
-        if (!protocol_->IsAudioChannelOpened()) {
-            SetDeviceState(kDeviceStateConnecting);
-            if (!protocol_->OpenAudioChannel()) {
-                // 连接失败，回滚状态到Idle，重新启用唤醒词检测
-                ESP_LOGW(TAG, "OpenAudioChannel失败，回滚状态到Idle");
-                SetDeviceState(kDeviceStateIdle);
-                audio_service_.EnableWakeWordDetection(true);
-                return;
-            }
-        }
-
-        ESP_LOGI(TAG, "Wake word detected: %s", wake_word.c_str());
+        OpenAudioChannelThen([this, wake_word]() {
+            ESP_LOGI(TAG, "Wake word detected: %s", wake_word.c_str());
 #if CONFIG_USE_AFE_WAKE_WORD || CONFIG_USE_CUSTOM_WAKE_WORD
-        // Encode and send the wake word data to the server
-        while (auto packet = audio_service_.PopWakeWordPacket()) {
-            protocol_->SendAudio(std::move(packet));
-        }
-        // Set the chat state to wake word detected
-        protocol_->SendWakeWordDetected(wake_word);
-        SetListeningMode(aec_mode_ == kAecOff ? kListeningModeAutoStop : kListeningModeRealtime);
+            // Encode and send the wake word data to the server
+            while (auto packet = audio_service_.PopWakeWordPacket()) {
+                if (protocol_->SendAudio(std::move(packet))) {
+                    connection_.OnAudioSent();
+                }
+            }
+            // Set the chat state to wake word detected
+            protocol_->SendWakeWordDetected(wake_word);
+            SetListeningMode(aec_mode_ == kAecOff ? kListeningModeAutoStop : kListeningModeRealtime);
 #else
-        SetListeningMode(aec_mode_ == kAecOff ? kListeningModeAutoStop : kListeningModeRealtime);
-        // Play the pop up sound to indicate the wake word is detected
-        audio_service_.PlaySound(Lang::Sounds::OGG_POPUP);
+            SetListeningMode(aec_mode_ == kAecOff ? kListeningModeAutoStop : kListeningModeRealtime);
+            // Play the pop up sound to indicate the wake word is detected
+            audio_service_.PlaySound(Lang::Sounds::OGG_POPUP);
 #endif
+        }, true);
     } else if (device_state_ == kDeviceStateSpeaking) {
         Schedule([this]() {
             AbortSpeaking(kAbortReasonNone);
         });
     } else if (device_state_ == kDeviceStateListening) {   
         Schedule([this]() {
-            if (protocol_) {
-                protocol_->CloseAudioChannel();
-            }
+            connection_.CloseAudioChannel();
         });
     }
 }
@@ -856,7 +956,7 @@ bool Application::CanEnterSleepMode() {
         return false;
     }
 
-    if (protocol_ && protocol_->IsAudioChannelOpened()) {
+    if (connection_.IsConnecting() || connection_.IsAudioChannelOpened()) {
         return false;
     }
 
@@ -874,11 +974,16 @@ void Application::SendMcpMessage(const std::string& payload) {
     }
 
     // Make sure you are using main thread to send MCP message
+    // A warm-up may be replacing the connection, the message goes out once it is done
     if (xTaskGetCurrentTaskHandle() == main_event_loop_task_handle_) {
-        protocol_->SendMcpMessage(payload);
+        connection_.WhenSettled([this, payload]() {
+            protocol_->SendMcpMessage(payload);
+        });
     } else {
         Schedule([this, payload = std::move(payload)]() {
-            protocol_->SendMcpMessage(payload);
+            connection_.WhenSettled([this, payload]() {
+                protocol_->SendMcpMessage(payload);
+            });
         });
     }
 }
@@ -904,8 +1009,8 @@ void Application::SetAecMode(AecMode mode) {
         }
 
         // If the AEC mode is changed, close the audio channel
-        if (protocol_ && protocol_->IsAudioChannelOpened()) {
-            protocol_->CloseAudioChannel();
+        if (connection_.IsAudioChannelOpened()) {
+            connection_.CloseAudioChannel();
         }
     });
 }
@@ -13,6 +13,7 @@
 #include <memory>
 
 #include "protocol.h"
+#include "connection_manager.h"
 #include "ota.h"
 #include "audio_service.h"
 #include "device_state_event.h"
@@ -25,6 +26,10 @@
 #define MAIN_EVENT_ERROR (1 << 4)
 #define MAIN_EVENT_CHECK_NEW_VERSION_DONE (1 << 5)
 #define MAIN_EVENT_CLOCK_TICK (1 << 6)
+#define MAIN_EVENT_END_OF_SPEECH (1 << 7)
+
+// Back to idle when the server does not answer a turn ended on the device within this time
+#define END_OF_SPEECH_RESPONSE_TIMEOUT_S 10
 
 // 主任务队列最大大小，防止内存耗尽
 #define MAX_MAIN_TASKS_QUEUE_SIZE 50
@@ -75,6 +80,7 @@ private:
     std::mutex mutex_;
     std::deque<std::function<void()>> main_tasks_;
     std::unique_ptr<Protocol> protocol_;
+    ConnectionManager connection_;
     EventGroupHandle_t event_group_ = nullptr;
     esp_timer_handle_t clock_timer_handle_ = nullptr;
     std::atomic<DeviceState> device_state_{kDeviceStateUnknown};
@@ -82,18 +88,26 @@ private:
     AecMode aec_mode_ = kAecOff;
     std::string last_error_message_;
     AudioService audio_service_;
+    // Packets sent together while the send queue is backed up, only used by the main event loop
+    std::vector<AudioStreamPacketPtr> send_batch_;
 
     bool has_server_time_ = false;
     std::atomic<bool> aborted_{false};
     int clock_ticks_ = 0;
+    // Clock tick of the turn ended on the device while listening, -1 if none
+    int end_of_speech_tick_ = -1;
     TaskHandle_t check_new_version_task_handle_ = nullptr;
     TaskHandle_t main_event_loop_task_handle_ = nullptr;
 
     void OnWakeWordDetected();
+    void OnEndOfSpeech();
     void CheckNewVersion(Ota& ota);
     void CheckAssetsVersion();
     void ShowActivationCode(const std::string& code, const std::string& message);
     void SetListeningMode(ListeningMode mode);
+    // Shows Connecting until the audio channel is open, then calls on_ready on the main task.
+    // Falls back to idle if the channel fails to open or the turn was left meanwhile
+    void OpenAudioChannelThen(std::function<void()> on_ready, bool restart_wake_word = false);
 };
 
 
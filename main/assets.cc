@@ -4,6 +4,7 @@
 #include "application.h"
 #include "lvgl_theme.h"
 #include "emote_display.h"
+#include "network_context.h"
 #ifdef HAVE_LVGL
 #include "display/lcd_display.h"
 #endif
@@ -384,6 +385,7 @@ bool Assets::Apply() {
 
 bool Assets::Download(std::string url, std::function<void(int progress, size_t speed)> progress_callback) {
     ESP_LOGI(TAG, "Downloading new version of assets from %s", url.c_str());
+    NetworkContext::GetInstance().AddHost(url);
     
     // 取消当前资源分区的内存映射
     if (mmap_handle_ != 0) {
@@ -0,0 +1,108 @@
+#include "adaptive_opus_encoder.h"
+
+#include <esp_log.h>
+
+#define TAG "AdaptiveOpusEncoder"
+#define MAX_OPUS_PACKET_BYTES 1500
+
+static const int kBitrateLevels[] = UPLINK_BITRATE_LEVELS;
+static const uint32_t kLevelCount = sizeof(kBitrateLevels) / sizeof(kBitrateLevels[0]);
+
+AdaptiveOpusEncoder::AdaptiveOpusEncoder(int sample_rate, int channels, int duration_ms)
+    : sample_rate_(sample_rate), channels_(channels), duration_ms_(duration_ms),
+      frame_size_(sample_rate / 1000 * channels * duration_ms) {
+    packet_buffer_.resize(MAX_OPUS_PACKET_BYTES);
+    int error;
+    audio_enc_ = opus_encoder_create(sample_rate, channels, OPUS_APPLICATION_VOIP, &error);
+    if (audio_enc_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to create audio encoder, error code: %d", error);
+    }
+}
+
+AdaptiveOpusEncoder::~AdaptiveOpusEncoder() {
+    if (audio_enc_ != nullptr) {
+        opus_encoder_destroy(audio_enc_);
+    }
+}
+
+bool AdaptiveOpusEncoder::Encode(std::vector<int16_t>&& pcm, std::vector<uint8_t>& opus) {
+    if (audio_enc_ == nullptr || pcm.size() != frame_size_) {
+        return false;
+    }
+    // Encode into the scratch buffer, the pooled packet only grows to the size of the frame
+    int ret = opus_encode(audio_enc_, pcm.data(), frame_size_, packet_buffer_.data(), packet_buffer_.size());
+    if (ret < 0) {
+        ESP_LOGE(TAG, "Failed to encode audio, error code: %d", ret);
+        return false;
+    }
+    opus.assign(packet_buffer_.begin(), packet_buffer_.begin() + ret);
+
+    stats_.frames++;
+    stats_.payload_bytes += ret;
+    if (ret <= 2) {
+        stats_.dtx_frames++;
+    }
+    return true;
+}
+
+void AdaptiveOpusEncoder::SetComplexity(int complexity) {
+    if (audio_enc_ != nullptr) {
+        opus_encoder_ctl(audio_enc_, OPUS_SET_COMPLEXITY(complexity));
+    }
+}
+
+void AdaptiveOpusEncoder::SetDtx(bool enable) {
+    if (audio_enc_ == nullptr || dtx_ == enable) {
+        return;
+    }
+    dtx_ = enable;
+    opus_encoder_ctl(audio_enc_, OPUS_SET_DTX(enable ? 1 : 0));
+}
+
+void AdaptiveOpusEncoder::Update(size_t queued_packets, size_t max_packets, bool send_failed) {
+    bool congested = send_failed || queued_packets * 100 > max_packets * UPLINK_CONGESTION_QUEUE_PERCENT;
+    if (congested) {
+        congested_ms_ += duration_ms_;
+        clear_ms_ = 0;
+        if (congested_ms_ >= UPLINK_STEP_DOWN_MS && stats_.level + 1 < kLevelCount) {
+            congested_ms_ = 0;
+            stats_.step_downs++;
+            ApplyLevel(stats_.level + 1);
+        }
+    } else {
+        clear_ms_ += duration_ms_;
+        congested_ms_ = 0;
+        if (clear_ms_ >= UPLINK_STEP_UP_MS && stats_.level > 0) {
+            clear_ms_ = 0;
+            ApplyLevel(stats_.level - 1);
+        }
+    }
+}
+
+void AdaptiveOpusEncoder::ResetState() {
+    if (audio_enc_ != nullptr) {
+        opus_encoder_ctl(audio_enc_, OPUS_RESET_STATE);
+    }
+    congested_ms_ = 0;
+    clear_ms_ = 0;
+}
+
+void AdaptiveOpusEncoder::SetFrameDuration(int duration_ms) {
+    duration_ms_ = duration_ms;
+    frame_size_ = sample_rate_ / 1000 * channels_ * duration_ms;
+    ResetState();
+}
+
+void AdaptiveOpusEncoder::ResetStats() {
+    uint32_t level = stats_.level;
+    stats_ = UplinkEncoderStats();
+    stats_.level = level;
+}
+
+void AdaptiveOpusEncoder::ApplyLevel(uint32_t level) {
+    stats_.level = level;
+    if (audio_enc_ != nullptr) {
+        opus_encoder_ctl(audio_enc_, OPUS_SET_BITRATE(kBitrateLevels[level]));
+    }
+    ESP_LOGI(TAG, "Uplink bitrate level %lu (%d bps)", (unsigned long)level, kBitrateLevels[level]);
+}
@@ -0,0 +1,71 @@
+#ifndef ADAPTIVE_OPUS_ENCODER_H
+#define ADAPTIVE_OPUS_ENCODER_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include <opus.h>
+
+// Uplink bitrate ladder, level 0 keeps the libopus default
+#define UPLINK_BITRATE_LEVELS { OPUS_AUTO, 12000, 9000, 6000 }
+// The send queue counts as congested above this fraction of its limit (in percent)
+#define UPLINK_CONGESTION_QUEUE_PERCENT 25
+// Consecutive frames needed before stepping the bitrate down / back up
+#define UPLINK_STEP_DOWN_MS 1000
+#define UPLINK_STEP_UP_MS 5000
+
+struct UplinkEncoderStats {
+    uint32_t frames = 0;
+    uint32_t dtx_frames = 0;      // Frames encoded as DTX (2 bytes or less)
+    uint32_t payload_bytes = 0;
+    uint32_t level = 0;           // Current index in UPLINK_BITRATE_LEVELS
+    uint32_t step_downs = 0;
+};
+
+/*
+ * Uplink Opus encoder that lowers its bitrate while the send path backs up.
+ *
+ * OpusEncoderWrapper does not expose the bitrate, so this class drives libopus directly.
+ * Call Update() once per frame with the send queue depth, the level steps down after
+ * UPLINK_STEP_DOWN_MS of congestion and back up after UPLINK_STEP_UP_MS without it.
+ * Only the opus encode task uses it.
+ */
+class AdaptiveOpusEncoder {
+public:
+    AdaptiveOpusEncoder(int sample_rate, int channels, int duration_ms);
+    ~AdaptiveOpusEncoder();
+
+    AdaptiveOpusEncoder(const AdaptiveOpusEncoder&) = delete;
+    AdaptiveOpusEncoder& operator=(const AdaptiveOpusEncoder&) = delete;
+
+    bool Encode(std::vector<int16_t>&& pcm, std::vector<uint8_t>& opus);
+    void SetComplexity(int complexity);
+    void SetDtx(bool enable);
+    void Update(size_t queued_packets, size_t max_packets, bool send_failed);
+    void ResetState();
+    // Opus takes the frame size per call, so a new duration keeps the encoder and only resets its state
+    void SetFrameDuration(int duration_ms);
+    // Start the counters of a new session, the bitrate level is kept
+    void ResetStats();
+
+    inline int duration_ms() const { return duration_ms_; }
+    inline size_t frame_size() const { return frame_size_; }
+    inline const UplinkEncoderStats& stats() const { return stats_; }
+
+private:
+    OpusEncoder* audio_enc_ = nullptr;
+    int sample_rate_;
+    int channels_;
+    int duration_ms_;
+    size_t frame_size_;
+    bool dtx_ = false;
+    int congested_ms_ = 0;
+    int clear_ms_ = 0;
+    UplinkEncoderStats stats_;
+    std::vector<uint8_t> packet_buffer_;
+
+    void ApplyLevel(uint32_t level);
+};
+
+#endif // ADAPTIVE_OPUS_ENCODER_H
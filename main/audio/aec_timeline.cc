@@ -0,0 +1,165 @@
+#include "aec_timeline.h"
+
+#if CONFIG_USE_SERVER_AEC
+
+#include <esp_log.h>
+#include <algorithm>
+
+#define TAG "AecTimeline"
+
+void SampleClock::Reset(int sample_rate) {
+    sample_rate_ = sample_rate;
+    valid_ = false;
+    drift_ppm_ = 0;
+}
+
+void SampleClock::Resync(int64_t time_us, int64_t position) {
+    if (valid_) {
+        resyncs_++;
+    }
+    valid_ = true;
+    base_time_us_ = time_us;
+    base_position_q16_ = position * 65536;
+    // A resync point may be an estimate, the baseline starts at the next real observation
+    anchor_time_us_ = 0;
+}
+
+int64_t SampleClock::PositionAtQ16(int64_t time_us) const {
+    int64_t elapsed = time_us - base_time_us_;
+    int64_t samples_q16 = elapsed * 65536 / 1000000 * sample_rate_;
+    return base_position_q16_ + samples_q16 + samples_q16 / 1000000 * drift_ppm_;
+}
+
+int64_t SampleClock::PositionAt(int64_t time_us) const {
+    return PositionAtQ16(time_us) >> 16;
+}
+
+int64_t SampleClock::TimeAt(int64_t position) const {
+    int64_t elapsed = (position * 65536 - base_position_q16_) * 1000000 / sample_rate_ >> 16;
+    return base_time_us_ + elapsed - elapsed * drift_ppm_ / 1000000;
+}
+
+void SampleClock::Update(int64_t time_us, int64_t position) {
+    if (!valid_) {
+        Resync(time_us, position);
+        return;
+    }
+    int64_t predicted_q16 = PositionAtQ16(time_us);
+    int64_t error_q16 = position * 65536 - predicted_q16;
+    if (std::abs(error_q16 >> 16) > static_cast<int64_t>(sample_rate_) * AEC_TIMELINE_RESYNC_MS / 1000) {
+        Resync(time_us, position);
+        return;
+    }
+
+    // Jitter of a single observation is a few ms, so the rate is only measured over a long baseline
+    int64_t baseline_us = time_us - anchor_time_us_;
+    if (anchor_time_us_ == 0) {
+        anchor_time_us_ = time_us;
+        anchor_position_ = position;
+    } else if (baseline_us >= AEC_TIMELINE_DRIFT_BASELINE_MS * 1000) {
+        int64_t nominal = baseline_us * sample_rate_ / 1000000;
+        int64_t ppm = (position - anchor_position_ - nominal) * 1000000 / nominal;
+        drift_ppm_ = std::clamp<int64_t>(ppm, -AEC_TIMELINE_MAX_DRIFT_PPM, AEC_TIMELINE_MAX_DRIFT_PPM);
+    }
+    base_time_us_ = time_us;
+    base_position_q16_ = predicted_q16 + error_q16 / 8;
+}
+
+void AecTimeline::Reset(int output_sample_rate, int dma_desc_num, int dma_frame_num) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    output_sample_rate_ = output_sample_rate;
+    dma_desc_num_ = dma_desc_num;
+    dma_frame_num_ = dma_frame_num;
+    playback_clock_.Reset(output_sample_rate);
+    capture_clock_.Reset(16000);
+    written_ = 0;
+    captured_ = 0;
+    processed_ = 0;
+    segment_count_ = 0;
+    segment_next_ = 0;
+    stats_ = AecTimelineStats();
+}
+
+void AecTimeline::ResetCapture() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    capture_clock_.Reset(16000);
+    captured_ = 0;
+    processed_ = 0;
+}
+
+void AecTimeline::OnPlayed(uint32_t timestamp, size_t samples, int64_t start_us, int64_t end_us) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    int64_t duration_us = static_cast<int64_t>(samples) * 1000000 / output_sample_rate_;
+    int64_t buffer_us = static_cast<int64_t>(dma_frame_num_) * 1000000 / output_sample_rate_;
+    bool blocked = end_us - start_us >= duration_us / 2;
+    if (!blocked && playback_clock_.valid() && playback_clock_.PositionAt(start_us) >= written_) {
+        // The output had run dry, the block plays after the DMA buffer that is being sent now.
+        // The silence until then counts as played samples, so frames captured during the pause
+        // fall between segments. The start is an estimate, so the drift baseline restarts
+        written_ = playback_clock_.PositionAt(end_us + buffer_us);
+        playback_clock_.Resync(end_us + buffer_us, written_);
+    }
+
+    int64_t start = written_;
+    written_ += samples;
+    if (timestamp != 0) {
+        segments_[segment_next_] = {start, static_cast<uint32_t>(samples), timestamp};
+        segment_next_ = (segment_next_ + 1) % AEC_TIMELINE_SEGMENTS;
+        segment_count_ = std::min<size_t>(segment_count_ + 1, AEC_TIMELINE_SEGMENTS);
+    }
+
+    if (blocked) {
+        // The write waited for room, the DMA is full behind the last sample written
+        playback_clock_.Update(end_us, written_ - dma_desc_num_ * dma_frame_num_);
+    } else if (!playback_clock_.valid()) {
+        playback_clock_.Resync(end_us + buffer_us, start);
+    }
+}
+
+void AecTimeline::OnCaptured(size_t samples, int64_t start_us, int64_t end_us) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    captured_ += samples;
+    int64_t duration_us = static_cast<int64_t>(samples) * 1000000 / 16000;
+    if (end_us - start_us >= duration_us / 2 || !capture_clock_.valid()) {
+        // The read waited for the DMA, its newest sample was captured just now
+        capture_clock_.Update(end_us, captured_);
+    }
+}
+
+uint32_t AecTimeline::OnProcessed(size_t samples) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    int64_t first = processed_;
+    processed_ += samples;
+    stats_.frames++;
+    if (!capture_clock_.valid() || !playback_clock_.valid()) {
+        return 0;
+    }
+
+    int64_t position = playback_clock_.PositionAt(capture_clock_.TimeAt(first));
+    if (position >= written_) {
+        // Everything written had been played, only the DMA silence was audible
+        return 0;
+    }
+    for (size_t i = 0; i < segment_count_; i++) {
+        auto& segment = segments_[(segment_next_ + AEC_TIMELINE_SEGMENTS - 1 - i) % AEC_TIMELINE_SEGMENTS];
+        if (position >= segment.start && position < segment.start + segment.samples) {
+            stats_.stamped_frames++;
+            return segment.timestamp + static_cast<uint32_t>((position - segment.start) * 1000 / output_sample_rate_);
+        }
+        if (position > segment.start) {
+            break;
+        }
+    }
+    return 0;
+}
+
+AecTimelineStats AecTimeline::stats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    AecTimelineStats stats = stats_;
+    stats.playback_drift_ppm = playback_clock_.drift_ppm();
+    stats.capture_drift_ppm = capture_clock_.drift_ppm();
+    stats.resyncs = playback_clock_.resyncs() + capture_clock_.resyncs();
+    return stats;
+}
+
+#endif // CONFIG_USE_SERVER_AEC
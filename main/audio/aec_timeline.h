@@ -0,0 +1,113 @@
+#ifndef AEC_TIMELINE_H
+#define AEC_TIMELINE_H
+
+#include <sdkconfig.h>
+#include <cstdint>
+#include <cstddef>
+
+#if CONFIG_USE_SERVER_AEC
+
+#include <mutex>
+
+// Played blocks remembered, far more than the capture to encode delay needs
+#define AEC_TIMELINE_SEGMENTS 32
+// An observation further off than this restarts a clock instead of steering it
+#define AEC_TIMELINE_RESYNC_MS 100
+#define AEC_TIMELINE_MAX_DRIFT_PPM 2000
+// Drift is measured between the last resync and now once they are this far apart
+#define AEC_TIMELINE_DRIFT_BASELINE_MS 5000
+
+/*
+ * Maps sample positions of one stream to esp_timer time and back.
+ *
+ * Each block handed to or taken from the I2S DMA gives an observation (time, position).
+ * The phase follows them by an eighth of the error, which smooths the scheduling jitter of
+ * single blocks. The rate (drift against esp_timer, in ppm) comes from the samples counted
+ * since the last resync, a baseline long enough for the jitter to not matter.
+ */
+class SampleClock {
+public:
+    void Reset(int sample_rate);
+    void Update(int64_t time_us, int64_t position);
+    // Restart at a known point, keeps the drift estimate
+    void Resync(int64_t time_us, int64_t position);
+    int64_t PositionAt(int64_t time_us) const;
+    int64_t TimeAt(int64_t position) const;
+
+    bool valid() const { return valid_; }
+    int32_t drift_ppm() const { return drift_ppm_; }
+    uint32_t resyncs() const { return resyncs_; }
+
+private:
+    int sample_rate_ = 16000;
+    bool valid_ = false;
+    int64_t base_time_us_ = 0;
+    int64_t base_position_q16_ = 0;     // Sub-sample precision, so rounding does not add up to drift
+    int64_t anchor_time_us_ = 0;
+    int64_t anchor_position_ = 0;
+    int32_t drift_ppm_ = 0;
+    uint32_t resyncs_ = 0;
+
+    int64_t PositionAtQ16(int64_t time_us) const;
+};
+
+struct AecTimelineStats {
+    int32_t playback_drift_ppm = 0;
+    int32_t capture_drift_ppm = 0;
+    uint32_t resyncs = 0;
+    uint32_t stamped_frames = 0;        // Uplink frames that overlapped TTS playback
+    uint32_t frames = 0;
+};
+
+/*
+ * Playback reference positions for server side AEC.
+ *
+ * The output task reports every block it wrote with the server timestamp it came with, the
+ * input task every block the audio processor got. Both streams get a SampleClock against
+ * esp_timer. A blocking write means the output DMA is full, so the audible sample is the
+ * DMA depth behind the last one written; a blocking read means the newest input sample was
+ * just captured. Writes and reads that did not block tell nothing about the DMA fill level
+ * and only advance the counters.
+ *
+ * The DMA depth comes from the codec, as a number of buffers of dma_frame_num samples each.
+ *
+ * For each processed uplink frame, OnProcessed() takes the capture time of its first
+ * sample, looks up which playback sample was audible at that moment and returns the server
+ * timestamp of that position in ms, interpolated within its packet.
+ */
+class AecTimeline {
+public:
+    void Reset(int output_sample_rate, int dma_desc_num, int dma_frame_num);
+    // The audio processor restarts, its output starts over at the next captured sample
+    void ResetCapture();
+    void OnPlayed(uint32_t timestamp, size_t samples, int64_t start_us, int64_t end_us);
+    void OnCaptured(size_t samples, int64_t start_us, int64_t end_us);
+    // Reference timestamp for the next processed frame, 0 if no TTS was audible
+    uint32_t OnProcessed(size_t samples);
+    AecTimelineStats stats();
+
+private:
+    struct Segment {
+        int64_t start = 0;
+        uint32_t samples = 0;
+        uint32_t timestamp = 0;
+    };
+
+    std::mutex mutex_;
+    int output_sample_rate_ = 16000;
+    int dma_desc_num_ = 0;
+    int dma_frame_num_ = 0;
+    SampleClock playback_clock_;
+    SampleClock capture_clock_;
+    int64_t written_ = 0;
+    int64_t captured_ = 0;
+    int64_t processed_ = 0;
+    Segment segments_[AEC_TIMELINE_SEGMENTS];
+    size_t segment_count_ = 0;
+    size_t segment_next_ = 0;
+    AecTimelineStats stats_;
+};
+
+#endif // CONFIG_USE_SERVER_AEC
+
+#endif // AEC_TIMELINE_H
@@ -3,6 +3,7 @@
 #include "settings.h"
 
 #include <esp_log.h>
+#include <esp_timer.h>
 #include <cstring>
 #include <driver/i2s_common.h>
 
@@ -65,6 +66,9 @@ void AudioCodec::EnableInput(bool enable) {
         return;
     }
     input_enabled_ = enable;
+    if (enable) {
+        input_enable_time_us_ = esp_timer_get_time();
+    }
     ESP_LOGI(TAG, "Set input enable to %s", enable ? "true" : "false");
 }
 
@@ -13,6 +13,8 @@
 
 #define AUDIO_CODEC_DMA_DESC_NUM 6
 #define AUDIO_CODEC_DMA_FRAME_NUM 240
+// Input settle time of codecs that do not set their own, the former fixed warm-up delay
+#define AUDIO_CODEC_DEFAULT_INPUT_SETTLE_MS 120
 
 class AudioCodec {
 public:
@@ -38,6 +40,9 @@ public:
     inline float input_gain() const { return input_gain_; }
     inline bool input_enabled() const { return input_enabled_; }
     inline bool output_enabled() const { return output_enabled_; }
+    // Samples read before input_enable_time_us() + input_settle_ms() are not valid yet
+    inline int input_settle_ms() const { return input_settle_ms_; }
+    inline int64_t input_enable_time_us() const { return input_enable_time_us_; }
 
 protected:
     i2s_chan_handle_t tx_handle_ = nullptr;
@@ -53,6 +58,8 @@ protected:
     int output_channels_ = 1;
     int output_volume_ = 70;
     float input_gain_ = 0.0;
+    int input_settle_ms_ = AUDIO_CODEC_DEFAULT_INPUT_SETTLE_MS;
+    int64_t input_enable_time_us_ = 0;
 
     virtual int Read(int16_t* dest, int samples) = 0;
     virtual int Write(const int16_t* data, int samples) = 0;
@@ -0,0 +1,60 @@
+#include "audio_mixer.h"
+
+#include <esp_log.h>
+#include <algorithm>
+
+#define TAG "AudioMixer"
+
+bool AudioMixer::Play(AudioMixerVoice voice, const PromptSound* sound) {
+    auto& v = voices_[voice];
+    if (v.count == AUDIO_MIXER_VOICE_QUEUE) {
+        ESP_LOGW(TAG, "Voice %d is full, sound dropped", voice);
+        return false;
+    }
+    v.queue[(v.head + v.count) % AUDIO_MIXER_VOICE_QUEUE] = sound;
+    v.count++;
+    queued_sounds_++;
+    return true;
+}
+
+void AudioMixer::SetGain(AudioMixerVoice voice, int32_t gain_q15) {
+    voices_[voice].gain_q15 = gain_q15;
+}
+
+void AudioMixer::Mix(int16_t* pcm, size_t samples) {
+    // Duck the main signal while an alert plays, ramping over the block to avoid clicks
+    bool ducked = voices_[kAudioMixerVoiceAlert].count > 0;
+    int32_t duck_target = ducked ? AUDIO_MIXER_DUCK_GAIN_Q15 : AUDIO_MIXER_UNITY_GAIN_Q15;
+    ApplyGainRampS16(pcm, samples, duck_gain_q15_, duck_target);
+    duck_gain_q15_ = duck_target;
+
+    for (int i = 0; i < kAudioMixerVoiceCount; i++) {
+        auto& v = voices_[i];
+        int32_t gain = i == kAudioMixerVoiceAlert ? v.gain_q15 : (v.gain_q15 * duck_gain_q15_) >> 15;
+        // A sound that ends inside the block is followed by the next one of the same voice
+        size_t mixed = 0;
+        while (mixed < samples && v.count > 0) {
+            const PromptSound* sound = v.queue[v.head];
+            size_t count = std::min(samples - mixed, sound->samples - v.offset);
+            MixSaturateS16(pcm + mixed, sound->pcm + v.offset, count, gain);
+            mixed += count;
+            v.offset += count;
+            if (v.offset >= sound->samples) {
+                v.head = (v.head + 1) % AUDIO_MIXER_VOICE_QUEUE;
+                v.count--;
+                v.offset = 0;
+                queued_sounds_--;
+            }
+        }
+    }
+}
+
+void AudioMixer::Clear() {
+    for (auto& v : voices_) {
+        v.head = 0;
+        v.count = 0;
+        v.offset = 0;
+    }
+    queued_sounds_ = 0;
+    duck_gain_q15_ = AUDIO_MIXER_UNITY_GAIN_Q15;
+}
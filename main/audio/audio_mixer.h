@@ -0,0 +1,58 @@
+#ifndef AUDIO_MIXER_H
+#define AUDIO_MIXER_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+#include "prompt_sound_cache.h"
+#include "sample_kernels.h"
+
+// Sounds waiting on one voice, played one after another
+#define AUDIO_MIXER_VOICE_QUEUE 8
+// Length of a frame when only prompt sounds are playing
+#define AUDIO_MIXER_FRAME_MS 20
+// Gain of everything else while the alert voice plays (Q15, about -12 dB)
+#define AUDIO_MIXER_DUCK_GAIN_Q15 8192
+#define AUDIO_MIXER_UNITY_GAIN_Q15 32768
+
+enum AudioMixerVoice {
+    kAudioMixerVoicePrompt,
+    kAudioMixerVoiceAlert,     // Priority voice, ducks the main signal and the prompt voice
+    kAudioMixerVoiceCount,
+};
+
+/*
+ * Mixes cached prompt sounds into the PCM that goes to AudioCodec::OutputData().
+ *
+ * The main signal (TTS) is the buffer passed to Mix(). Each voice plays its queued sounds in
+ * order with its own gain and is added on top of the main signal, so a prompt never waits
+ * for the TTS to finish. While the alert voice plays, the main signal and the prompt voice
+ * are ducked to AUDIO_MIXER_DUCK_GAIN_Q15.
+ *
+ * Only the audio output task uses the mixer, Active() may be read from any task.
+ */
+class AudioMixer {
+public:
+    // Returns false if the voice queue is full
+    bool Play(AudioMixerVoice voice, const PromptSound* sound);
+    void SetGain(AudioMixerVoice voice, int32_t gain_q15);
+    void Mix(int16_t* pcm, size_t samples);
+    void Clear();
+    bool Active() const { return queued_sounds_ > 0; }
+
+private:
+    struct Voice {
+        const PromptSound* queue[AUDIO_MIXER_VOICE_QUEUE] = {};
+        size_t head = 0;
+        size_t count = 0;
+        size_t offset = 0;   // Read position in queue[head]
+        int32_t gain_q15 = AUDIO_MIXER_UNITY_GAIN_Q15;
+    };
+
+    Voice voices_[kAudioMixerVoiceCount];
+    std::atomic<int> queued_sounds_{0};
+    int32_t duck_gain_q15_ = AUDIO_MIXER_UNITY_GAIN_Q15;
+};
+
+#endif // AUDIO_MIXER_H
@@ -0,0 +1,397 @@
+#include "audio_recorder.h"
+
+#if CONFIG_USE_AUDIO_DEBUGGER
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <errno.h>
+#include <cstring>
+#include <string>
+#include <algorithm>
+
+#define TAG "AudioRecorder"
+
+// The Opus task encodes for every tap, so it gets the stack of an Opus encoder
+#define AUDIO_RECORDER_ENCODE_TASK_STACK_SIZE (4096 * 7)
+
+static const char* const kTapNames[kAudioTapCount] = {
+    "mic",
+    "processed",
+    "decoded",
+    "speaker",
+};
+
+bool AudioRecorder::Start(uint32_t taps, bool opus) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (dumping_) {
+        ESP_LOGW(TAG, "Dump in progress, not started");
+        return false;
+    }
+    if (ring_ == nullptr) {
+        ring_size_ = CONFIG_AUDIO_RECORDER_BUFFER_KB * 1024;
+        ring_ = (uint8_t*)heap_caps_malloc(ring_size_, MALLOC_CAP_SPIRAM);
+        if (ring_ == nullptr) {
+            ESP_LOGE(TAG, "Failed to allocate %u bytes for the recorder buffer", ring_size_);
+            ring_size_ = 0;
+            return false;
+        }
+    }
+    if (opus && !StartEncodeTask()) {
+        return false;
+    }
+    if (opus != opus_) {
+        // A tap stream never mixes formats
+        for (auto& state : tap_states_) {
+            state.encoder.reset();
+            state.frame.clear();
+        }
+        ring_read_ = 0;
+        ring_used_ = 0;
+        records_ = 0;
+        opus_ = opus;
+    }
+    selected_taps_ = taps & ((1u << kAudioTapCount) - 1);
+    taps_ = selected_taps_;
+    ESP_LOGI(TAG, "Recording taps 0x%lx as %s into %u KB", selected_taps_, opus_ ? "opus" : "pcm", ring_size_ / 1024);
+    return true;
+}
+
+bool AudioRecorder::StartEncodeTask() {
+    if (encode_task_ != nullptr) {
+        return true;
+    }
+    staging_ = (uint8_t*)heap_caps_malloc(AUDIO_RECORDER_STAGING_BYTES, MALLOC_CAP_SPIRAM);
+    encode_task_stack_ = (StackType_t*)heap_caps_malloc(AUDIO_RECORDER_ENCODE_TASK_STACK_SIZE, MALLOC_CAP_SPIRAM);
+    encode_task_buffer_ = (StaticTask_t*)heap_caps_malloc(sizeof(StaticTask_t), MALLOC_CAP_INTERNAL);
+    if (staging_ == nullptr || encode_task_stack_ == nullptr || encode_task_buffer_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate the Opus task of the recorder");
+        heap_caps_free(staging_);
+        heap_caps_free(encode_task_stack_);
+        heap_caps_free(encode_task_buffer_);
+        staging_ = nullptr;
+        encode_task_stack_ = nullptr;
+        encode_task_buffer_ = nullptr;
+        return false;
+    }
+
+    // Below the audio tasks, a busy recorder drops staged frames instead of delaying the pipeline
+    encode_task_ = xTaskCreateStatic([](void* arg) {
+        auto this_ = (AudioRecorder*)arg;
+        this_->EncodeTask();
+        vTaskDelete(NULL);
+    }, "audio_recorder", AUDIO_RECORDER_ENCODE_TASK_STACK_SIZE, this, 2, encode_task_stack_, encode_task_buffer_);
+    return true;
+}
+
+bool AudioRecorder::StartConfigured() {
+    uint32_t taps = 0;
+#if CONFIG_AUDIO_RECORDER_TAP_MIC
+    taps |= 1u << kAudioTapMic;
+#endif
+#if CONFIG_AUDIO_RECORDER_TAP_PROCESSED
+    taps |= 1u << kAudioTapProcessed;
+#endif
+#if CONFIG_AUDIO_RECORDER_TAP_DECODED
+    taps |= 1u << kAudioTapDecoded;
+#endif
+#if CONFIG_AUDIO_RECORDER_TAP_SPEAKER
+    taps |= 1u << kAudioTapSpeaker;
+#endif
+#if CONFIG_AUDIO_RECORDER_OPUS
+    return Start(taps, true);
+#else
+    return Start(taps, false);
+#endif
+}
+
+uint32_t AudioRecorder::ParseTaps(const std::string& names) {
+    uint32_t taps = 0;
+    for (int i = 0; i < kAudioTapCount; i++) {
+        if (names.find(kTapNames[i]) != std::string::npos) {
+            taps |= 1u << i;
+        }
+    }
+    return taps;
+}
+
+void AudioRecorder::Stop() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    selected_taps_ = 0;
+    taps_ = 0;
+}
+
+void AudioRecorder::Record(AudioTap tap, const int16_t* pcm, size_t samples, int sample_rate, int channels) {
+    uint32_t tap_bit = 1u << tap;
+    if ((taps_.load() & tap_bit) == 0 || samples == 0) {
+        return;
+    }
+    uint32_t now_ms = esp_timer_get_time() / 1000;
+    if (opus_) {
+        // The calling audio task only copies the frame, the Opus task compresses it
+        Stage(tap, pcm, samples, sample_rate, channels, now_ms);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    // Dump() may have paused recording since the check above, it reads the ring without the lock
+    if (dumping_ || (taps_.load() & tap_bit) == 0) {
+        return;
+    }
+    RecordPcm(tap, PrepareTap(tap, sample_rate, channels), pcm, samples, now_ms);
+}
+
+void AudioRecorder::Stage(AudioTap tap, const int16_t* pcm, size_t samples, int sample_rate, int channels, uint32_t now_ms) {
+    StagedChunk chunk = {
+        .tap = static_cast<uint8_t>(tap),
+        .channels = static_cast<uint8_t>(channels),
+        .reserved = 0,
+        .sample_rate = static_cast<uint32_t>(sample_rate),
+        .timestamp_ms = now_ms,
+        .samples = static_cast<uint32_t>(samples),
+    };
+    size_t size = sizeof(chunk) + samples * sizeof(int16_t);
+    {
+        std::lock_guard<std::mutex> lock(staging_mutex_);
+        if (staging_used_ + size > AUDIO_RECORDER_STAGING_BYTES) {
+            staging_drops_++;
+            return;
+        }
+        size_t write = (staging_read_ + staging_used_) % AUDIO_RECORDER_STAGING_BYTES;
+        CopyIn(staging_, AUDIO_RECORDER_STAGING_BYTES, write, &chunk, sizeof(chunk));
+        CopyIn(staging_, AUDIO_RECORDER_STAGING_BYTES, (write + sizeof(chunk)) % AUDIO_RECORDER_STAGING_BYTES,
+            pcm, samples * sizeof(int16_t));
+        staging_used_ += size;
+    }
+    xTaskNotifyGive(encode_task_);
+}
+
+void AudioRecorder::EncodeTask() {
+    std::vector<int16_t> pcm;
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        while (true) {
+            StagedChunk chunk;
+            {
+                std::lock_guard<std::mutex> lock(staging_mutex_);
+                if (staging_used_ == 0) {
+                    break;
+                }
+                CopyOut(staging_, AUDIO_RECORDER_STAGING_BYTES, staging_read_, &chunk, sizeof(chunk));
+                pcm.resize(chunk.samples);
+                CopyOut(staging_, AUDIO_RECORDER_STAGING_BYTES, (staging_read_ + sizeof(chunk)) % AUDIO_RECORDER_STAGING_BYTES,
+                    pcm.data(), chunk.samples * sizeof(int16_t));
+                size_t size = sizeof(chunk) + chunk.samples * sizeof(int16_t);
+                staging_read_ = (staging_read_ + size) % AUDIO_RECORDER_STAGING_BYTES;
+                staging_used_ -= size;
+            }
+
+            // Only this task encodes, so holding the lock here never blocks an audio task
+            std::lock_guard<std::mutex> lock(mutex_);
+            AudioTap tap = static_cast<AudioTap>(chunk.tap);
+            if (dumping_ || !opus_ || (selected_taps_ & (1u << tap)) == 0) {
+                continue;
+            }
+            RecordOpus(tap, PrepareTap(tap, chunk.sample_rate, chunk.channels), pcm.data(), pcm.size(), chunk.timestamp_ms);
+        }
+    }
+}
+
+AudioRecorder::TapState& AudioRecorder::PrepareTap(AudioTap tap, int sample_rate, int channels) {
+    auto& state = tap_states_[tap];
+    if (state.sample_rate != sample_rate || state.channels != channels) {
+        state.encoder.reset();
+        state.frame.clear();
+        state.sample_rate = sample_rate;
+        state.channels = channels;
+    }
+    return state;
+}
+
+void AudioRecorder::RecordPcm(AudioTap tap, TapState& state, const int16_t* pcm, size_t samples, uint32_t now_ms) {
+    // Whole frames only, so every record starts on the first channel
+    size_t max_samples = AUDIO_RECORDER_MAX_PAYLOAD / sizeof(int16_t) / state.channels * state.channels;
+    for (size_t offset = 0; offset < samples; offset += max_samples) {
+        size_t count = std::min(samples - offset, max_samples);
+        uint32_t timestamp_ms = now_ms + offset / state.channels * 1000 / state.sample_rate;
+        Append(tap, state, AUDIO_RECORD_FORMAT_PCM, timestamp_ms, pcm + offset, count * sizeof(int16_t));
+    }
+}
+
+void AudioRecorder::RecordOpus(AudioTap tap, TapState& state, const int16_t* pcm, size_t samples, uint32_t now_ms) {
+    size_t frame_samples = state.sample_rate / 1000 * AUDIO_RECORDER_OPUS_FRAME_MS * state.channels;
+    if (state.encoder == nullptr) {
+        state.encoder = std::make_unique<OpusEncoderWrapper>(state.sample_rate, state.channels, AUDIO_RECORDER_OPUS_FRAME_MS);
+        state.encoder->SetComplexity(0); // 0 is the fastest
+    }
+
+    size_t offset = 0;
+    while (offset < samples) {
+        if (state.frame.empty()) {
+            state.frame.reserve(frame_samples);
+            state.frame_time_ms = now_ms + offset / state.channels * 1000 / state.sample_rate;
+        }
+        size_t count = std::min(samples - offset, frame_samples - state.frame.size());
+        state.frame.insert(state.frame.end(), pcm + offset, pcm + offset + count);
+        offset += count;
+        if (state.frame.size() < frame_samples) {
+            break;
+        }
+        bool encoded = state.encoder->Encode(std::move(state.frame), opus_packet_);
+        state.frame.clear();
+        if (encoded) {
+            Append(tap, state, AUDIO_RECORD_FORMAT_OPUS, state.frame_time_ms, opus_packet_.data(), opus_packet_.size());
+        }
+    }
+}
+
+void AudioRecorder::Append(AudioTap tap, TapState& state, uint8_t format, uint32_t timestamp_ms, const void* payload, size_t size) {
+    AudioRecordHeader header = {
+        .magic = AUDIO_RECORD_MAGIC,
+        .tap = static_cast<uint8_t>(tap),
+        .format = format,
+        .channels = static_cast<uint8_t>(state.channels),
+        .sample_rate = static_cast<uint16_t>(state.sample_rate),
+        .payload_size = static_cast<uint16_t>(size),
+        .sequence = state.sequence++,
+        .timestamp_ms = timestamp_ms,
+    };
+    size_t record_size = sizeof(header) + size;
+    if (record_size > ring_size_) {
+        return;
+    }
+
+    // Make room by dropping the oldest records
+    while (ring_used_ + record_size > ring_size_) {
+        AudioRecordHeader oldest;
+        CopyOut(ring_, ring_size_, ring_read_, &oldest, sizeof(oldest));
+        size_t oldest_size = sizeof(oldest) + oldest.payload_size;
+        ring_read_ = (ring_read_ + oldest_size) % ring_size_;
+        ring_used_ -= oldest_size;
+        records_--;
+        overwritten_records_++;
+    }
+    size_t write = (ring_read_ + ring_used_) % ring_size_;
+    CopyIn(ring_, ring_size_, write, &header, sizeof(header));
+    CopyIn(ring_, ring_size_, (write + sizeof(header)) % ring_size_, payload, size);
+    ring_used_ += record_size;
+    records_++;
+}
+
+void AudioRecorder::CopyIn(uint8_t* ring, size_t ring_size, size_t offset, const void* data, size_t size) {
+    size_t first = std::min(size, ring_size - offset);
+    memcpy(ring + offset, data, first);
+    memcpy(ring, static_cast<const uint8_t*>(data) + first, size - first);
+}
+
+void AudioRecorder::CopyOut(const uint8_t* ring, size_t ring_size, size_t offset, void* data, size_t size) {
+    size_t first = std::min(size, ring_size - offset);
+    memcpy(data, ring + offset, first);
+    memcpy(static_cast<uint8_t*>(data) + first, ring, size - first);
+}
+
+int AudioRecorder::Dump() {
+    // 解析配置的服务器地址 "IP:PORT"
+    std::string server_addr = CONFIG_AUDIO_DEBUG_UDP_SERVER;
+    size_t colon_pos = server_addr.find(':');
+    if (colon_pos == std::string::npos) {
+        ESP_LOGW(TAG, "Invalid server address: %s, should be IP:PORT", CONFIG_AUDIO_DEBUG_UDP_SERVER);
+        return -1;
+    }
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(std::stoi(server_addr.substr(colon_pos + 1)));
+    inet_pton(AF_INET, server_addr.substr(0, colon_pos).c_str(), &addr.sin_addr);
+
+    int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sockfd < 0) {
+        ESP_LOGW(TAG, "Failed to create UDP socket: %d", errno);
+        return -1;
+    }
+
+    size_t read;
+    size_t used;
+    {
+        // Recording pauses, so the ring can be read without holding the lock.
+        // Record() and the Opus task check dumping_ again once they hold it
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (dumping_) {
+            close(sockfd);
+            return -1;
+        }
+        dumping_ = true;
+        taps_ = 0;
+        read = ring_read_;
+        used = ring_used_;
+    }
+
+    std::vector<uint8_t> datagram(sizeof(AudioRecordHeader) + std::max(AUDIO_RECORDER_MAX_PAYLOAD, MAX_OPUS_PACKET_SIZE));
+    int sent_records = 0;
+    int datagrams = 0;
+    while (used > 0) {
+        AudioRecordHeader header;
+        CopyOut(ring_, ring_size_, read, &header, sizeof(header));
+        size_t record_size = sizeof(header) + header.payload_size;
+        CopyOut(ring_, ring_size_, read, datagram.data(), record_size);
+        read = (read + record_size) % ring_size_;
+        used -= record_size;
+
+        if (sendto(sockfd, datagram.data(), record_size, 0, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+            ESP_LOGW(TAG, "Failed to send audio record to %s: %d", CONFIG_AUDIO_DEBUG_UDP_SERVER, errno);
+        } else {
+            sent_records++;
+        }
+        if (++datagrams % AUDIO_RECORDER_DUMP_BURST == 0) {
+            vTaskDelay(pdMS_TO_TICKS(5));
+        }
+    }
+
+    AudioRecordHeader end = {};
+    end.magic = AUDIO_RECORD_MAGIC;
+    end.tap = AUDIO_RECORD_TAP_END;
+    end.sequence = sent_records;
+    end.timestamp_ms = esp_timer_get_time() / 1000;
+    sendto(sockfd, &end, sizeof(end), 0, (struct sockaddr*)&addr, sizeof(addr));
+    close(sockfd);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    ring_read_ = 0;
+    ring_used_ = 0;
+    records_ = 0;
+    dumping_ = false;
+    taps_ = selected_taps_;
+    ESP_LOGI(TAG, "Dumped %d records to %s", sent_records, CONFIG_AUDIO_DEBUG_UDP_SERVER);
+    return sent_records;
+}
+
+cJSON* AudioRecorder::GetStatusJson() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    cJSON* root = cJSON_CreateObject();
+    cJSON* taps = cJSON_CreateArray();
+    for (int i = 0; i < kAudioTapCount; i++) {
+        if (selected_taps_ & (1u << i)) {
+            cJSON_AddItemToArray(taps, cJSON_CreateString(kTapNames[i]));
+        }
+    }
+    cJSON_AddItemToObject(root, "taps", taps);
+    cJSON_AddStringToObject(root, "format", opus_ ? "opus" : "pcm");
+    cJSON_AddNumberToObject(root, "buffer_size", ring_size_);
+    cJSON_AddNumberToObject(root, "buffer_used", ring_used_);
+    cJSON_AddNumberToObject(root, "records", records_);
+    cJSON_AddNumberToObject(root, "overwritten_records", overwritten_records_);
+    {
+        std::lock_guard<std::mutex> staging_lock(staging_mutex_);
+        cJSON_AddNumberToObject(root, "staging_drops", staging_drops_);
+    }
+    return root;
+}
+
+#endif // CONFIG_USE_AUDIO_DEBUGGER
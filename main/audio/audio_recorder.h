@@ -0,0 +1,153 @@
+#ifndef AUDIO_RECORDER_H
+#define AUDIO_RECORDER_H
+
+#include <sdkconfig.h>
+#include <cstdint>
+#include <cstddef>
+
+/*
+ * Capture of the audio pipeline for debugging, enabled with CONFIG_USE_AUDIO_DEBUGGER.
+ *
+ * Every tap records the audio passing one stage. The frames are tagged with the stage, a
+ * per tap sequence number and the time they passed the tap, optionally compressed with
+ * Opus, and kept in a ring buffer in PSRAM, the oldest records are overwritten. A tap only
+ * copies PCM, the Opus compression runs on a low priority task of the recorder. Dump()
+ * sends the buffer to CONFIG_AUDIO_DEBUG_UDP_SERVER, one record per datagram, where
+ * scripts/audio_debug_server.py writes one WAV file per tap.
+ */
+enum AudioTap {
+    kAudioTapMic,               // Input after resampling to 16 kHz, interleaved with the reference channel if any
+    kAudioTapProcessed,         // Audio processor output, what the encoder gets
+    kAudioTapDecoded,           // Decoded TTS at the output sample rate, before the mixer
+    kAudioTapSpeaker,           // Mixed output handed to the codec
+    kAudioTapCount,
+};
+
+// Record layout on the wire and in the ring, little endian
+#define AUDIO_RECORD_MAGIC 0xA7
+#define AUDIO_RECORD_FORMAT_PCM 0
+#define AUDIO_RECORD_FORMAT_OPUS 1
+// Tap of the record that ends a dump, it has no payload
+#define AUDIO_RECORD_TAP_END 0xFF
+
+struct __attribute__((packed)) AudioRecordHeader {
+    uint8_t magic;
+    uint8_t tap;
+    uint8_t format;
+    uint8_t channels;
+    uint16_t sample_rate;
+    uint16_t payload_size;
+    uint32_t sequence;          // Per tap, gaps are records that were overwritten
+    uint32_t timestamp_ms;      // esp_timer time the first sample passed the tap
+};
+
+#if CONFIG_USE_AUDIO_DEBUGGER
+
+#include <cJSON.h>
+#include <opus_encoder.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <atomic>
+
+// PCM payloads are split to fit into one datagram
+#define AUDIO_RECORDER_MAX_PAYLOAD 1280
+#define AUDIO_RECORDER_OPUS_FRAME_MS 20
+// PCM waiting for the Opus task, taps drop their frames while it is full
+#define AUDIO_RECORDER_STAGING_BYTES (64 * 1024)
+// Datagrams sent in a row before the dump gives the network stack a break
+#define AUDIO_RECORDER_DUMP_BURST 16
+
+class AudioRecorder {
+public:
+    static AudioRecorder& GetInstance() {
+        static AudioRecorder instance;
+        return instance;
+    }
+
+    // taps is a bit mask of (1 << AudioTap), the buffer is allocated on the first call
+    bool Start(uint32_t taps, bool opus);
+    // Start with the taps and format selected in menuconfig
+    bool StartConfigured();
+    void Stop();
+    // Tap mask from a list of tap names, e.g. "mic,processed"
+    static uint32_t ParseTaps(const std::string& names);
+    // samples counts all channels
+    void Record(AudioTap tap, const int16_t* pcm, size_t samples, int sample_rate, int channels);
+    // Sends and empties the buffer, recording pauses meanwhile. Returns the records sent, -1 on error
+    int Dump();
+    // The caller owns the returned object
+    cJSON* GetStatusJson();
+
+private:
+    // Staged PCM of one Record() call, followed by the samples
+    struct StagedChunk {
+        uint8_t tap;
+        uint8_t channels;
+        uint16_t reserved;
+        uint32_t sample_rate;
+        uint32_t timestamp_ms;
+        uint32_t samples;
+    };
+
+    struct TapState {
+        std::unique_ptr<OpusEncoderWrapper> encoder;
+        std::vector<int16_t> frame;
+        int sample_rate = 0;
+        int channels = 0;
+        uint32_t sequence = 0;
+        uint32_t frame_time_ms = 0;
+    };
+
+    // Guards the record ring and the tap states. Audio tasks only take it in PCM mode, to copy a frame in
+    std::mutex mutex_;
+    std::atomic<uint32_t> taps_{0};
+    uint32_t selected_taps_ = 0;
+    std::atomic<bool> opus_{false};
+    bool dumping_ = false;
+    TapState tap_states_[kAudioTapCount];
+    std::vector<uint8_t> opus_packet_;
+
+    // PCM handed from the taps to the Opus task, guarded by staging_mutex_
+    std::mutex staging_mutex_;
+    uint8_t* staging_ = nullptr;
+    size_t staging_read_ = 0;
+    size_t staging_used_ = 0;
+    uint32_t staging_drops_ = 0;
+    TaskHandle_t encode_task_ = nullptr;
+    StaticTask_t* encode_task_buffer_ = nullptr;
+    StackType_t* encode_task_stack_ = nullptr;
+
+    uint8_t* ring_ = nullptr;
+    size_t ring_size_ = 0;
+    size_t ring_read_ = 0;
+    size_t ring_used_ = 0;
+    uint32_t records_ = 0;
+    uint32_t overwritten_records_ = 0;
+
+    AudioRecorder() = default;
+    bool StartEncodeTask();
+    void EncodeTask();
+    void Stage(AudioTap tap, const int16_t* pcm, size_t samples, int sample_rate, int channels, uint32_t now_ms);
+    TapState& PrepareTap(AudioTap tap, int sample_rate, int channels);
+    void RecordPcm(AudioTap tap, TapState& state, const int16_t* pcm, size_t samples, uint32_t now_ms);
+    void RecordOpus(AudioTap tap, TapState& state, const int16_t* pcm, size_t samples, uint32_t now_ms);
+    void Append(AudioTap tap, TapState& state, uint8_t format, uint32_t timestamp_ms, const void* payload, size_t size);
+    static void CopyIn(uint8_t* ring, size_t ring_size, size_t offset, const void* data, size_t size);
+    static void CopyOut(const uint8_t* ring, size_t ring_size, size_t offset, void* data, size_t size);
+};
+
+#define AUDIO_RECORD(tap, pcm, samples, sample_rate, channels) \
+    do { AudioRecorder::GetInstance().Record(tap, pcm, samples, sample_rate, channels); } while (0)
+
+#else
+
+#define AUDIO_RECORD(tap, pcm, samples, sample_rate, channels) do {} while (0)
+
+#endif // CONFIG_USE_AUDIO_DEBUGGER
+
+#endif // AUDIO_RECORDER_H
@@ -1,6 +1,9 @@
 #include "audio_service.h"
 #include <esp_log.h>
 #include <cstring>
+#include <algorithm>
+
+#include "sample_kernels.h"
 
 #if CONFIG_USE_AUDIO_PROCESSOR
 #include "processors/afe_audio_processor.h"
@@ -20,12 +23,20 @@
 
 AudioService::AudioService() {
     event_group_ = xEventGroupCreate();
+    decode_space_semaphore_ = xSemaphoreCreateBinary();
+    encode_space_semaphore_ = xSemaphoreCreateBinary();
 }
 
 AudioService::~AudioService() {
     if (event_group_ != nullptr) {
         vEventGroupDelete(event_group_);
     }
+    if (decode_space_semaphore_ != nullptr) {
+        vSemaphoreDelete(decode_space_semaphore_);
+    }
+    if (encode_space_semaphore_ != nullptr) {
+        vSemaphoreDelete(encode_space_semaphore_);
+    }
 }
 
 
@@ -34,32 +45,63 @@ void AudioService::Initialize(AudioCodec* codec) {
     codec_->Start();
 
     /* Setup the audio codec */
-    opus_decoder_ = std::make_unique<OpusDecoderWrapper>(codec->output_sample_rate(), 1, OPUS_FRAME_DURATION_MS);
-    opus_encoder_ = std::make_unique<OpusEncoderWrapper>(16000, 1, OPUS_FRAME_DURATION_MS);
+    SetDecodeSampleRate(codec->output_sample_rate(), OPUS_FRAME_DURATION_MS);
+#if CONFIG_USE_SERVER_AEC
+    aec_timeline_.Reset(codec->output_sample_rate(), AUDIO_CODEC_DMA_DESC_NUM, AUDIO_CODEC_DMA_FRAME_NUM);
+#endif
+    opus_encoder_ = std::make_unique<AdaptiveOpusEncoder>(16000, 1, uplink_frame_duration_);
     opus_encoder_->SetComplexity(0);
 
+    /* Warm up the pools so that the first turn doesn't allocate per frame either */
+    ReserveAudioStreamPackets(AUDIO_PACKET_PREALLOCATE);
+    audio_task_pool_.Reserve(AUDIO_TASK_POOL_SIZE);
+
     if (codec->input_sample_rate() != 16000) {
         input_resampler_.Configure(codec->input_sample_rate(), 16000);
         reference_resampler_.Configure(codec->input_sample_rate(), 16000);
     }
 
+#if CONFIG_USE_AUDIO_DEBUGGER
+    AudioRecorder::GetInstance().StartConfigured();
+#endif
+
 #if CONFIG_USE_AUDIO_PROCESSOR
     audio_processor_ = std::make_unique<AfeAudioProcessor>();
 #else
     audio_processor_ = std::make_unique<NoAudioProcessor>();
 #endif
 
-    audio_processor_->OnOutput([this](std::vector<int16_t>&& data) {
-        PushTaskToEncodeQueue(kAudioTaskTypeEncodeToSendQueue, std::move(data));
+    audio_processor_->OnOutput([this](const int16_t* data, size_t samples) {
+        OnProcessedAudio(data, samples);
     });
 
     audio_processor_->OnVadStateChange([this](bool speaking) {
         voice_detected_ = speaking;
+#if CONFIG_USE_LOCAL_ENDPOINTING
+        {
+            std::lock_guard<std::mutex> lock(endpoint_mutex_);
+            endpoint_detector_.OnVadChange(speaking);
+        }
+#endif
+        // Let the encoder send DTX frames instead of full packets of silence
+        uplink_dtx_ = !speaking;
         if (callbacks_.on_vad_change) {
             callbacks_.on_vad_change(speaking);
         }
     });
 
+#if CONFIG_USE_AUDIO_INPUT_GATE
+    // Zeros for the longest uplink frame
+    input_gate_silence_.assign(60 * 16000 / 1000, 0);
+    input_gate_.Initialize(codec->input_channels(), uplink_frame_duration_);
+    input_gate_.OnFeed([this](std::vector<int16_t>& chunk) {
+        audio_processor_->Feed(std::move(chunk));
+    });
+    input_gate_.OnSilence([this](size_t samples) {
+        OnProcessedAudio(input_gate_silence_.data(), samples);
+    });
+#endif
+
     esp_timer_create_args_t audio_power_timer_args = {
         .callback = [](void* arg) {
             AudioService* audio_service = (AudioService*)arg;
@@ -109,12 +151,21 @@ void AudioService::Start() {
     }, "audio_output", 2048, this, 4, &audio_output_task_handle_);
 #endif
 
-    /* Start the opus codec task */
-    xTaskCreate([](void* arg) {
+    /* Start the opus decode task, it feeds the speaker so it runs above the encoder */
+    xTaskCreatePinnedToCore([](void* arg) {
         AudioService* audio_service = (AudioService*)arg;
-        audio_service->OpusCodecTask();
+        audio_service->OpusDecodeTask();
         vTaskDelete(NULL);
-    }, "opus_codec", 2048 * 13, this, 2, &opus_codec_task_handle_);
+    }, "opus_decode", OPUS_DECODE_TASK_STACK_SIZE, this, CONFIG_OPUS_DECODE_TASK_PRIORITY,
+        &opus_decode_task_handle_, OPUS_DECODE_TASK_CORE);
+
+    /* Start the opus encode task */
+    xTaskCreatePinnedToCore([](void* arg) {
+        AudioService* audio_service = (AudioService*)arg;
+        audio_service->OpusEncodeTask();
+        vTaskDelete(NULL);
+    }, "opus_encode", OPUS_ENCODE_TASK_STACK_SIZE, this, CONFIG_OPUS_ENCODE_TASK_PRIORITY,
+        &opus_encode_task_handle_, OPUS_ENCODE_TASK_CORE);
 }
 
 void AudioService::Stop() {
@@ -124,20 +175,55 @@ void AudioService::Stop() {
         AS_EVENT_WAKE_WORD_RUNNING |
         AS_EVENT_AUDIO_PROCESSOR_RUNNING);
 
-    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-    audio_encode_queue_.clear();
-    audio_decode_queue_.clear();
-    audio_playback_queue_.clear();
-    audio_testing_queue_.clear();
-    audio_queue_cv_.notify_all();
+    audio_encode_queue_.Clear();
+    audio_decode_queue_.Clear();
+    prompt_queue_.Clear();
+    prompt_decode_queue_.Clear();
+    audio_playback_queue_.Clear();
+    audio_testing_queue_.Clear();
+
+    /* Wake up every task so that they can see service_stopped_ */
+    NotifyTask(audio_output_task_handle_);
+    NotifyTask(opus_decode_task_handle_);
+    NotifyTask(opus_encode_task_handle_);
+    xSemaphoreGive(decode_space_semaphore_);
+    xSemaphoreGive(encode_space_semaphore_);
 }
 
-bool AudioService::ReadAudioData(std::vector<int16_t>& data, int sample_rate, int samples) {
+void AudioService::NotifyTask(TaskHandle_t task) {
+    if (task != nullptr) {
+        xTaskNotifyGive(task);
+    }
+}
+
+void AudioService::EnableCodecInput() {
     if (!codec_->input_enabled()) {
         esp_timer_stop(audio_power_timer_);
         esp_timer_start_periodic(audio_power_timer_, AUDIO_POWER_CHECK_INTERVAL_MS * 1000);
         codec_->EnableInput(true);
     }
+}
+
+void AudioService::PrepareInput() {
+    if (service_stopped_) {
+        return;
+    }
+    xEventGroupSetBits(event_group_, AS_EVENT_PREPARE_INPUT);
+}
+
+bool AudioService::DiscardUnsettledInput(std::vector<int16_t>& data) {
+    EnableCodecInput();
+    int64_t settled_us = codec_->input_enable_time_us() + codec_->input_settle_ms() * 1000LL;
+    if (esp_timer_get_time() >= settled_us) {
+        return false;
+    }
+    // Keep draining the I2S DMA, so no samples from the settling period are left for later reads
+    ReadAudioData(data, 16000, 10 * 16000 / 1000);
+    return true;
+}
+
+bool AudioService::ReadAudioData(std::vector<int16_t>& data, int sample_rate, int samples) {
+    EnableCodecInput();
 
     if (codec_->input_sample_rate() != sample_rate) {
         data.resize(samples * codec_->input_sample_rate() / sample_rate * codec_->input_channels());
@@ -145,25 +231,25 @@ bool AudioService::ReadAudioData(std::vector<int16_t>& data, int sample_rate, in
             return false;
         }
         if (codec_->input_channels() == 2) {
-            auto mic_channel = std::vector<int16_t>(data.size() / 2);
-            auto reference_channel = std::vector<int16_t>(data.size() / 2);
-            for (size_t i = 0, j = 0; i < mic_channel.size(); ++i, j += 2) {
-                mic_channel[i] = data[j];
-                reference_channel[i] = data[j + 1];
-            }
-            auto resampled_mic = std::vector<int16_t>(input_resampler_.GetOutputSamples(mic_channel.size()));
-            auto resampled_reference = std::vector<int16_t>(reference_resampler_.GetOutputSamples(reference_channel.size()));
-            input_resampler_.Process(mic_channel.data(), mic_channel.size(), resampled_mic.data());
-            reference_resampler_.Process(reference_channel.data(), reference_channel.size(), resampled_reference.data());
-            data.resize(resampled_mic.size() + resampled_reference.size());
-            for (size_t i = 0, j = 0; i < resampled_mic.size(); ++i, j += 2) {
-                data[j] = resampled_mic[i];
-                data[j + 1] = resampled_reference[i];
-            }
+            // Compact the mic channel in place and copy the reference channel into a persistent buffer,
+            // then resample both into persistent buffers and interleave them back into data
+            size_t frames = data.size() / 2;
+            int16_t* interleaved = data.data();
+            input_reference_buffer_.resize(frames);
+            DeinterleaveS16(interleaved, interleaved, input_reference_buffer_.data(), frames);
+
+            size_t resampled_frames = input_resampler_.GetOutputSamples(frames);
+            input_resampled_mic_buffer_.resize(resampled_frames);
+            input_resampled_reference_buffer_.resize(resampled_frames);
+            input_resampler_.Process(interleaved, frames, input_resampled_mic_buffer_.data());
+            reference_resampler_.Process(input_reference_buffer_.data(), frames, input_resampled_reference_buffer_.data());
+
+            data.resize(resampled_frames * 2);
+            InterleaveS16(input_resampled_mic_buffer_.data(), input_resampled_reference_buffer_.data(), data.data(), resampled_frames);
         } else {
-            auto resampled = std::vector<int16_t>(input_resampler_.GetOutputSamples(data.size()));
-            input_resampler_.Process(data.data(), data.size(), resampled.data());
-            data = std::move(resampled);
+            input_resampled_mic_buffer_.resize(input_resampler_.GetOutputSamples(data.size()));
+            input_resampler_.Process(data.data(), data.size(), input_resampled_mic_buffer_.data());
+            data.assign(input_resampled_mic_buffer_.begin(), input_resampled_mic_buffer_.end());
         }
     } else {
         data.resize(samples * codec_->input_channels());
@@ -176,58 +262,56 @@ bool AudioService::ReadAudioData(std::vector<int16_t>& data, int sample_rate, in
     last_input_time_ = std::chrono::steady_clock::now();
     debug_statistics_.input_count++;
 
-#if CONFIG_USE_AUDIO_DEBUGGER
-    // 音频调试：发送原始音频数据
-    if (audio_debugger_ == nullptr) {
-        audio_debugger_ = std::make_unique<AudioDebugger>();
-    }
-    audio_debugger_->Feed(data);
-#endif
+    AUDIO_RECORD(kAudioTapMic, data.data(), data.size(), sample_rate, codec_->input_channels());
 
     return true;
 }
 
 void AudioService::AudioInputTask() {
+    // Reused across reads so that ReadAudioData keeps its capacity
+    std::vector<int16_t> data;
     while (true) {
         EventBits_t bits = xEventGroupWaitBits(event_group_, AS_EVENT_AUDIO_TESTING_RUNNING |
-            AS_EVENT_WAKE_WORD_RUNNING | AS_EVENT_AUDIO_PROCESSOR_RUNNING,
+            AS_EVENT_WAKE_WORD_RUNNING | AS_EVENT_AUDIO_PROCESSOR_RUNNING | AS_EVENT_PREPARE_INPUT,
             pdFALSE, pdFALSE, portMAX_DELAY);
 
         if (service_stopped_) {
             break;
         }
-        if (audio_input_need_warmup_) {
-            audio_input_need_warmup_ = false;
-            vTaskDelay(pdMS_TO_TICKS(120));
+        /* Power up the input early on behalf of PrepareInput(), the codec and the power timer are only touched here */
+        if (bits & AS_EVENT_PREPARE_INPUT) {
+            xEventGroupClearBits(event_group_, AS_EVENT_PREPARE_INPUT);
+            last_input_time_ = std::chrono::steady_clock::now();
+            EnableCodecInput();
+            if (!(bits & (AS_EVENT_AUDIO_TESTING_RUNNING | AS_EVENT_WAKE_WORD_RUNNING | AS_EVENT_AUDIO_PROCESSOR_RUNNING))) {
+                continue;
+            }
+        }
+        /* The codec settle time replaces a fixed warm-up delay, an input that is already running is used right away */
+        if (DiscardUnsettledInput(data)) {
             continue;
         }
 
         /* Used for audio testing in NetworkConfiguring mode by clicking the BOOT button */
         if (bits & AS_EVENT_AUDIO_TESTING_RUNNING) {
-            if (audio_testing_queue_.size() >= AUDIO_TESTING_MAX_DURATION_MS / OPUS_FRAME_DURATION_MS) {
+            int frame_duration = uplink_frame_duration_;
+            if (audio_testing_queue_.Size() >= static_cast<size_t>(AUDIO_TESTING_MAX_DURATION_MS / frame_duration)) {
                 ESP_LOGW(TAG, "Audio testing queue is full, stopping audio testing");
                 EnableAudioTesting(false);
                 continue;
             }
-            std::vector<int16_t> data;
-            int samples = OPUS_FRAME_DURATION_MS * 16000 / 1000;
+            int samples = frame_duration * 16000 / 1000;
             if (ReadAudioData(data, 16000, samples)) {
                 // If input channels is 2, we need to fetch the left channel data
-                if (codec_->input_channels() == 2) {
-                    auto mono_data = std::vector<int16_t>(data.size() / 2);
-                    for (size_t i = 0, j = 0; i < mono_data.size(); ++i, j += 2) {
-                        mono_data[i] = data[j];
-                    }
-                    data = std::move(mono_data);
-                }
-                PushTaskToEncodeQueue(kAudioTaskTypeEncodeToTestingQueue, std::move(data));
+                size_t mono_samples = data.size() / codec_->input_channels();
+                ExtractChannelS16(data.data(), data.data(), mono_samples, codec_->input_channels(), 0);
+                PushTaskToEncodeQueue(kAudioTaskTypeEncodeToTestingQueue, data.data(), mono_samples);
                 continue;
             }
         }
 
         /* Feed the wake word */
         if (bits & AS_EVENT_WAKE_WORD_RUNNING) {
-            std::vector<int16_t> data;
             int samples = wake_word_->GetFeedSize();
             if (samples > 0) {
                 if (ReadAudioData(data, 16000, samples)) {
@@ -239,11 +323,28 @@ void AudioService::AudioInputTask() {
 
         /* Feed the audio processor */
         if (bits & AS_EVENT_AUDIO_PROCESSOR_RUNNING) {
-            std::vector<int16_t> data;
             int samples = audio_processor_->GetFeedSize();
             if (samples > 0) {
+#if CONFIG_USE_SERVER_AEC
+                int64_t read_start_us = esp_timer_get_time();
+#endif
                 if (ReadAudioData(data, 16000, samples)) {
+#if CONFIG_USE_SERVER_AEC
+                    aec_timeline_.OnCaptured(samples, read_start_us, esp_timer_get_time());
+#endif
+                    auto started_us = voice_processing_started_us_.exchange(0);
+                    if (started_us != 0) {
+                        ESP_LOGI(TAG, "First valid input sample %ld ms after voice processing started (settle %d ms)",
+                            (long)((esp_timer_get_time() - started_us) / 1000), codec_->input_settle_ms());
+                    }
+                    LATENCY_TRACE_CAPTURE(samples);
+#if CONFIG_USE_AUDIO_INPUT_GATE
+                    auto since_output = std::chrono::steady_clock::now() - last_output_time_;
+                    bool playing = codec_->output_enabled() && since_output < std::chrono::milliseconds(INPUT_GATE_PLAYBACK_HOLD_MS);
+                    input_gate_.Process(data, voice_detected_ || playing);
+#else
                     audio_processor_->Feed(std::move(data));
+#endif
                     continue;
                 }
             }
@@ -257,192 +358,337 @@ void AudioService::AudioInputTask() {
 }
 
 void AudioService::AudioOutputTask() {
+    // Output frame while only prompt sounds are playing
+    std::vector<int16_t> prompt_frame;
+    mixer_.Clear();
     while (true) {
-        std::unique_lock<std::mutex> lock(audio_queue_mutex_);
-        audio_queue_cv_.wait(lock, [this]() { return !audio_playback_queue_.empty() || service_stopped_; });
+        AudioTaskPtr task;
+        size_t pending = audio_playback_queue_.Size();
+        bool popped = audio_playback_queue_.Pop(task);
         if (service_stopped_) {
             break;
         }
 
-        auto task = std::move(audio_playback_queue_.front());
-        audio_playback_queue_.pop_front();
-        audio_queue_cv_.notify_all();
+        /* Playback slots are free (popped or flushed), the decoder may continue */
+        if (popped || audio_playback_queue_.Size() < pending) {
+            NotifyTask(opus_decode_task_handle_);
+        }
 
-#if CONFIG_USE_SERVER_AEC
-        // 保存 timestamp，在释放锁后使用
-        uint32_t timestamp = task->timestamp;
-#endif
-        lock.unlock();
+        /* New prompt sounds join the mixer right away, even in the middle of a TTS sentence */
+        PromptRequest prompt;
+        while (prompt_queue_.Pop(prompt)) {
+            mixer_.Play(prompt.priority ? kAudioMixerVoiceAlert : kAudioMixerVoicePrompt, prompt.sound);
+        }
+        if (!popped && !mixer_.Active()) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
 
         if (!codec_->output_enabled()) {
             esp_timer_stop(audio_power_timer_);
             esp_timer_start_periodic(audio_power_timer_, AUDIO_POWER_CHECK_INTERVAL_MS * 1000);
             codec_->EnableOutput(true);
         }
+        if (!popped) {
+            prompt_frame.assign(codec_->output_sample_rate() / 1000 * AUDIO_MIXER_FRAME_MS, 0);
+            mixer_.Mix(prompt_frame.data(), prompt_frame.size());
+            AUDIO_RECORD(kAudioTapSpeaker, prompt_frame.data(), prompt_frame.size(), codec_->output_sample_rate(), 1);
+#if CONFIG_USE_SERVER_AEC
+            int64_t write_start_us = esp_timer_get_time();
+            codec_->OutputData(prompt_frame);
+            aec_timeline_.OnPlayed(0, prompt_frame.size(), write_start_us, esp_timer_get_time());
+#else
+            codec_->OutputData(prompt_frame);
+#endif
+            last_output_time_ = std::chrono::steady_clock::now();
+            continue;
+        }
+        if (mixer_.Active()) {
+            mixer_.Mix(task->pcm.data(), task->pcm.size());
+        }
+        AUDIO_RECORD(kAudioTapSpeaker, task->pcm.data(), task->pcm.size(), codec_->output_sample_rate(), 1);
+#if CONFIG_USE_SERVER_AEC
+        /* The timeline maps the played samples back to the server timestamp for AEC */
+        int64_t write_start_us = esp_timer_get_time();
+        codec_->OutputData(task->pcm);
+        aec_timeline_.OnPlayed(task->timestamp, task->pcm.size(), write_start_us, esp_timer_get_time());
+#else
         codec_->OutputData(task->pcm);
+#endif
+        LATENCY_TRACE_END(task->trace, kLatencyStagePlayback, kLatencyStageDownlink);
 
         /* Update the last output time */
         last_output_time_ = std::chrono::steady_clock::now();
         debug_statistics_.playback_count++;
-
-#if CONFIG_USE_SERVER_AEC
-        /* Record the timestamp for server AEC */
-        if (timestamp > 0) {
-            std::lock_guard<std::mutex> ts_lock(audio_queue_mutex_);
-            timestamp_queue_.push_back(timestamp);
-        }
-#endif
     }
 
     ESP_LOGW(TAG, "Audio output task stopped");
 }
 
-void AudioService::OpusCodecTask() {
+void AudioService::OpusDecodeTask() {
+    // A local sound packet waiting for a playback slot, it bypasses the jitter buffer
+    AudioStreamPacketPtr unsequenced;
+    uint32_t logged_received = 0;
     while (true) {
-        std::unique_lock<std::mutex> lock(audio_queue_mutex_);
-        audio_queue_cv_.wait(lock, [this]() {
-            return service_stopped_ ||
-                (!audio_encode_queue_.empty() && audio_send_queue_.size() < MAX_SEND_PACKETS_IN_QUEUE) ||
-                (!audio_decode_queue_.empty() && audio_playback_queue_.size() < MAX_PLAYBACK_TASKS_IN_QUEUE);
-        });
         if (service_stopped_) {
             break;
         }
+        if (decoder_reset_pending_.exchange(false)) {
+            // A new stream starts, none of the cached decoders may carry state over
+            for (auto& slot : decoder_slots_) {
+                if (slot.decoder) {
+                    slot.decoder->ResetState();
+                }
+            }
+            jitter_buffer_.Reset();
+            unsequenced.reset();
+            playback_rate_.Reset();
+
+            auto& stats = jitter_buffer_.stats();
+            if (stats.received != logged_received) {
+                logged_received = stats.received;
+                ESP_LOGI(TAG, "Jitter buffer: received %lu, concealed %lu, late %lu, duplicates %lu, underruns %lu, jitter %lu ms, target depth %lu",
+                    stats.received, stats.concealed, stats.late_drops, stats.duplicates, stats.underruns, stats.jitter_ms, stats.target_depth);
+                auto rate_stats = playback_rate_.stats();
+                ESP_LOGI(TAG, "Playback rate: %lu frames shortened, %lu ms skipped in total",
+                    rate_stats.stretched_frames, rate_stats.removed_ms);
+            }
+        }
 
-        /* Decode the audio from decode queue */
-        if (!audio_decode_queue_.empty() && audio_playback_queue_.size() < MAX_PLAYBACK_TASKS_IN_QUEUE) {
-            auto packet = std::move(audio_decode_queue_.front());
-            audio_decode_queue_.pop_front();
-            audio_queue_cv_.notify_all();
-            lock.unlock();
-
-            auto task = std::make_unique<AudioTask>();
-            task->type = kAudioTaskTypeDecodeToPlaybackQueue;
-            task->timestamp = packet->timestamp;
+        /* Sounds played before they were cached, decoded here instead of in the calling task */
+        PromptDecodeRequest sound_request;
+        while (prompt_decode_queue_.Pop(sound_request)) {
+            DecodePromptSound(sound_request);
+        }
 
-            {
-                // 使用 codec_mutex_ 保护 opus_decoder_ 和 output_resampler_ 的访问
-                std::lock_guard<std::mutex> codec_lock(codec_mutex_);
-                SetDecodeSampleRate(packet->sample_rate, packet->frame_duration);
-                if (opus_decoder_->Decode(std::move(packet->payload), task->pcm)) {
-                    // Resample if the sample rate is different
-                    if (opus_decoder_->sample_rate() != codec_->output_sample_rate()) {
-                        int target_size = output_resampler_.GetOutputSamples(task->pcm.size());
-                        std::vector<int16_t> resampled(target_size);
-                        output_resampler_.Process(task->pcm.data(), task->pcm.size(), resampled.data());
-                        task->pcm = std::move(resampled);
-                    }
-                } else {
-                    ESP_LOGE(TAG, "Failed to decode audio");
-                    task.reset();  // 解码失败，清除任务
-                }
+        /* Move packets from the decode queue into the jitter buffer */
+        int64_t now = esp_timer_get_time();
+        // Free the cleared slots even when the jitter buffer is full and nothing is popped
+        audio_decode_queue_.ReleaseFlushed();
+        AudioStreamPacketPtr packet;
+        while (!unsequenced && !jitter_buffer_.Full() && audio_decode_queue_.Pop(packet)) {
+            if (packet->sequence == 0) {
+                unsequenced = std::move(packet);
+            } else {
+                jitter_buffer_.Put(std::move(packet), now);
             }
+        }
+        // Pop() also releases flushed slots, so wake up blocked producers either way
+        xSemaphoreGive(decode_space_semaphore_);
+
+        if (audio_playback_queue_.Size() >= MAX_PLAYBACK_TASKS_IN_QUEUE) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+
+        if (unsequenced) {
+            packet = std::move(unsequenced);
+        } else if (jitter_buffer_.Get(packet, now) == JitterBuffer::kWait) {
+            // While packets are held, wake up every frame to start playback or conceal a lost packet
+            ulTaskNotifyTake(pdTRUE, jitter_buffer_.Empty() ? portMAX_DELAY : pdMS_TO_TICKS(jitter_buffer_.frame_duration()));
+            continue;
+        }
+
+        // A concealed frame has an empty payload, the decoder runs packet loss concealment for it
+        auto decoded = audio_task_pool_.Acquire();
+        decoded->type = kAudioTaskTypeDecodeToPlaybackQueue;
+        decoded->timestamp = packet->timestamp;
 
-            lock.lock();
-            if (task) {
-                audio_playback_queue_.push_back(std::move(task));
-                audio_queue_cv_.notify_all();
+        SetDecodeSampleRate(packet->sample_rate, packet->frame_duration);
+        if (!opus_decoder_->Decode(std::move(packet->payload), decoded->pcm)) {
+            ESP_LOGE(TAG, "Failed to decode audio");
+            continue;
+        }
+#if !CONFIG_USE_SERVER_AEC
+        // Catch up with a TTS backlog, the server AEC needs the original timing so it is left out there
+        if (packet->sequence != 0) {
+            int frame_duration = jitter_buffer_.frame_duration();
+            playback_rate_.Update((audio_decode_queue_.Size() + jitter_buffer_.Size()) * frame_duration);
+            if (playback_rate_.active()) {
+                playback_rate_.Process(decoded->pcm, opus_decoder_->sample_rate());
             }
-            debug_statistics_.decode_count++;
         }
-        
+#endif
+        // Resample if the sample rate is different
+        if (opus_decoder_->sample_rate() != codec_->output_sample_rate()) {
+            // Swap with the persistent scratch buffer, both keep their capacity
+            int target_size = output_resampler_->GetOutputSamples(decoded->pcm.size());
+            output_resample_buffer_.resize(target_size);
+            output_resampler_->Process(decoded->pcm.data(), decoded->pcm.size(), output_resample_buffer_.data());
+            decoded->pcm.swap(output_resample_buffer_);
+        }
+
+        AUDIO_RECORD(kAudioTapDecoded, decoded->pcm.data(), decoded->pcm.size(), codec_->output_sample_rate(), 1);
+        LATENCY_TRACE_COPY(decoded->trace, packet->trace);
+        LATENCY_TRACE_STAGE(decoded->trace, kLatencyStageDecode);
+        if (audio_playback_queue_.Push(std::move(decoded))) {
+            NotifyTask(audio_output_task_handle_);
+        }
+        debug_statistics_.decode_count++;
+    }
+
+    ESP_LOGW(TAG, "Opus decode task stopped");
+}
+
+void AudioService::OpusEncodeTask() {
+    while (true) {
+        if (service_stopped_) {
+            break;
+        }
+
         /* Encode the audio to send queue */
-        if (!audio_encode_queue_.empty() && audio_send_queue_.size() < MAX_SEND_PACKETS_IN_QUEUE) {
-            auto task = std::move(audio_encode_queue_.front());
-            audio_encode_queue_.pop_front();
-            audio_queue_cv_.notify_all();
-            lock.unlock();
-
-            auto packet = std::make_unique<AudioStreamPacket>();
-            packet->frame_duration = OPUS_FRAME_DURATION_MS;
-            packet->sample_rate = 16000;
-            packet->timestamp = task->timestamp;
-            if (!opus_encoder_->Encode(std::move(task->pcm), packet->payload)) {
-                ESP_LOGE(TAG, "Failed to encode audio");
+        AudioTaskPtr task;
+        size_t max_send_packets = MAX_SEND_QUEUE_DURATION_MS / uplink_frame_duration_;
+        bool encode_ready = audio_send_queue_.Size() < max_send_packets && audio_encode_queue_.Pop(task);
+        xSemaphoreGive(encode_space_semaphore_);
+        if (!encode_ready) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+
+        if (uplink_stats_reset_pending_.exchange(false)) {
+            opus_encoder_->ResetStats();
+        }
+
+        // The frame duration follows the PCM size, so frames queued before a renegotiation still encode
+        int frame_duration = task->pcm.size() * 1000 / 16000;
+        if (task->pcm.size() != opus_encoder_->frame_size()) {
+            if (frame_duration != 20 && frame_duration != 40 && frame_duration != 60) {
+                ESP_LOGE(TAG, "Invalid frame size to encode: %u", task->pcm.size());
                 continue;
             }
+            ESP_LOGI(TAG, "Encoder frame duration changed to %d ms", frame_duration);
+            opus_encoder_->SetFrameDuration(frame_duration);
+        }
+        if (task->type == kAudioTaskTypeEncodeToSendQueue) {
+            opus_encoder_->SetDtx(uplink_dtx_);
+        }
 
-            if (task->type == kAudioTaskTypeEncodeToSendQueue) {
-                {
-                    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-                    audio_send_queue_.push_back(std::move(packet));
-                }
-                if (callbacks_.on_send_queue_available) {
-                    callbacks_.on_send_queue_available();
-                }
-            } else if (task->type == kAudioTaskTypeEncodeToTestingQueue) {
-                std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-                audio_testing_queue_.push_back(std::move(packet));
+        auto encoded = AllocateAudioStreamPacket();
+        encoded->frame_duration = frame_duration;
+        encoded->sample_rate = 16000;
+        encoded->timestamp = task->timestamp;
+        if (!opus_encoder_->Encode(std::move(task->pcm), encoded->payload)) {
+            ESP_LOGE(TAG, "Failed to encode audio");
+            continue;
+        }
+
+        if (task->type == kAudioTaskTypeEncodeToSendQueue) {
+            LATENCY_TRACE_COPY(encoded->trace, task->trace);
+            LATENCY_TRACE_STAGE(encoded->trace, kLatencyStageEncode);
+            audio_send_queue_.Push(std::move(encoded));
+            opus_encoder_->Update(audio_send_queue_.Size(), max_send_packets, uplink_send_failures_.exchange(0) > 0);
+            {
+                std::lock_guard<std::mutex> lock(uplink_stats_mutex_);
+                uplink_stats_ = opus_encoder_->stats();
+            }
+            if (callbacks_.on_send_queue_available) {
+                callbacks_.on_send_queue_available();
             }
-            debug_statistics_.encode_count++;
-            lock.lock();
+        } else if (task->type == kAudioTaskTypeEncodeToTestingQueue) {
+            audio_testing_queue_.Push(std::move(encoded));
         }
+        debug_statistics_.encode_count++;
     }
 
-    ESP_LOGW(TAG, "Opus codec task stopped");
+    ESP_LOGW(TAG, "Opus encode task stopped");
 }
 
 void AudioService::SetDecodeSampleRate(int sample_rate, int frame_duration) {
-    // 调用者必须持有 codec_mutex_
-    if (opus_decoder_->sample_rate() == sample_rate && opus_decoder_->duration_ms() == frame_duration) {
-        return;
+    // 只能在 opus decode 任务中调用
+    decoder_slot_uses_++;
+    DecoderSlot* victim = nullptr;
+    for (auto& slot : decoder_slots_) {
+        if (slot.decoder && slot.decoder->sample_rate() == sample_rate && slot.decoder->duration_ms() == frame_duration) {
+            // Switching back keeps the decoder and resampler state, nothing is allocated
+            slot.last_used = decoder_slot_uses_;
+            opus_decoder_ = slot.decoder.get();
+            output_resampler_ = &slot.resampler;
+            return;
+        }
+        if (victim == nullptr || (victim->decoder && (!slot.decoder || slot.last_used < victim->last_used))) {
+            victim = &slot;
+        }
     }
 
-    opus_decoder_.reset();
-    opus_decoder_ = std::make_unique<OpusDecoderWrapper>(sample_rate, 1, frame_duration);
+    // Replace an empty or the least recently used slot
+    victim->decoder.reset();
+    victim->decoder = std::make_unique<OpusDecoderWrapper>(sample_rate, 1, frame_duration);
+    victim->last_used = decoder_slot_uses_;
+    opus_decoder_ = victim->decoder.get();
+    output_resampler_ = &victim->resampler;
 
     auto codec = Board::GetInstance().GetAudioCodec();
     if (opus_decoder_->sample_rate() != codec->output_sample_rate()) {
         ESP_LOGI(TAG, "Resampling audio from %d to %d", opus_decoder_->sample_rate(), codec->output_sample_rate());
-        output_resampler_.Configure(opus_decoder_->sample_rate(), codec->output_sample_rate());
+        output_resampler_->Configure(opus_decoder_->sample_rate(), codec->output_sample_rate());
     }
 }
 
-void AudioService::PushTaskToEncodeQueue(AudioTaskType type, std::vector<int16_t>&& pcm) {
-    auto task = std::make_unique<AudioTask>();
+void AudioService::OnProcessedAudio(const int16_t* data, size_t samples) {
+    AUDIO_RECORD(kAudioTapProcessed, data, samples, 16000, 1);
+#if CONFIG_USE_LOCAL_ENDPOINTING
+    if (endpointing_enabled_) {
+        std::lock_guard<std::mutex> lock(endpoint_mutex_);
+        if (endpoint_detector_.Process(data, samples) && callbacks_.on_end_of_speech) {
+            callbacks_.on_end_of_speech();
+        }
+    }
+#endif
+    PushTaskToEncodeQueue(kAudioTaskTypeEncodeToSendQueue, data, samples);
+}
+
+void AudioService::PushTaskToEncodeQueue(AudioTaskType type, const int16_t* pcm, size_t samples) {
+    // The only copy of the frame, from the processor output straight into the pooled buffer
+    auto task = audio_task_pool_.Acquire();
     task->type = type;
-    task->pcm = std::move(pcm);
-    
-    /* Push the task to the encode queue */
-    std::unique_lock<std::mutex> lock(audio_queue_mutex_);
+    task->pcm.assign(pcm, pcm + samples);
 
     /* If the task is to send queue, we need to set the timestamp */
-    if (type == kAudioTaskTypeEncodeToSendQueue && !timestamp_queue_.empty()) {
-        if (timestamp_queue_.size() <= MAX_TIMESTAMPS_IN_QUEUE) {
-            task->timestamp = timestamp_queue_.front();
-        } else {
-            ESP_LOGW(TAG, "Timestamp queue (%u) is full, dropping timestamp", timestamp_queue_.size());
-        }
-        timestamp_queue_.pop_front();
+    if (type == kAudioTaskTypeEncodeToSendQueue) {
+        LATENCY_TRACE_PROCESSED(task->trace, task->pcm.size());
+#if CONFIG_USE_SERVER_AEC
+        task->timestamp = aec_timeline_.OnProcessed(samples);
+#endif
     }
 
-    audio_queue_cv_.wait(lock, [this]() { return audio_encode_queue_.size() < MAX_ENCODE_TASKS_IN_QUEUE; });
-    audio_encode_queue_.push_back(std::move(task));
-    audio_queue_cv_.notify_all();
+    /* Push the task to the encode queue */
+    std::lock_guard<std::mutex> lock(encode_producer_mutex_);
+    while (audio_encode_queue_.Size() >= MAX_ENCODE_TASKS_IN_QUEUE && !service_stopped_) {
+        xSemaphoreTake(encode_space_semaphore_, portMAX_DELAY);
+    }
+    if (audio_encode_queue_.Push(std::move(task))) {
+        NotifyTask(opus_encode_task_handle_);
+    }
 }
 
-bool AudioService::PushPacketToDecodeQueue(std::unique_ptr<AudioStreamPacket> packet, bool wait) {
-    std::unique_lock<std::mutex> lock(audio_queue_mutex_);
-    if (audio_decode_queue_.size() >= MAX_DECODE_PACKETS_IN_QUEUE) {
-        if (wait) {
-            audio_queue_cv_.wait(lock, [this]() { return audio_decode_queue_.size() < MAX_DECODE_PACKETS_IN_QUEUE; });
-        } else {
+void AudioService::ReportSendFailure() {
+    uplink_send_failures_++;
+}
+
+bool AudioService::PushPacketToDecodeQueue(AudioStreamPacketPtr packet, bool wait) {
+    size_t max_packets = MAX_DECODE_QUEUE_DURATION_MS / std::max(packet->frame_duration, MIN_OPUS_FRAME_DURATION_MS);
+    std::lock_guard<std::mutex> lock(decode_producer_mutex_);
+    while (audio_decode_queue_.Size() >= max_packets) {
+        if (!wait || service_stopped_) {
             return false;
         }
+        xSemaphoreTake(decode_space_semaphore_, portMAX_DELAY);
     }
-    audio_decode_queue_.push_back(std::move(packet));
-    audio_queue_cv_.notify_all();
+    if (!audio_decode_queue_.Push(std::move(packet))) {
+        return false;
+    }
+    NotifyTask(opus_decode_task_handle_);
     return true;
 }
 
-std::unique_ptr<AudioStreamPacket> AudioService::PopPacketFromSendQueue() {
-    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-    if (audio_send_queue_.empty()) {
+AudioStreamPacketPtr AudioService::PopPacketFromSendQueue() {
+    AudioStreamPacketPtr packet;
+    if (!audio_send_queue_.Pop(packet)) {
         return nullptr;
     }
-    auto packet = std::move(audio_send_queue_.front());
-    audio_send_queue_.pop_front();
-    audio_queue_cv_.notify_all();
+    /* A send slot is free, the encoder may continue */
+    NotifyTask(opus_encode_task_handle_);
     return packet;
 }
 
@@ -456,9 +702,13 @@ const std::string& AudioService::GetLastWakeWord() const {
     return wake_word_->GetLastDetectedWakeWord();
 }
 
-std::unique_ptr<AudioStreamPacket> AudioService::PopWakeWordPacket() {
-    auto packet = std::make_unique<AudioStreamPacket>();
+AudioStreamPacketPtr AudioService::PopWakeWordPacket() {
+    auto packet = AllocateAudioStreamPacket();
     if (wake_word_->GetWakeWordOpus(packet->payload)) {
+        auto detected_us = wake_word_detected_us_.exchange(0);
+        if (detected_us != 0) {
+            ESP_LOGI(TAG, "Wake word detection to first packet: %ld ms", (long)((esp_timer_get_time() - detected_us) / 1000));
+        }
         return packet;
     }
     return nullptr;
@@ -494,31 +744,103 @@ void AudioService::EnableVoiceProcessing(bool enable) {
         // 使用锁保护初始化检查和执行，防止 Check-Then-Act 竞态条件
         std::lock_guard<std::mutex> lock(init_mutex_);
         if (!audio_processor_initialized_) {
-            audio_processor_->Initialize(codec_, OPUS_FRAME_DURATION_MS, models_list_);
+            audio_processor_->Initialize(codec_, uplink_frame_duration_, models_list_);
             audio_processor_initialized_ = true;
         }
+        audio_processor_->SetFrameDuration(uplink_frame_duration_);
 
         /* We should make sure no audio is playing */
         ResetDecoder();
-        audio_input_need_warmup_ = true;
+        voice_processing_started_us_ = esp_timer_get_time();
+#if CONFIG_USE_LOCAL_ENDPOINTING
+        {
+            std::lock_guard<std::mutex> lock(endpoint_mutex_);
+            endpoint_detector_.Reset();
+        }
+#endif
+#if CONFIG_USE_AUDIO_INPUT_GATE
+        input_gate_.Reset();
+#endif
+        LATENCY_TRACE_RESET_CAPTURE();
+        {
+            // The encode task restarts its counters before the first frame of this session
+            std::lock_guard<std::mutex> lock(uplink_stats_mutex_);
+            uplink_stats_ = UplinkEncoderStats();
+            uplink_stats_reset_pending_ = true;
+        }
+#if CONFIG_USE_SERVER_AEC
+        aec_timeline_.ResetCapture();
+#endif
         audio_processor_->Start();
         xEventGroupSetBits(event_group_, AS_EVENT_AUDIO_PROCESSOR_RUNNING);
     } else {
         audio_processor_->Stop();
         xEventGroupClearBits(event_group_, AS_EVENT_AUDIO_PROCESSOR_RUNNING);
+
+        UplinkEncoderStats stats;
+        {
+            std::lock_guard<std::mutex> lock(uplink_stats_mutex_);
+            stats = uplink_stats_;
+        }
+        if (stats.frames > 0) {
+            ESP_LOGI(TAG, "Uplink: %lu frames, %lu bytes (%lu per frame), %lu DTX frames, bitrate level %lu, %lu step downs",
+                stats.frames, stats.payload_bytes, stats.payload_bytes / stats.frames, stats.dtx_frames, stats.level, stats.step_downs);
+        }
+#if CONFIG_USE_AUDIO_INPUT_GATE
+        auto gate_stats = input_gate_.stats();
+        if (gate_stats.chunks > 0) {
+            ESP_LOGI(TAG, "Input gate: %lu of %lu chunks skipped the audio processor (%lu%%), opened %lu times",
+                gate_stats.bypassed_chunks, gate_stats.chunks, gate_stats.bypassed_chunks * 100 / gate_stats.chunks, gate_stats.openings);
+        }
+#endif
+#if CONFIG_USE_SERVER_AEC
+        auto aec_stats = aec_timeline_.stats();
+        ESP_LOGI(TAG, "AEC timeline: %lu of %lu frames stamped, drift playback %ld ppm capture %ld ppm, %lu resyncs",
+            aec_stats.stamped_frames, aec_stats.frames, aec_stats.playback_drift_ppm, aec_stats.capture_drift_ppm, aec_stats.resyncs);
+#endif
     }
 }
 
+void AudioService::EnableEndpointing(bool enable) {
+#if CONFIG_USE_LOCAL_ENDPOINTING
+    endpointing_enabled_ = enable;
+#endif
+}
+
 void AudioService::EnableAudioTesting(bool enable) {
     ESP_LOGI(TAG, "%s audio testing", enable ? "Enabling" : "Disabling");
     if (enable) {
         xEventGroupSetBits(event_group_, AS_EVENT_AUDIO_TESTING_RUNNING);
     } else {
-        xEventGroupClearBits(event_group_, AS_EVENT_AUDIO_TESTING_RUNNING);
-        /* Copy audio_testing_queue_ to audio_decode_queue_ */
-        std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-        audio_decode_queue_ = std::move(audio_testing_queue_);
-        audio_queue_cv_.notify_all();
+        // Both the input task (queue full) and the main task (button) stop testing, only the first one replays
+        EventBits_t bits = xEventGroupClearBits(event_group_, AS_EVENT_AUDIO_TESTING_RUNNING);
+        if (!(bits & AS_EVENT_AUDIO_TESTING_RUNNING)) {
+            return;
+        }
+        /* Move audio_testing_queue_ to audio_decode_queue_, the decode ring is sized for the whole replay */
+        std::lock_guard<std::mutex> consumer_lock(testing_consumer_mutex_);
+        {
+            std::lock_guard<std::mutex> lock(decode_producer_mutex_);
+            audio_decode_queue_.Clear();
+        }
+        // The cleared slots count until the decode task frees them. Wait without the producer lock,
+        // the decode task may need it to queue a prompt sound before it gets there
+        NotifyTask(opus_decode_task_handle_);
+        while (!service_stopped_ &&
+            audio_decode_queue_.Size() + audio_testing_queue_.Size() > audio_decode_queue_.capacity()) {
+            if (xSemaphoreTake(decode_space_semaphore_, pdMS_TO_TICKS(AUDIO_TESTING_RELEASE_TIMEOUT_MS)) != pdTRUE) {
+                break;
+            }
+        }
+        std::lock_guard<std::mutex> lock(decode_producer_mutex_);
+        AudioStreamPacketPtr packet;
+        while (audio_testing_queue_.Pop(packet)) {
+            if (!audio_decode_queue_.Push(std::move(packet))) {
+                ESP_LOGW(TAG, "Decode queue is full, dropping audio testing packets");
+                break;
+            }
+        }
+        NotifyTask(opus_decode_task_handle_);
     }
 }
 
@@ -528,7 +850,7 @@ void AudioService::EnableDeviceAec(bool enable) {
         // 使用锁保护初始化检查和执行，防止 Check-Then-Act 竞态条件
         std::lock_guard<std::mutex> lock(init_mutex_);
         if (!audio_processor_initialized_) {
-            audio_processor_->Initialize(codec_, OPUS_FRAME_DURATION_MS, models_list_);
+            audio_processor_->Initialize(codec_, uplink_frame_duration_, models_list_);
             audio_processor_initialized_ = true;
         }
     }
@@ -539,121 +861,141 @@ void AudioService::SetCallbacks(AudioServiceCallbacks& callbacks) {
     callbacks_ = callbacks;
 }
 
-void AudioService::PlaySound(const std::string_view& ogg) {
+void AudioService::SetUplinkFrameDuration(int frame_duration_ms) {
+    if (frame_duration_ms != 20 && frame_duration_ms != 40 && frame_duration_ms != 60) {
+        ESP_LOGW(TAG, "Unsupported uplink frame duration %d ms, keeping %d ms", frame_duration_ms, uplink_frame_duration_.load());
+        return;
+    }
+    if (uplink_frame_duration_.exchange(frame_duration_ms) == frame_duration_ms) {
+        return;
+    }
+    ESP_LOGI(TAG, "Uplink frame duration: %d ms", frame_duration_ms);
+
+    std::lock_guard<std::mutex> lock(init_mutex_);
+    if (audio_processor_initialized_) {
+        audio_processor_->SetFrameDuration(frame_duration_ms);
+    }
+#if CONFIG_USE_AUDIO_INPUT_GATE
+    input_gate_.SetFrameDuration(frame_duration_ms);
+#endif
+    if (wake_word_) {
+        // The pre-roll picks it up when wake word detection starts again
+        wake_word_->SetEncodeFrameDuration(frame_duration_ms);
+    }
+}
+
+void AudioService::PlaySound(const std::string_view& ogg, bool priority) {
     if (!codec_->output_enabled()) {
         esp_timer_stop(audio_power_timer_);
         esp_timer_start_periodic(audio_power_timer_, AUDIO_POWER_CHECK_INTERVAL_MS * 1000);
         codec_->EnableOutput(true);
     }
 
-    const uint8_t* buf = reinterpret_cast<const uint8_t*>(ogg.data());
-    size_t size = ogg.size();
-    size_t offset = 0;
-
-    auto find_page = [&](size_t start)->size_t {
-        for (size_t i = start; i + 4 <= size; ++i) {
-            if (buf[i] == 'O' && buf[i+1] == 'g' && buf[i+2] == 'g' && buf[i+3] == 'S') return i;
+    // Cached sounds are mixed on top of the TTS, so the TTS decoder state is left alone
+    PromptRequest request;
+    request.sound = prompt_sound_cache_.Find(ogg, codec_->output_sample_rate());
+    request.priority = priority;
+    if (request.sound != nullptr) {
+        std::lock_guard<std::mutex> lock(prompt_producer_mutex_);
+        if (!prompt_queue_.Push(std::move(request))) {
+            ESP_LOGW(TAG, "Prompt queue is full, sound dropped");
+            return;
         }
-        return static_cast<size_t>(-1);
-    };
+        NotifyTask(audio_output_task_handle_);
+        return;
+    }
 
-    bool seen_head = false;
-    bool seen_tags = false;
-    int sample_rate = 16000; // 默认值
+    // Not cached yet, the caller may be any task, so the decode task decodes it into the cache
+    if (prompt_sound_cache_.Fits(ogg, codec_->output_sample_rate())) {
+        PromptDecodeRequest decode_request;
+        decode_request.ogg = ogg;
+        decode_request.priority = priority;
+        std::lock_guard<std::mutex> lock(prompt_producer_mutex_);
+        if (!prompt_decode_queue_.Push(std::move(decode_request))) {
+            ESP_LOGW(TAG, "Prompt decode queue is full, sound dropped");
+            return;
+        }
+        NotifyTask(opus_decode_task_handle_);
+        return;
+    }
 
-    while (true) {
-        size_t pos = find_page(offset);
-        if (pos == static_cast<size_t>(-1)) break;
-        offset = pos;
-        if (offset + 27 > size) break;
-
-        const uint8_t* page = buf + offset;
-        uint8_t page_segments = page[26];
-        size_t seg_table_off = offset + 27;
-        if (seg_table_off + page_segments > size) break;
-
-        size_t body_size = 0;
-        for (size_t i = 0; i < page_segments; ++i) body_size += page[27 + i];
-
-        size_t body_off = seg_table_off + page_segments;
-        if (body_off + body_size > size) break;
-
-        // Parse packets using lacing
-        size_t cur = body_off;
-        size_t seg_idx = 0;
-        while (seg_idx < page_segments) {
-            size_t pkt_len = 0;
-            size_t pkt_start = cur;
-            bool continued = false;
-            do {
-                uint8_t l = page[27 + seg_idx++];
-                pkt_len += l;
-                cur += l;
-                continued = (l == 255);
-            } while (continued && seg_idx < page_segments);
-
-            if (pkt_len == 0) continue;
-            const uint8_t* pkt_ptr = buf + pkt_start;
-
-            if (!seen_head) {
-                // 解析OpusHead包
-                if (pkt_len >= 19 && std::memcmp(pkt_ptr, "OpusHead", 8) == 0) {
-                    seen_head = true;
-                    
-                    // OpusHead结构：[0-7] "OpusHead", [8] version, [9] channel_count, [10-11] pre_skip
-                    // [12-15] input_sample_rate, [16-17] output_gain, [18] mapping_family
-                    if (pkt_len >= 12) {
-                        uint8_t version = pkt_ptr[8];
-                        uint8_t channel_count = pkt_ptr[9];
-                        
-                        if (pkt_len >= 16) {
-                            // 读取输入采样率 (little-endian)
-                            sample_rate = pkt_ptr[12] | (pkt_ptr[13] << 8) | 
-                                        (pkt_ptr[14] << 16) | (pkt_ptr[15] << 24);
-                            ESP_LOGI(TAG, "OpusHead: version=%d, channels=%d, sample_rate=%d", 
-                                   version, channel_count, sample_rate);
-                        }
-                    }
-                }
-                continue;
-            }
-            if (!seen_tags) {
-                // Expect OpusTags in second packet
-                if (pkt_len >= 8 && std::memcmp(pkt_ptr, "OpusTags", 8) == 0) {
-                    seen_tags = true;
-                }
-                continue;
-            }
+    // Not cacheable, decode the Opus packets in the decode task after the queued TTS
+    PushSoundPackets(ogg, true);
+}
 
-            // Audio packet (Opus)
-            auto packet = std::make_unique<AudioStreamPacket>();
-            packet->sample_rate = sample_rate;
-            packet->frame_duration = 60;
-            packet->payload.resize(pkt_len);
-            std::memcpy(packet->payload.data(), pkt_ptr, pkt_len);
-            PushPacketToDecodeQueue(std::move(packet), true);
+void AudioService::PushSoundPackets(const std::string_view& ogg, bool wait) {
+    // Without wait the caller is the decode task, a producer may hold the lock while it waits for this task to make room
+    std::unique_lock<std::mutex> lock;
+    if (!wait) {
+        lock = std::unique_lock<std::mutex>(decode_producer_mutex_, std::try_to_lock);
+        if (!lock.owns_lock()) {
+            ESP_LOGW(TAG, "Decode queue is busy, sound dropped");
+            return;
         }
+    }
+    PromptSoundCache::ParseOgg(ogg, [this, wait](int sample_rate, const uint8_t* packet_data, size_t packet_size) {
+        auto packet = AllocateAudioStreamPacket();
+        packet->sample_rate = sample_rate;
+        packet->frame_duration = 60;
+        packet->payload.assign(packet_data, packet_data + packet_size);
+        bool pushed = wait ? PushPacketToDecodeQueue(std::move(packet), true) :
+            audio_decode_queue_.Size() < MAX_DECODE_QUEUE_DURATION_MS / 60 && audio_decode_queue_.Push(std::move(packet));
+        if (!pushed) {
+            ESP_LOGW(TAG, "Decode queue is full, sound packet dropped");
+        }
+    });
+}
+
+void AudioService::DecodePromptSound(const PromptDecodeRequest& request) {
+    // 只能在 opus decode 任务中调用
+    PromptRequest prompt;
+    prompt.sound = prompt_sound_cache_.Get(request.ogg, codec_->output_sample_rate());
+    prompt.priority = request.priority;
+    // The prompt decode is the deepest call on this task, keep an eye on OPUS_DECODE_TASK_STACK_SIZE
+    ESP_LOGI(TAG, "Opus decode task stack: %u bytes never used", (unsigned)uxTaskGetStackHighWaterMark(nullptr));
+    if (!request.play) {
+        return;
+    }
+    if (prompt.sound == nullptr) {
+        // The cache filled up since PlaySound() checked, this task consumes the decode queue so it must not wait on it
+        PushSoundPackets(request.ogg, false);
+        return;
+    }
+    std::lock_guard<std::mutex> lock(prompt_producer_mutex_);
+    if (!prompt_queue_.Push(std::move(prompt))) {
+        ESP_LOGW(TAG, "Prompt queue is full, sound dropped");
+        return;
+    }
+    NotifyTask(audio_output_task_handle_);
+}
 
-        offset = body_off + body_size;
+void AudioService::PreloadSound(const std::string_view& ogg) {
+    // Decoding takes an Opus decoder's worth of stack, more than the caller may have
+    PromptDecodeRequest request;
+    request.ogg = ogg;
+    request.play = false;
+    std::lock_guard<std::mutex> lock(prompt_producer_mutex_);
+    if (!prompt_decode_queue_.Push(std::move(request))) {
+        ESP_LOGW(TAG, "Prompt decode queue is full, sound not preloaded");
+        return;
     }
+    NotifyTask(opus_decode_task_handle_);
 }
 
 bool AudioService::IsIdle() {
-    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-    return audio_encode_queue_.empty() && audio_decode_queue_.empty() && audio_playback_queue_.empty() && audio_testing_queue_.empty();
+    return audio_encode_queue_.Empty() && audio_decode_queue_.Empty() && audio_playback_queue_.Empty() && audio_testing_queue_.Empty() &&
+        prompt_queue_.Empty() && !mixer_.Active();
 }
 
 void AudioService::ResetDecoder() {
-    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
-    {
-        std::lock_guard<std::mutex> codec_lock(codec_mutex_);
-        opus_decoder_->ResetState();
-    }
-    timestamp_queue_.clear();
-    audio_decode_queue_.clear();
-    audio_playback_queue_.clear();
-    audio_testing_queue_.clear();
-    audio_queue_cv_.notify_all();
+    decoder_reset_pending_ = true;
+    audio_decode_queue_.Clear();
+    audio_playback_queue_.Clear();
+    audio_testing_queue_.Clear();
+
+    /* The consumers reset the decoder, release the flushed items and wake up blocked producers */
+    NotifyTask(opus_decode_task_handle_);
+    NotifyTask(audio_output_task_handle_);
 }
 
 void AudioService::CheckAndUpdateAudioPowerState() {
@@ -691,7 +1033,9 @@ void AudioService::SetModelsList(srmodel_list_t* models_list) {
 #endif
 
     if (wake_word_) {
+        wake_word_->SetEncodeFrameDuration(uplink_frame_duration_);
         wake_word_->OnWakeWordDetected([this](const std::string& wake_word) {
+            wake_word_detected_us_ = esp_timer_get_time();
             if (callbacks_.on_wake_word_detected) {
                 callbacks_.on_wake_word_detected(wake_word);
             }
@@ -2,8 +2,6 @@
 #define AUDIO_SERVICE_H
 
 #include <memory>
-#include <deque>
-#include <condition_variable>
 #include <chrono>
 #include <mutex>
 #include <atomic>
@@ -11,6 +9,7 @@
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <freertos/event_groups.h>
+#include <freertos/semphr.h>
 #include <esp_timer.h>
 #include <model_path.h>
 
@@ -20,29 +19,69 @@
 
 #include "audio_codec.h"
 #include "audio_processor.h"
-#include "processors/audio_debugger.h"
 #include "wake_word.h"
 #include "protocol.h"
+#include "spsc_queue.h"
+#include "object_pool.h"
+#include "jitter_buffer.h"
+#include "adaptive_opus_encoder.h"
+#include "prompt_sound_cache.h"
+#include "audio_mixer.h"
+#include "playback_rate_controller.h"
+#include "endpoint_detector.h"
+#include "input_gate.h"
+#include "aec_timeline.h"
+#include "audio_recorder.h"
 
 
 /*
  * There are two types of audio data flow:
  * 1. (MIC) -> [Processors] -> {Encode Queue} -> [Opus Encoder] -> {Send Queue} -> (Server)
- * 2. (Server) -> {Decode Queue} -> [Opus Decoder] -> {Playback Queue} -> (Speaker)
+ * 2. (Server) -> {Decode Queue} -> [Jitter Buffer] -> [Opus Decoder] -> [Playback Rate] -> {Playback Queue} -> (Speaker)
+ * 3. Cached prompt sounds skip the decoder: {Prompt Queue} -> [Mixer] -> (Speaker)
+ *    A sound that is not cached yet is decoded into the cache by the Opus decode task first.
+ *    The mixer adds them on top of the TTS in the output task, so they never wait behind it.
  *
- * We use one task for MIC / Speaker / Processors, and one task for Opus Encoder / Opus Decoder.
+ * We use one task for MIC / Speaker / Processors, one task for Opus Encoder and one task for Opus Decoder.
+ * The encoder and decoder tasks own their codec state, so a slow encode never delays playback.
  * 
  * Decode Queue and Send Queue are the main queues, because Opus packets are quite smaller than PCM packets.
  * 
+ * Every queue is a lock-free SPSC ring. The consumer task is woken by a task notification,
+ * and producers that may block wait on a per-queue semaphore given by the consumer.
  */
 
-#define OPUS_FRAME_DURATION_MS 60
+// Preferred uplink frame duration, sent in the hello message. The server may pick another one of 20 / 40 / 60 ms
+#define OPUS_FRAME_DURATION_MS CONFIG_OPUS_FRAME_DURATION_MS
+#define MIN_OPUS_FRAME_DURATION_MS 20
+#define MAX_OPUS_FRAME_DURATION_MS 60
 #define MAX_ENCODE_TASKS_IN_QUEUE 2
 #define MAX_PLAYBACK_TASKS_IN_QUEUE 2
-#define MAX_DECODE_PACKETS_IN_QUEUE (2400 / OPUS_FRAME_DURATION_MS)
-#define MAX_SEND_PACKETS_IN_QUEUE (2400 / OPUS_FRAME_DURATION_MS)
+// The decode and send queues are limited by duration, the packet count depends on the frame duration in use
+#define MAX_DECODE_QUEUE_DURATION_MS 2400
+#define MAX_SEND_QUEUE_DURATION_MS 2400
 #define AUDIO_TESTING_MAX_DURATION_MS 10000
-#define MAX_TIMESTAMPS_IN_QUEUE 3
+// Wait this long for the decode task to free the cleared decode slots before the testing replay
+#define AUDIO_TESTING_RELEASE_TIMEOUT_MS 500
+
+// Ring capacities are sized for the shortest frames, the decode ring also has to hold the audio testing replay
+#define DECODE_QUEUE_CAPACITY ((MAX_DECODE_QUEUE_DURATION_MS + AUDIO_TESTING_MAX_DURATION_MS) / MIN_OPUS_FRAME_DURATION_MS)
+#define SEND_QUEUE_CAPACITY (MAX_SEND_QUEUE_DURATION_MS / MIN_OPUS_FRAME_DURATION_MS)
+#define TESTING_QUEUE_CAPACITY (AUDIO_TESTING_MAX_DURATION_MS / MIN_OPUS_FRAME_DURATION_MS)
+#define PROMPT_QUEUE_CAPACITY 8
+
+// Idle AudioTask objects kept for reuse, and packets preallocated at startup
+#define AUDIO_TASK_POOL_SIZE (MAX_ENCODE_TASKS_IN_QUEUE + MAX_PLAYBACK_TASKS_IN_QUEUE + 4)
+#define AUDIO_PACKET_PREALLOCATE 24
+
+// Opus worker tasks, core -1 means no affinity
+// The decode task also decodes prompt sounds into the cache, with a second decoder and a resampler
+#define OPUS_DECODE_TASK_STACK_SIZE (2048 * 10)
+#define OPUS_ENCODE_TASK_STACK_SIZE (2048 * 13)
+#define OPUS_DECODE_TASK_CORE (CONFIG_OPUS_DECODE_TASK_CORE < 0 ? tskNO_AFFINITY : CONFIG_OPUS_DECODE_TASK_CORE)
+#define OPUS_ENCODE_TASK_CORE (CONFIG_OPUS_ENCODE_TASK_CORE < 0 ? tskNO_AFFINITY : CONFIG_OPUS_ENCODE_TASK_CORE)
+// Decoder + resampler pairs kept by SetDecodeSampleRate, TTS and local sounds usually need one each
+#define DECODER_CACHE_SIZE 3
 
 #define AUDIO_POWER_TIMEOUT_MS 15000
 #define AUDIO_POWER_CHECK_INTERVAL_MS 1000
@@ -52,11 +91,14 @@
 #define AS_EVENT_WAKE_WORD_RUNNING          (1 << 1)
 #define AS_EVENT_AUDIO_PROCESSOR_RUNNING    (1 << 2)
 #define AS_EVENT_PLAYBACK_NOT_EMPTY         (1 << 3)
+// Set by PrepareInput(), the input task powers up the codec input so only it touches the codec input state
+#define AS_EVENT_PREPARE_INPUT              (1 << 4)
 
 struct AudioServiceCallbacks {
     std::function<void(void)> on_send_queue_available;
     std::function<void(const std::string&)> on_wake_word_detected;
     std::function<void(bool)> on_vad_change;
+    std::function<void(void)> on_end_of_speech;
     std::function<void(void)> on_audio_testing_queue_full;
 };
 
@@ -67,10 +109,34 @@ enum AudioTaskType {
     kAudioTaskTypeDecodeToPlaybackQueue,
 };
 
+struct PromptRequest {
+    const PromptSound* sound = nullptr;
+    bool priority = false;
+};
+
+// A prompt sound played or preloaded before it was cached, the decode task decodes it and
+// then queues a PromptRequest unless it is only preloaded
+struct PromptDecodeRequest {
+    std::string_view ogg;
+    bool priority = false;
+    bool play = true;
+};
+
 struct AudioTask {
     AudioTaskType type;
     std::vector<int16_t> pcm;
     uint32_t timestamp;
+#if CONFIG_USE_AUDIO_LATENCY_TRACE
+    LatencyStamp trace;
+#endif
+};
+
+using AudioTaskPtr = ObjectPool<AudioTask>::Ptr;
+
+struct DecoderSlot {
+    std::unique_ptr<OpusDecoderWrapper> decoder;
+    OpusResampler resampler;    // Configured once when the decoder rate differs from the codec output
+    uint32_t last_used = 0;
 };
 
 struct DebugStatistics {
@@ -89,7 +155,7 @@ public:
     void Start();
     void Stop();
     void EncodeWakeWord();
-    std::unique_ptr<AudioStreamPacket> PopWakeWordPacket();
+    AudioStreamPacketPtr PopWakeWordPacket();
     const std::string& GetLastWakeWord() const;
     bool IsVoiceDetected() const { return voice_detected_; }
     bool IsIdle();
@@ -101,12 +167,28 @@ public:
     void EnableVoiceProcessing(bool enable);
     void EnableAudioTesting(bool enable);
     void EnableDeviceAec(bool enable);
+    // Report the end of the user's speech through on_end_of_speech, does nothing without CONFIG_USE_LOCAL_ENDPOINTING
+    void EnableEndpointing(bool enable);
+    // Power up the codec input ahead of a listening session (wake word, button, end of TTS),
+    // so it has settled by the time voice processing starts. May be called from any task,
+    // the audio input task does the work
+    void PrepareInput();
 
     void SetCallbacks(AudioServiceCallbacks& callbacks);
+    // Uplink frame duration negotiated in the hello exchange, must be 20, 40 or 60 ms
+    void SetUplinkFrameDuration(int frame_duration_ms);
+    int GetUplinkFrameDuration() const { return uplink_frame_duration_; }
 
-    bool PushPacketToDecodeQueue(std::unique_ptr<AudioStreamPacket> packet, bool wait = false);
-    std::unique_ptr<AudioStreamPacket> PopPacketFromSendQueue();
-    void PlaySound(const std::string_view& sound);
+    bool PushPacketToDecodeQueue(AudioStreamPacketPtr packet, bool wait = false);
+    AudioStreamPacketPtr PopPacketFromSendQueue();
+    size_t GetSendQueueSize() const { return audio_send_queue_.Size(); }
+    // Called when the protocol failed to send a packet, the encoder lowers its bitrate on repeated failures
+    void ReportSendFailure();
+    // Sounds are mixed over the TTS and play in order with others of the same priority,
+    // a priority sound (alert) ducks the TTS and the other prompts while it plays
+    void PlaySound(const std::string_view& sound, bool priority = false);
+    // Decode a prompt sound into the cache ahead of its first PlaySound(), on the decode task
+    void PreloadSound(const std::string_view& sound);
     bool ReadAudioData(std::vector<int16_t>& data, int sample_rate, int samples);
     void ResetDecoder();
     void SetModelsList(srmodel_list_t* models_list);
@@ -116,12 +198,28 @@ private:
     AudioServiceCallbacks callbacks_;
     std::unique_ptr<AudioProcessor> audio_processor_;
     std::unique_ptr<WakeWord> wake_word_;
-    std::unique_ptr<AudioDebugger> audio_debugger_;
-    std::unique_ptr<OpusEncoderWrapper> opus_encoder_;
-    std::unique_ptr<OpusDecoderWrapper> opus_decoder_;
+    // Owned by the opus encode task, created once and reconfigured in place when the frame duration changes
+    std::unique_ptr<AdaptiveOpusEncoder> opus_encoder_;
+    // Published by the opus encode task after each uplink frame, read by EnableVoiceProcessing(false)
+    UplinkEncoderStats uplink_stats_;
+    std::mutex uplink_stats_mutex_;
+    std::atomic<bool> uplink_stats_reset_pending_{false};
+    // Owned by the opus decode task, together with output_resample_buffer_, jitter_buffer_ and playback_rate_.
+    // opus_decoder_ and output_resampler_ point into the slot picked by SetDecodeSampleRate
+    DecoderSlot decoder_slots_[DECODER_CACHE_SIZE];
+    uint32_t decoder_slot_uses_ = 0;
+    OpusDecoderWrapper* opus_decoder_ = nullptr;
+    OpusResampler* output_resampler_ = nullptr;
     OpusResampler input_resampler_;
     OpusResampler reference_resampler_;
-    OpusResampler output_resampler_;
+    // Scratch buffers for ReadAudioData, only used by the audio input task
+    std::vector<int16_t> input_reference_buffer_;
+    std::vector<int16_t> input_resampled_mic_buffer_;
+    std::vector<int16_t> input_resampled_reference_buffer_;
+    std::vector<int16_t> output_resample_buffer_;
+    JitterBuffer jitter_buffer_;
+    PlaybackRateController playback_rate_;
+    PromptSoundCache prompt_sound_cache_;
     DebugStatistics debug_statistics_;
     srmodel_list_t* models_list_ = nullptr;
 
@@ -130,24 +228,66 @@ private:
     // Audio encode / decode
     TaskHandle_t audio_input_task_handle_ = nullptr;
     TaskHandle_t audio_output_task_handle_ = nullptr;
-    TaskHandle_t opus_codec_task_handle_ = nullptr;
-    std::mutex audio_queue_mutex_;
-    std::condition_variable audio_queue_cv_;
-    std::mutex codec_mutex_;  // 保护 opus_decoder_ 和 resampler_ 的访问
+    TaskHandle_t opus_decode_task_handle_ = nullptr;
+    TaskHandle_t opus_encode_task_handle_ = nullptr;
+    // ResetDecoder() only raises this flag, the decode task resets its own decoder state
+    std::atomic<bool> decoder_reset_pending_{false};
     std::mutex init_mutex_;   // 保护初始化操作
-    std::deque<std::unique_ptr<AudioStreamPacket>> audio_decode_queue_;
-    std::deque<std::unique_ptr<AudioStreamPacket>> audio_send_queue_;
-    std::deque<std::unique_ptr<AudioStreamPacket>> audio_testing_queue_;
-    std::deque<std::unique_ptr<AudioTask>> audio_encode_queue_;
-    std::deque<std::unique_ptr<AudioTask>> audio_playback_queue_;
-    // For server AEC
-    std::deque<uint32_t> timestamp_queue_;
+    // The decode and encode queues have more than one producer task, producers serialize on these
+    std::mutex decode_producer_mutex_;
+    std::mutex encode_producer_mutex_;
+    // EnableAudioTesting(false) may run on the input task or the main task, it is the testing queue consumer
+    std::mutex testing_consumer_mutex_;
+    SemaphoreHandle_t decode_space_semaphore_ = nullptr;
+    SemaphoreHandle_t encode_space_semaphore_ = nullptr;
+    // Declared before the queues so that it outlives the tasks they hold
+    ObjectPool<AudioTask> audio_task_pool_{AUDIO_TASK_POOL_SIZE, [](AudioTask& task) {
+        task.timestamp = 0;
+        task.pcm.clear();
+#if CONFIG_USE_AUDIO_LATENCY_TRACE
+        task.trace = LatencyStamp();
+#endif
+        task.pcm.reserve(16000 * MAX_OPUS_FRAME_DURATION_MS / 1000);
+    }};
+    SpscQueue<AudioStreamPacketPtr> audio_decode_queue_{DECODE_QUEUE_CAPACITY};
+    SpscQueue<AudioStreamPacketPtr> audio_send_queue_{SEND_QUEUE_CAPACITY};
+    SpscQueue<AudioStreamPacketPtr> audio_testing_queue_{TESTING_QUEUE_CAPACITY};
+    SpscQueue<AudioTaskPtr> audio_encode_queue_{MAX_ENCODE_TASKS_IN_QUEUE};
+    SpscQueue<AudioTaskPtr> audio_playback_queue_{MAX_PLAYBACK_TASKS_IN_QUEUE};
+    // Cached prompt sounds, produced under prompt_producer_mutex_ and consumed by the output task
+    SpscQueue<PromptRequest> prompt_queue_{PROMPT_QUEUE_CAPACITY};
+    // Sounds to cache on first use or preload, produced under prompt_producer_mutex_ and consumed by the decode task
+    SpscQueue<PromptDecodeRequest> prompt_decode_queue_{PROMPT_QUEUE_CAPACITY};
+    std::mutex prompt_producer_mutex_;
+    // Owned by the audio output task
+    AudioMixer mixer_;
+#if CONFIG_USE_LOCAL_ENDPOINTING
+    // Fed by the audio processor task, and by the input task while the input gate is closed
+    EndpointDetector endpoint_detector_;
+    std::mutex endpoint_mutex_;
+    std::atomic<bool> endpointing_enabled_{false};
+#endif
+#if CONFIG_USE_AUDIO_INPUT_GATE
+    // Owned by the audio input task
+    InputGate input_gate_;
+    std::vector<int16_t> input_gate_silence_;
+#endif
+#if CONFIG_USE_SERVER_AEC
+    // Fed by the output task (played blocks) and the input task (captured blocks)
+    AecTimeline aec_timeline_;
+#endif
 
     std::atomic<bool> wake_word_initialized_{false};
     std::atomic<bool> audio_processor_initialized_{false};
     std::atomic<bool> voice_detected_{false};
+    std::atomic<int> uplink_frame_duration_{OPUS_FRAME_DURATION_MS};
+    std::atomic<bool> uplink_dtx_{false};
+    std::atomic<uint32_t> uplink_send_failures_{0};
+    // Detection time of the last wake word, cleared when its first packet is handed out
+    std::atomic<int64_t> wake_word_detected_us_{0};
     bool service_stopped_ = true;
-    bool audio_input_need_warmup_ = false;
+    // Start of voice processing, cleared when its first settled sample reaches the audio processor
+    std::atomic<int64_t> voice_processing_started_us_{0};
 
     esp_timer_handle_t audio_power_timer_ = nullptr;
     std::chrono::steady_clock::time_point last_input_time_;
@@ -155,10 +295,17 @@ private:
 
     void AudioInputTask();
     void AudioOutputTask();
-    void OpusCodecTask();
-    void PushTaskToEncodeQueue(AudioTaskType type, std::vector<int16_t>&& pcm);
+    void OpusDecodeTask();
+    void OpusEncodeTask();
+    void PushTaskToEncodeQueue(AudioTaskType type, const int16_t* pcm, size_t samples);
+    void PushSoundPackets(const std::string_view& ogg, bool wait);
+    void DecodePromptSound(const PromptDecodeRequest& request);
+    void NotifyTask(TaskHandle_t task);
     void SetDecodeSampleRate(int sample_rate, int frame_duration);
     void CheckAndUpdateAudioPowerState();
+    void EnableCodecInput();
+    void OnProcessedAudio(const int16_t* data, size_t samples);
+    bool DiscardUnsettledInput(std::vector<int16_t>& data);
 };
 
 #endif
\ No newline at end of file
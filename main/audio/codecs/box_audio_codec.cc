@@ -13,6 +13,7 @@ BoxAudioCodec::BoxAudioCodec(void* i2c_master_handle, int input_sample_rate, int
     input_reference_ = input_reference; // 是否使用参考输入，实现回声消除
     input_channels_ = input_reference_ ? 2 : 1; // 输入通道数
     input_sample_rate_ = input_sample_rate;
+    input_settle_ms_ = 80; // 输入上电后丢弃的稳定时间
     output_sample_rate_ = output_sample_rate;
     input_gain_ = 30;
 
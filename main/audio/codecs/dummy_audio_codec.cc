@@ -5,6 +5,7 @@ DummyAudioCodec::DummyAudioCodec(int input_sample_rate, int output_sample_rate)
     input_reference_ = false;
     input_channels_ = 1;
     input_sample_rate_ = input_sample_rate;
+    input_settle_ms_ = 0;
     output_sample_rate_ = output_sample_rate;
 }
 
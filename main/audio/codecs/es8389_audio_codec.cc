@@ -11,6 +11,7 @@ Es8389AudioCodec::Es8389AudioCodec(void* i2c_master_handle, i2c_port_t i2c_port,
     input_reference_ = false; // 是否使用参考输入，实现回声消除
     input_channels_ = 1; // 输入通道数
     input_sample_rate_ = input_sample_rate;
+    input_settle_ms_ = 40; // 输入上电后丢弃的稳定时间
     output_sample_rate_ = output_sample_rate;
     input_gain_ = 40;
     pa_pin_ = pa_pin;
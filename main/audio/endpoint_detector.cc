@@ -0,0 +1,67 @@
+#include "endpoint_detector.h"
+
+#if CONFIG_USE_LOCAL_ENDPOINTING
+
+#include <esp_log.h>
+#include <algorithm>
+#include <cmath>
+
+#define TAG "EndpointDetector"
+
+void EndpointDetector::Reset() {
+    vad_speaking_ = false;
+    endpointed_ = false;
+    speech_samples_ = 0;
+    silence_samples_ = 0;
+    stats_.speech_ms = 0;
+}
+
+void EndpointDetector::OnVadChange(bool speaking) {
+    vad_speaking_ = speaking;
+}
+
+bool EndpointDetector::Process(const int16_t* pcm, size_t samples, int sample_rate) {
+    if (endpointed_ || samples == 0) {
+        return false;
+    }
+
+    int64_t energy = 0;
+    for (size_t i = 0; i < samples; i++) {
+        energy += pcm[i] * pcm[i];
+    }
+    uint32_t rms = static_cast<uint32_t>(sqrtf(static_cast<float>(energy / static_cast<int64_t>(samples))));
+
+    bool speech = vad_speaking_ && rms >= noise_rms_ * ENDPOINT_SPEECH_TO_NOISE_RATIO;
+    if (!vad_speaking_) {
+        // Follow a falling noise floor quickly and a rising one slowly
+        if (rms < noise_rms_) {
+            noise_rms_ = (noise_rms_ + rms) / 2;
+        } else {
+            noise_rms_ += (rms - noise_rms_) / 16;
+        }
+        noise_rms_ = std::max<uint32_t>(noise_rms_, ENDPOINT_MIN_NOISE_RMS);
+    }
+
+    if (speech) {
+        speech_samples_ += samples;
+        silence_samples_ = 0;
+        return false;
+    }
+    silence_samples_ += samples;
+    if (silence_samples_ < static_cast<uint64_t>(sample_rate) * CONFIG_ENDPOINT_HANGOVER_MS / 1000) {
+        return false;
+    }
+    if (speech_samples_ < static_cast<uint64_t>(sample_rate) * CONFIG_ENDPOINT_MIN_SPEECH_MS / 1000) {
+        // Too little speech before the pause, a short noise burst does not make a turn
+        speech_samples_ = 0;
+        return false;
+    }
+
+    endpointed_ = true;
+    stats_.speech_ms = speech_samples_ * 1000 / sample_rate;
+    stats_.endpoints++;
+    ESP_LOGI(TAG, "End of speech after %lu ms of speech, noise rms %lu", stats_.speech_ms, noise_rms_);
+    return true;
+}
+
+#endif // CONFIG_USE_LOCAL_ENDPOINTING
@@ -0,0 +1,51 @@
+#ifndef ENDPOINT_DETECTOR_H
+#define ENDPOINT_DETECTOR_H
+
+#include <sdkconfig.h>
+#include <cstdint>
+#include <cstddef>
+
+#if CONFIG_USE_LOCAL_ENDPOINTING
+
+// A frame counts as speech when the VAD reports speech and its level is this many times the noise floor
+#define ENDPOINT_SPEECH_TO_NOISE_RATIO 3
+// Lowest noise floor in RMS, keeps digital silence from making every sound look like speech
+#define ENDPOINT_MIN_NOISE_RMS 30
+
+struct EndpointStats {
+    uint32_t speech_ms = 0;         // Speech in the last turn
+    uint32_t endpoints = 0;         // Turns ended on the device
+};
+
+/*
+ * Decides on the device that the user stopped talking, instead of waiting for the server VAD.
+ *
+ * The audio processor VAD is combined with the frame energy: a frame only counts as speech
+ * when the VAD says so and it stands out from the noise floor, which is tracked while the VAD
+ * reports silence. After at least CONFIG_ENDPOINT_MIN_SPEECH_MS of speech, the turn ends once
+ * CONFIG_ENDPOINT_HANGOVER_MS of non-speech followed. Time is counted in samples, so the
+ * result only depends on the audio.
+ *
+ * Used from the audio processor task, OnVadChange and Process come from the same task.
+ */
+class EndpointDetector {
+public:
+    void Reset();
+    void OnVadChange(bool speaking);
+    // Returns true on the frame that ends the turn, once per Reset
+    bool Process(const int16_t* pcm, size_t samples, int sample_rate = 16000);
+
+    const EndpointStats& stats() const { return stats_; }
+
+private:
+    bool vad_speaking_ = false;
+    bool endpointed_ = false;
+    uint32_t noise_rms_ = ENDPOINT_MIN_NOISE_RMS;
+    uint64_t speech_samples_ = 0;
+    uint64_t silence_samples_ = 0;
+    EndpointStats stats_;
+};
+
+#endif // CONFIG_USE_LOCAL_ENDPOINTING
+
+#endif // ENDPOINT_DETECTOR_H
@@ -0,0 +1,122 @@
+#include "input_gate.h"
+
+#if CONFIG_USE_AUDIO_INPUT_GATE
+
+#include <esp_log.h>
+#include <algorithm>
+
+#define TAG "InputGate"
+
+void InputGate::Initialize(int channels, int frame_duration_ms) {
+    channels_ = channels;
+    SetFrameDuration(frame_duration_ms);
+}
+
+void InputGate::SetFrameDuration(int frame_duration_ms) {
+    frame_samples_ = frame_duration_ms * 16000 / 1000;
+}
+
+void InputGate::Reset() {
+    open_ = true;
+    quiet_samples_ = 0;
+    silence_samples_ = 0;
+    lookahead_head_ = 0;
+    lookahead_count_ = 0;
+}
+
+void InputGate::OnFeed(std::function<void(std::vector<int16_t>& chunk)> callback) {
+    feed_callback_ = callback;
+}
+
+void InputGate::OnSilence(std::function<void(size_t samples)> callback) {
+    silence_callback_ = callback;
+}
+
+bool InputGate::IsActive(const std::vector<int16_t>& chunk) {
+    // Mic channel only, the reference channel follows it when there is one
+    size_t samples = chunk.size() / channels_;
+    if (samples == 0) {
+        return false;
+    }
+    uint64_t energy = 0;
+    uint32_t crossings = 0;
+    int16_t previous = chunk[0];
+    for (size_t i = 0; i < samples; i++) {
+        int32_t sample = chunk[i * channels_];
+        energy += sample * sample;
+        crossings += (sample ^ previous) < 0;
+        previous = sample;
+    }
+    uint32_t mean_energy = energy / samples;
+    uint32_t zcr_permille = crossings * 1000 / samples;
+
+    bool active = mean_energy > noise_energy_ * INPUT_GATE_ACTIVE_ENERGY_RATIO ||
+        (zcr_permille > INPUT_GATE_FRICATIVE_ZCR_PERMILLE && mean_energy > noise_energy_ * INPUT_GATE_FRICATIVE_ENERGY_RATIO);
+    if (!active) {
+        // Follow a falling noise floor right away and a rising one slowly
+        if (mean_energy < noise_energy_) {
+            noise_energy_ = mean_energy;
+        } else {
+            noise_energy_ += (mean_energy - noise_energy_) / 64;
+        }
+        noise_energy_ = std::max<uint32_t>(noise_energy_, INPUT_GATE_MIN_NOISE_ENERGY);
+    }
+    return active;
+}
+
+void InputGate::FlushLookahead() {
+    while (lookahead_count_ > 0) {
+        feed_callback_(lookahead_[lookahead_head_]);
+        lookahead_head_ = (lookahead_head_ + 1) % INPUT_GATE_LOOKAHEAD_SLOTS;
+        lookahead_count_--;
+    }
+    lookahead_head_ = 0;
+}
+
+void InputGate::Process(std::vector<int16_t>& chunk, bool keep_open) {
+    size_t samples = chunk.size() / channels_;
+    bool active = IsActive(chunk) || keep_open;
+    stats_.chunks++;
+
+    if (open_) {
+        feed_callback_(chunk);
+        quiet_samples_ = active ? 0 : quiet_samples_ + samples;
+        if (quiet_samples_ >= INPUT_GATE_HANGOVER_MS * 16000 / 1000) {
+            open_ = false;
+            silence_samples_ = 0;
+            ESP_LOGD(TAG, "Gate closed, noise energy %lu", noise_energy_);
+        }
+        return;
+    }
+
+    // Hold the chunk back, swapping buffers so nothing is copied
+    size_t capacity = std::clamp<size_t>((INPUT_GATE_LOOKAHEAD_MS * 16000 / 1000 + samples - 1) / samples,
+        1, INPUT_GATE_MAX_LOOKAHEAD_CHUNKS);
+    size_t tail = (lookahead_head_ + lookahead_count_) % INPUT_GATE_LOOKAHEAD_SLOTS;
+    std::swap(lookahead_[tail], chunk);
+    lookahead_count_++;
+
+    if (active) {
+        open_ = true;
+        quiet_samples_ = 0;
+        stats_.openings++;
+        ESP_LOGD(TAG, "Gate opened, feeding %u held back chunks", lookahead_count_);
+        FlushLookahead();
+        return;
+    }
+
+    if (lookahead_count_ > capacity) {
+        // The oldest chunk is now known to be silence, it never reaches the processor
+        lookahead_head_ = (lookahead_head_ + 1) % INPUT_GATE_LOOKAHEAD_SLOTS;
+        lookahead_count_--;
+        stats_.bypassed_chunks++;
+        silence_samples_ += samples;
+        size_t frame_samples = frame_samples_;
+        while (frame_samples > 0 && silence_samples_ >= frame_samples) {
+            silence_samples_ -= frame_samples;
+            silence_callback_(frame_samples);
+        }
+    }
+}
+
+#endif // CONFIG_USE_AUDIO_INPUT_GATE
@@ -0,0 +1,86 @@
+#ifndef INPUT_GATE_H
+#define INPUT_GATE_H
+
+#include <sdkconfig.h>
+#include <vector>
+#include <functional>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+#if CONFIG_USE_AUDIO_INPUT_GATE
+
+// Input kept back while the gate is closed, fed to the processor first when it opens so onsets are not clipped
+#define INPUT_GATE_LOOKAHEAD_MS 100
+// Quiet input needed before the gate closes again
+#define INPUT_GATE_HANGOVER_MS 1500
+// Activity: level 6 dB over the noise floor, or a fricative (many zero crossings) 3 dB over it
+#define INPUT_GATE_ACTIVE_ENERGY_RATIO 4
+#define INPUT_GATE_FRICATIVE_ENERGY_RATIO 2
+#define INPUT_GATE_FRICATIVE_ZCR_PERMILLE 300
+// Lowest noise floor in mean square, so a dead quiet input does not open the gate on every click
+#define INPUT_GATE_MIN_NOISE_ENERGY 400
+#define INPUT_GATE_MAX_LOOKAHEAD_CHUNKS 8
+// One slot more than the lookahead holds, the incoming chunk is stored before the oldest leaves
+#define INPUT_GATE_LOOKAHEAD_SLOTS (INPUT_GATE_MAX_LOOKAHEAD_CHUNKS + 1)
+// The gate stays open this long after the speaker played, so the AEC keeps seeing the echo
+#define INPUT_GATE_PLAYBACK_HOLD_MS 500
+
+struct InputGateStats {
+    uint32_t chunks = 0;
+    uint32_t bypassed_chunks = 0;      // Chunks the audio processor never saw
+    uint32_t openings = 0;
+};
+
+/*
+ * Cheap energy / zero crossing gate in front of the audio processor.
+ *
+ * While the room is clearly silent, input chunks are not fed to the AFE at all, which saves
+ * its noise suppression, VAD and AEC work. The uplink still gets frames of digital silence,
+ * so the server keeps an unbroken stream and the encoder sends DTX frames. The last
+ * INPUT_GATE_LOOKAHEAD_MS of input is held back, when activity shows up the held chunks go to
+ * the processor first. A chunk only becomes silence once it leaves the lookahead.
+ *
+ * The gate closes after INPUT_GATE_HANGOVER_MS of quiet input, and only while the processor
+ * VAD reports silence, so the VAD and everything driven by it see the end of the speech.
+ * Only the audio input task uses it.
+ */
+class InputGate {
+public:
+    void Initialize(int channels, int frame_duration_ms);
+    void SetFrameDuration(int frame_duration_ms);
+    // Opens the gate and forgets the held back input
+    void Reset();
+    // keep_open (VAD speech, playback) counts as activity. May swap the chunk with a held back
+    // buffer, the caller keeps reusing it for reads
+    void Process(std::vector<int16_t>& chunk, bool keep_open);
+
+    // Chunks for the processor, in input order
+    void OnFeed(std::function<void(std::vector<int16_t>& chunk)> callback);
+    // A frame of silence replaces skipped input, the argument is the frame size in samples
+    void OnSilence(std::function<void(size_t samples)> callback);
+
+    bool is_open() const { return open_; }
+    InputGateStats stats() const { return stats_; }
+
+private:
+    int channels_ = 1;
+    std::atomic<int> frame_samples_{0};
+    bool open_ = true;
+    uint32_t noise_energy_ = INPUT_GATE_MIN_NOISE_ENERGY;
+    uint64_t quiet_samples_ = 0;
+    uint64_t silence_samples_ = 0;       // Skipped input not yet sent as silence frames
+    std::vector<int16_t> lookahead_[INPUT_GATE_LOOKAHEAD_SLOTS];
+    size_t lookahead_head_ = 0;
+    size_t lookahead_count_ = 0;
+    std::function<void(std::vector<int16_t>& chunk)> feed_callback_;
+    std::function<void(size_t samples)> silence_callback_;
+    InputGateStats stats_;
+
+    bool IsActive(const std::vector<int16_t>& chunk);
+    void FlushLookahead();
+};
+
+#endif // CONFIG_USE_AUDIO_INPUT_GATE
+
+#endif // INPUT_GATE_H
@@ -0,0 +1,152 @@
+#include "jitter_buffer.h"
+
+#include <esp_log.h>
+#include <algorithm>
+
+#define TAG "JitterBuffer"
+
+void JitterBuffer::Put(AudioStreamPacketPtr packet, int64_t now_us) {
+    stats_.received++;
+    sample_rate_ = packet->sample_rate;
+    if (packet->frame_duration > 0) {
+        frame_duration_ = packet->frame_duration;
+    }
+
+    uint32_t sequence = packet->sequence;
+    if (!synced_) {
+        Resync(sequence);
+    }
+
+    int32_t offset = static_cast<int32_t>(sequence - next_sequence_);
+    if (offset < 0 && offset > -JITTER_BUFFER_CAPACITY) {
+        stats_.late_drops++;
+        return;
+    }
+    if (offset < 0 || offset >= JITTER_BUFFER_CAPACITY) {
+        // Too far from the current window, the server started a new stream
+        ESP_LOGW(TAG, "Sequence jumped from %lu to %lu, resync", (unsigned long)next_sequence_, (unsigned long)sequence);
+        Resync(sequence);
+    }
+
+    uint32_t index = sequence & kMask;
+    if (slots_[index]) {
+        stats_.duplicates++;
+        return;
+    }
+    if (starved_ && sequence == next_sequence_) {
+        // The stream went on after the buffer ran dry, so it was an underrun and not the end of the stream
+        stats_.underruns++;
+    }
+    starved_ = false;
+
+    UpdateJitter(sequence, now_us);
+    slots_[index] = std::move(packet);
+    arrival_us_[index] = now_us;
+    count_++;
+}
+
+JitterBuffer::Result JitterBuffer::Get(AudioStreamPacketPtr& packet, int64_t now_us) {
+    if (count_ == 0) {
+        if (playing_) {
+            playing_ = false;
+            starved_ = true;
+            // The next packet may follow a pause between sentences, measure it against a new baseline
+            has_transit_ = false;
+        }
+        return kWait;
+    }
+
+    int64_t waited_us = now_us - OldestArrivalUs();
+    if (!playing_) {
+        if (count_ < TargetDepth() && waited_us < TargetDelayUs()) {
+            return kWait;
+        }
+        playing_ = true;
+    }
+
+    uint32_t index = next_sequence_ & kMask;
+    if (slots_[index]) {
+        packet = std::move(slots_[index]);
+        count_--;
+        next_sequence_++;
+        return kPacket;
+    }
+
+    // Give a reordered packet one frame to show up before concealing it
+    if (count_ <= TargetDepth() && waited_us < frame_duration_ * 1000) {
+        return kWait;
+    }
+    packet = AllocateAudioStreamPacket();
+    packet->sample_rate = sample_rate_;
+    packet->frame_duration = frame_duration_;
+    packet->sequence = next_sequence_;
+    next_sequence_++;
+    stats_.concealed++;
+    return kConceal;
+}
+
+void JitterBuffer::Reset() {
+    for (auto& slot : slots_) {
+        slot.reset();
+    }
+    count_ = 0;
+    synced_ = false;
+    playing_ = false;
+    starved_ = false;
+    has_transit_ = false;
+}
+
+const JitterBufferStats& JitterBuffer::stats() {
+    stats_.depth = count_;
+    stats_.target_depth = TargetDepth();
+    stats_.jitter_ms = jitter_us_ / 1000;
+    return stats_;
+}
+
+void JitterBuffer::Resync(uint32_t sequence) {
+    for (auto& slot : slots_) {
+        slot.reset();
+    }
+    count_ = 0;
+    next_sequence_ = sequence;
+    synced_ = true;
+    playing_ = false;
+    starved_ = false;
+    has_transit_ = false;
+}
+
+void JitterBuffer::UpdateJitter(uint32_t sequence, int64_t now_us) {
+    // Transit time relative to the media clock, only packets later than expected count as jitter,
+    // the server often sends TTS faster than realtime and early packets never hurt playback.
+    // The sequence keeps counting across sentences, so a gap longer than the largest delay we would
+    // ever buffer is a pause between talkspurts and only restarts the baseline
+    int64_t transit_us = now_us - static_cast<int64_t>(sequence) * frame_duration_ * 1000;
+    if (has_transit_) {
+        int64_t lateness_us = std::max<int64_t>(transit_us - last_transit_us_, 0);
+        if (lateness_us <= JITTER_BUFFER_MAX_DELAY_MS * 1000) {
+            jitter_us_ += (lateness_us - jitter_us_) / 16;
+        }
+    }
+    last_transit_us_ = transit_us;
+    has_transit_ = true;
+}
+
+int64_t JitterBuffer::TargetDelayUs() const {
+    return std::clamp<int64_t>(jitter_us_ * 3, JITTER_BUFFER_MIN_DELAY_MS * 1000, JITTER_BUFFER_MAX_DELAY_MS * 1000);
+}
+
+size_t JitterBuffer::TargetDepth() const {
+    int64_t frame_us = frame_duration_ * 1000;
+    size_t depth = (TargetDelayUs() + frame_us - 1) / frame_us;
+    return std::clamp<size_t>(depth, 1, JITTER_BUFFER_CAPACITY / 2);
+}
+
+int64_t JitterBuffer::OldestArrivalUs() const {
+    int64_t oldest = INT64_MAX;
+    for (uint32_t i = 0; i < JITTER_BUFFER_CAPACITY; i++) {
+        if (slots_[i]) {
+            oldest = std::min(oldest, arrival_us_[i]);
+        }
+    }
+    return oldest;
+}
@@ -0,0 +1,84 @@
+#ifndef JITTER_BUFFER_H
+#define JITTER_BUFFER_H
+
+#include <cstdint>
+#include <cstddef>
+
+#include "protocol.h"
+
+// Sequence window held by the jitter buffer, must be a power of two
+#define JITTER_BUFFER_CAPACITY 32
+#define JITTER_BUFFER_MIN_DELAY_MS 0
+#define JITTER_BUFFER_MAX_DELAY_MS 600
+
+struct JitterBufferStats {
+    uint32_t depth = 0;           // Packets held right now
+    uint32_t target_depth = 0;    // Packets buffered before playback (re)starts
+    uint32_t jitter_ms = 0;       // Estimated late arrival jitter
+    uint32_t received = 0;
+    uint32_t concealed = 0;       // Frames generated by packet loss concealment
+    uint32_t late_drops = 0;      // Packets that arrived after their frame was played or concealed
+    uint32_t duplicates = 0;
+    uint32_t underruns = 0;       // The buffer ran dry in the middle of a stream
+};
+
+/*
+ * Reorders sequenced downlink packets and decides when the next frame is played.
+ *
+ * The target depth follows an RFC 3550 style estimate of how late packets arrive compared
+ * to their sequence number. The estimate restarts its baseline when the buffer runs dry, so
+ * a pause between sentences is not mistaken for jitter. Playback starts once the target depth
+ * is buffered, or once the oldest packet has waited for the target delay, so short sentences
+ * are not held back.
+ * A missing packet is concealed only when later packets are already buffered, the end of
+ * a stream is never padded with concealment.
+ *
+ * Only the opus decode task uses it, so there is no locking.
+ */
+class JitterBuffer {
+public:
+    enum Result {
+        kWait,      // Nothing to play yet
+        kPacket,    // Decode the returned packet
+        kConceal,   // The returned packet has an empty payload, decode it to run packet loss concealment
+    };
+
+    void Put(AudioStreamPacketPtr packet, int64_t now_us);
+    Result Get(AudioStreamPacketPtr& packet, int64_t now_us);
+    // Drop the held packets and wait for a new stream, the jitter estimate is kept
+    void Reset();
+
+    bool Empty() const { return count_ == 0; }
+    size_t Size() const { return count_; }
+    bool Full() const { return count_ >= JITTER_BUFFER_CAPACITY; }
+    int frame_duration() const { return frame_duration_; }
+    // Refreshes and returns the counters, decode task only like everything else here
+    const JitterBufferStats& stats();
+
+private:
+    static constexpr uint32_t kMask = JITTER_BUFFER_CAPACITY - 1;
+
+    AudioStreamPacketPtr slots_[JITTER_BUFFER_CAPACITY];
+    int64_t arrival_us_[JITTER_BUFFER_CAPACITY] = {};
+    size_t count_ = 0;
+    uint32_t next_sequence_ = 0;
+    bool synced_ = false;
+    bool playing_ = false;
+    bool starved_ = false;
+
+    int sample_rate_ = 24000;
+    int frame_duration_ = 60;
+    int64_t last_transit_us_ = 0;
+    bool has_transit_ = false;
+    int64_t jitter_us_ = 0;
+
+    JitterBufferStats stats_;
+
+    void Resync(uint32_t sequence);
+    void UpdateJitter(uint32_t sequence, int64_t now_us);
+    int64_t TargetDelayUs() const;
+    size_t TargetDepth() const;
+    int64_t OldestArrivalUs() const;
+};
+
+#endif // JITTER_BUFFER_H
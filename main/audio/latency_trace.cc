@@ -0,0 +1,125 @@
+#include "latency_trace.h"
+
+#if CONFIG_USE_AUDIO_LATENCY_TRACE
+
+#include <esp_log.h>
+#include <algorithm>
+
+#define TAG "LatencyTrace"
+
+static const char* const kStageNames[kLatencyStageCount] = {
+    "i2s_to_processor",
+    "processor_to_encode",
+    "encode_to_send",
+    "uplink_total",
+    "arrival_to_decode",
+    "decode_to_output",
+    "downlink_total",
+};
+
+static size_t BucketOf(uint32_t ms) {
+    if (ms < LATENCY_TRACE_FINE_BUCKETS) {
+        return ms;
+    }
+    size_t bucket = LATENCY_TRACE_FINE_BUCKETS + (ms - LATENCY_TRACE_FINE_BUCKETS) / LATENCY_TRACE_COARSE_BUCKET_MS;
+    return std::min<size_t>(bucket, LATENCY_TRACE_BUCKETS - 1);
+}
+
+// Upper bound of a bucket in ms
+static uint32_t BucketLimit(size_t bucket) {
+    if (bucket < LATENCY_TRACE_FINE_BUCKETS) {
+        return bucket + 1;
+    }
+    return LATENCY_TRACE_FINE_BUCKETS + (bucket - LATENCY_TRACE_FINE_BUCKETS + 1) * LATENCY_TRACE_COARSE_BUCKET_MS;
+}
+
+void LatencyTracer::Record(LatencyStage stage, int64_t start_us, int64_t end_us) {
+    if (start_us == 0 || end_us < start_us) {
+        return;
+    }
+    uint32_t ms = (end_us - start_us) / 1000;
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& histogram = histograms_[stage];
+    histogram.buckets[BucketOf(ms)]++;
+    histogram.count++;
+    histogram.max_ms = std::max(histogram.max_ms, ms);
+}
+
+void LatencyTracer::OnCapture(size_t samples) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    captured_samples_ += samples;
+    auto& capture = captures_[capture_index_];
+    capture.end_sample = captured_samples_;
+    capture.time_us = esp_timer_get_time();
+    capture_index_ = (capture_index_ + 1) % LATENCY_TRACE_CAPTURE_HISTORY;
+}
+
+int64_t LatencyTracer::OnProcessed(size_t samples) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    processed_samples_ += samples;
+    // The newest sample of the output was captured by the oldest read that reaches it
+    int64_t time_us = 0;
+    uint64_t best_end = UINT64_MAX;
+    for (auto& capture : captures_) {
+        if (capture.time_us != 0 && capture.end_sample >= processed_samples_ && capture.end_sample < best_end) {
+            best_end = capture.end_sample;
+            time_us = capture.time_us;
+        }
+    }
+    return time_us;
+}
+
+void LatencyTracer::ResetCapture() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& capture : captures_) {
+        capture = Capture();
+    }
+    capture_index_ = 0;
+    captured_samples_ = 0;
+    processed_samples_ = 0;
+}
+
+uint32_t LatencyTracer::Percentile(const Histogram& histogram, uint32_t percent) {
+    if (histogram.count == 0) {
+        return 0;
+    }
+    uint32_t rank = (histogram.count * percent + 99) / 100;
+    uint32_t seen = 0;
+    for (size_t i = 0; i < LATENCY_TRACE_BUCKETS; i++) {
+        seen += histogram.buckets[i];
+        if (seen >= rank) {
+            return std::min(BucketLimit(i), histogram.max_ms);
+        }
+    }
+    return histogram.max_ms;
+}
+
+cJSON* LatencyTracer::GetStatsJson() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    cJSON* root = cJSON_CreateObject();
+    for (int i = 0; i < kLatencyStageCount; i++) {
+        auto& histogram = histograms_[i];
+        cJSON* stage = cJSON_CreateObject();
+        cJSON_AddNumberToObject(stage, "count", histogram.count);
+        cJSON_AddNumberToObject(stage, "p50_ms", Percentile(histogram, 50));
+        cJSON_AddNumberToObject(stage, "p90_ms", Percentile(histogram, 90));
+        cJSON_AddNumberToObject(stage, "p99_ms", Percentile(histogram, 99));
+        cJSON_AddNumberToObject(stage, "max_ms", histogram.max_ms);
+        cJSON_AddItemToObject(root, kStageNames[i], stage);
+    }
+    return root;
+}
+
+void LatencyTracer::PrintStats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (int i = 0; i < kLatencyStageCount; i++) {
+        auto& histogram = histograms_[i];
+        if (histogram.count == 0) {
+            continue;
+        }
+        ESP_LOGI(TAG, "%s: n=%lu p50=%lu p90=%lu p99=%lu max=%lu ms", kStageNames[i], histogram.count,
+            Percentile(histogram, 50), Percentile(histogram, 90), Percentile(histogram, 99), histogram.max_ms);
+    }
+}
+
+#endif // CONFIG_USE_AUDIO_LATENCY_TRACE
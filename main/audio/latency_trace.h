@@ -0,0 +1,124 @@
+#ifndef LATENCY_TRACE_H
+#define LATENCY_TRACE_H
+
+#include <sdkconfig.h>
+#include <cstdint>
+#include <cstddef>
+
+/*
+ * Per-frame latency of the audio pipeline, enabled with CONFIG_USE_AUDIO_LATENCY_TRACE.
+ *
+ * Frames carry a LatencyStamp from the first stage to the last one. Each stage records the
+ * time since the previous stage into a histogram, the end points also record the total.
+ * When the option is off the stamps are not part of the packets and every macro below
+ * expands to nothing.
+ */
+enum LatencyStage {
+    kLatencyStageProcess,       // I2S read in ReadAudioData -> audio processor output
+    kLatencyStageEncode,        // Audio processor output -> Opus encode done
+    kLatencyStageSend,          // Encode done -> SendAudio returned
+    kLatencyStageUplink,        // I2S read -> SendAudio returned
+    kLatencyStageDecode,        // Packet arrival in the protocol -> decode done, includes the jitter buffer
+    kLatencyStagePlayback,      // Decode done -> OutputData returned
+    kLatencyStageDownlink,      // Packet arrival -> OutputData returned
+    kLatencyStageCount,
+};
+
+#if CONFIG_USE_AUDIO_LATENCY_TRACE
+
+#include <esp_timer.h>
+#include <cJSON.h>
+#include <mutex>
+
+// 1 ms buckets up to 64 ms, then 16 ms buckets up to 1024 ms, the last one collects everything above
+#define LATENCY_TRACE_FINE_BUCKETS 64
+#define LATENCY_TRACE_COARSE_BUCKET_MS 16
+#define LATENCY_TRACE_BUCKETS (LATENCY_TRACE_FINE_BUCKETS + 60 + 1)
+// Recent I2S reads remembered to find the capture time of processor output
+#define LATENCY_TRACE_CAPTURE_HISTORY 16
+
+struct LatencyStamp {
+    int64_t origin_us = 0;      // First stage of the frame, 0 if the frame is not traced
+    int64_t stage_us = 0;       // Last stage the frame went through
+};
+
+class LatencyTracer {
+public:
+    static LatencyTracer& GetInstance() {
+        static LatencyTracer instance;
+        return instance;
+    }
+
+    void Record(LatencyStage stage, int64_t start_us, int64_t end_us);
+    // The audio processor changes the frame size, so captured and processed audio are matched by sample count
+    void OnCapture(size_t samples);
+    int64_t OnProcessed(size_t samples);
+    void ResetCapture();
+
+    // Percentiles of every stage, the caller owns the returned object
+    cJSON* GetStatsJson();
+    void PrintStats();
+
+private:
+    struct Histogram {
+        uint32_t buckets[LATENCY_TRACE_BUCKETS] = {};
+        uint32_t count = 0;
+        uint32_t max_ms = 0;
+    };
+    struct Capture {
+        uint64_t end_sample = 0;
+        int64_t time_us = 0;
+    };
+
+    std::mutex mutex_;
+    Histogram histograms_[kLatencyStageCount];
+    Capture captures_[LATENCY_TRACE_CAPTURE_HISTORY];
+    size_t capture_index_ = 0;
+    uint64_t captured_samples_ = 0;
+    uint64_t processed_samples_ = 0;
+
+    LatencyTracer() = default;
+    static uint32_t Percentile(const Histogram& histogram, uint32_t percent);
+};
+
+#define LATENCY_TRACE_BEGIN(stamp) \
+    do { (stamp).origin_us = (stamp).stage_us = esp_timer_get_time(); } while (0)
+#define LATENCY_TRACE_COPY(dst, src) \
+    do { (dst) = (src); } while (0)
+#define LATENCY_TRACE_STAGE(stamp, stage) \
+    do { \
+        if ((stamp).stage_us != 0) { \
+            int64_t now_ = esp_timer_get_time(); \
+            LatencyTracer::GetInstance().Record(stage, (stamp).stage_us, now_); \
+            (stamp).stage_us = now_; \
+        } \
+    } while (0)
+#define LATENCY_TRACE_END(stamp, stage, total_stage) \
+    do { \
+        int64_t now_ = esp_timer_get_time(); \
+        LatencyTracer::GetInstance().Record(stage, (stamp).stage_us, now_); \
+        LatencyTracer::GetInstance().Record(total_stage, (stamp).origin_us, now_); \
+    } while (0)
+#define LATENCY_TRACE_CAPTURE(samples) \
+    do { LatencyTracer::GetInstance().OnCapture(samples); } while (0)
+#define LATENCY_TRACE_PROCESSED(stamp, samples) \
+    do { \
+        (stamp).origin_us = (stamp).stage_us = LatencyTracer::GetInstance().OnProcessed(samples); \
+        LATENCY_TRACE_STAGE(stamp, kLatencyStageProcess); \
+    } while (0)
+#define LATENCY_TRACE_RESET_CAPTURE() \
+    do { LatencyTracer::GetInstance().ResetCapture(); } while (0)
+
+#else
+
+#define LATENCY_TRACE_BEGIN(stamp) do {} while (0)
+#define LATENCY_TRACE_COPY(dst, src) do {} while (0)
+#define LATENCY_TRACE_STAGE(stamp, stage) do {} while (0)
+#define LATENCY_TRACE_END(stamp, stage, total_stage) do {} while (0)
+#define LATENCY_TRACE_CAPTURE(samples) do {} while (0)
+#define LATENCY_TRACE_PROCESSED(stamp, samples) do {} while (0)
+#define LATENCY_TRACE_RESET_CAPTURE() do {} while (0)
+
+#endif // CONFIG_USE_AUDIO_LATENCY_TRACE
+
+#endif // LATENCY_TRACE_H
@@ -0,0 +1,104 @@
+#ifndef OBJECT_POOL_H
+#define OBJECT_POOL_H
+
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <functional>
+#include <cstddef>
+
+/*
+ * A pool of reusable objects handed out as unique_ptr.
+ *
+ * When the unique_ptr is destroyed the object goes back to the free list instead of the heap,
+ * so buffers owned by the object (e.g. a reserved std::vector) keep their capacity across uses.
+ * The pool grows on demand until max_free objects are cached, objects released beyond that
+ * are deleted. The pool must outlive every object it hands out.
+ */
+template <typename T>
+class ObjectPool {
+public:
+    class Deleter {
+    public:
+        Deleter() = default;
+        explicit Deleter(ObjectPool* pool) : pool_(pool) {}
+        void operator()(T* object) const { pool_->Release(object); }
+
+    private:
+        ObjectPool* pool_ = nullptr;
+    };
+    using Ptr = std::unique_ptr<T, Deleter>;
+
+    // prepare is called on a new object and on every object coming back to the pool
+    ObjectPool(size_t max_free, std::function<void(T&)> prepare)
+        : max_free_(max_free), prepare_(std::move(prepare)) {
+        free_.reserve(max_free_);
+    }
+
+    ~ObjectPool() {
+        for (auto object : free_) {
+            delete object;
+        }
+    }
+
+    ObjectPool(const ObjectPool&) = delete;
+    ObjectPool& operator=(const ObjectPool&) = delete;
+
+    // Preallocate objects so that the first frames don't hit the heap either
+    void Reserve(size_t count) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        while (free_.size() < count && free_.size() < max_free_) {
+            free_.push_back(Create());
+        }
+    }
+
+    Ptr Acquire() {
+        T* object = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!free_.empty()) {
+                object = free_.back();
+                free_.pop_back();
+            }
+        }
+        if (object == nullptr) {
+            object = Create();
+        }
+        return Ptr(object, Deleter(this));
+    }
+
+    size_t free_count() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return free_.size();
+    }
+
+private:
+    std::mutex mutex_;
+    std::vector<T*> free_;
+    size_t max_free_;
+    std::function<void(T&)> prepare_;
+
+    T* Create() {
+        auto object = new T();
+        if (prepare_) {
+            prepare_(*object);
+        }
+        return object;
+    }
+
+    void Release(T* object) {
+        if (prepare_) {
+            prepare_(*object);
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (free_.size() < max_free_) {
+                free_.push_back(object);
+                return;
+            }
+        }
+        delete object;
+    }
+};
+
+#endif // OBJECT_POOL_H
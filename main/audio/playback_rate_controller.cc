@@ -0,0 +1,118 @@
+#include "playback_rate_controller.h"
+
+#include <esp_log.h>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+#define TAG "PlaybackRate"
+
+// Largest rate change per frame, so the speed never jumps audibly
+#define RATE_STEP_PERMILLE 10
+
+void PlaybackRateController::Update(int buffered_ms) {
+    if (buffered_ms > PLAYBACK_RATE_TARGET_MS) {
+        int excess_ms = std::min(buffered_ms - PLAYBACK_RATE_TARGET_MS, PLAYBACK_RATE_FULL_SPEED_MS);
+        target_permille_ = 1000 + (PLAYBACK_RATE_MAX_PERCENT * 10 - 1000) * excess_ms / PLAYBACK_RATE_FULL_SPEED_MS;
+    } else if (buffered_ms < PLAYBACK_RATE_TARGET_MS - PLAYBACK_RATE_HYSTERESIS_MS) {
+        target_permille_ = 1000;
+    }
+
+    int previous = rate_permille_;
+    rate_permille_ += std::clamp(target_permille_ - rate_permille_, -RATE_STEP_PERMILLE, RATE_STEP_PERMILLE);
+    if ((previous == 1000) != (rate_permille_ == 1000)) {
+        ESP_LOGI(TAG, "Playback rate %s, %d ms buffered", rate_permille_ > 1000 ? "speeding up" : "back to normal", buffered_ms);
+    }
+}
+
+void PlaybackRateController::Process(std::vector<int16_t>& pcm, int sample_rate) {
+    if (sample_rate != sample_rate_) {
+        sample_rate_ = sample_rate;
+        debt_ = 0;
+    }
+    if (rate_permille_ > 1000) {
+        // Output length is input / rate
+        debt_ += static_cast<int64_t>(pcm.size()) * (rate_permille_ - 1000) / rate_permille_;
+    }
+
+    size_t min_period = sample_rate * PLAYBACK_RATE_MIN_PERIOD_MS / 1000;
+    size_t max_period = sample_rate * PLAYBACK_RATE_MAX_PERIOD_MS / 1000;
+    size_t overlap = sample_rate * PLAYBACK_RATE_CROSSFADE_MS / 1000;
+    if (debt_ < static_cast<int64_t>(min_period)) {
+        return;
+    }
+
+    // Compact in place, the write position never passes the read position
+    int16_t* data = pcm.data();
+    size_t size = pcm.size();
+    size_t read = 0;
+    size_t write = 0;
+    size_t splice = overlap;
+    bool stretched = false;
+    while (debt_ >= static_cast<int64_t>(min_period) && splice + max_period + overlap <= size) {
+        size_t period = FindPeriod(data, size, splice, min_period, max_period, overlap);
+        if (period == 0) {
+            break;
+        }
+
+        memmove(data + write, data + read, (splice - read) * sizeof(int16_t));
+        write += splice - read;
+        // Fade out the segment at the splice while fading in the one a period later
+        for (size_t i = 0; i < overlap; i++) {
+            int32_t out = data[splice + i] * static_cast<int32_t>(overlap - i) + data[splice + period + i] * static_cast<int32_t>(i);
+            data[write + i] = static_cast<int16_t>(out / static_cast<int32_t>(overlap));
+        }
+        write += overlap;
+        read = splice + period + overlap;
+        splice = read + overlap;
+
+        debt_ -= period;
+        removed_samples_ += period;
+        stretched = true;
+    }
+    if (!stretched) {
+        return;
+    }
+    memmove(data + write, data + read, (size - read) * sizeof(int16_t));
+    write += size - read;
+    pcm.resize(write);
+    stats_.stretched_frames++;
+}
+
+size_t PlaybackRateController::FindPeriod(const int16_t* pcm, size_t size, size_t start, size_t min_period, size_t max_period, size_t overlap) const {
+    // Do not remove much more than is due
+    max_period = std::min<size_t>(max_period, std::max<int64_t>(debt_, min_period));
+    const int16_t* ref = pcm + start;
+
+    size_t best_period = 0;
+    float best_score = 0.0f;
+    for (size_t period = min_period; period <= max_period && start + period + overlap <= size; period++) {
+        const int16_t* candidate = pcm + start + period;
+        int64_t corr = 0;
+        int64_t energy = 0;
+        for (size_t i = 0; i < overlap; i++) {
+            corr += ref[i] * candidate[i];
+            energy += candidate[i] * candidate[i];
+        }
+        // Normalized cross correlation, the reference energy is the same for every lag
+        float score = energy > 0 ? static_cast<float>(corr) / sqrtf(static_cast<float>(energy)) : 0.0f;
+        if (best_period == 0 || score > best_score) {
+            best_period = period;
+            best_score = score;
+        }
+    }
+    return best_period;
+}
+
+void PlaybackRateController::Reset() {
+    rate_permille_ = 1000;
+    target_permille_ = 1000;
+    debt_ = 0;
+}
+
+PlaybackRateStats PlaybackRateController::stats() const {
+    PlaybackRateStats stats = stats_;
+    stats.rate_percent = rate_permille_ / 10;
+    stats.removed_ms = sample_rate_ > 0 ? removed_samples_ * 1000ull / sample_rate_ : 0;
+    return stats;
+}
@@ -0,0 +1,59 @@
+#ifndef PLAYBACK_RATE_CONTROLLER_H
+#define PLAYBACK_RATE_CONTROLLER_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// Buffered TTS above this starts speeding up playback, below TARGET - HYSTERESIS it relaxes to 1x
+#define PLAYBACK_RATE_TARGET_MS 600
+#define PLAYBACK_RATE_HYSTERESIS_MS 200
+// Playback rate in percent, reached when the backlog is PLAYBACK_RATE_FULL_SPEED_MS over the target
+#define PLAYBACK_RATE_MAX_PERCENT 125
+#define PLAYBACK_RATE_FULL_SPEED_MS 1200
+// Pitch period search range and splice crossfade length
+#define PLAYBACK_RATE_MIN_PERIOD_MS 3
+#define PLAYBACK_RATE_MAX_PERIOD_MS 12
+#define PLAYBACK_RATE_CROSSFADE_MS 5
+
+struct PlaybackRateStats {
+    uint32_t rate_percent = 100;
+    uint32_t stretched_frames = 0;    // Frames that got shorter
+    uint32_t removed_ms = 0;          // Audio skipped by time compression
+};
+
+/*
+ * Catches up with a TTS backlog by playing slightly faster, without changing the pitch.
+ *
+ * Update() picks the rate from the buffered duration. Process() then shortens each decoded
+ * frame WSOLA style: it searches the lag with the highest waveform similarity within the
+ * pitch period range, crossfades the two segments and skips the samples in between, so
+ * whole pitch periods are removed. The removed amount is carried between frames, a frame
+ * is only touched when at least one period is due.
+ *
+ * Only the opus decode task uses it.
+ */
+class PlaybackRateController {
+public:
+    void Update(int buffered_ms);
+    // Shortens pcm in place, the sample rate may change between calls
+    void Process(std::vector<int16_t>& pcm, int sample_rate);
+    void Reset();
+
+    bool active() const { return rate_permille_ > 1000 || debt_ > 0; }
+    PlaybackRateStats stats() const;
+
+private:
+    int rate_permille_ = 1000;
+    int target_permille_ = 1000;
+    // Samples still to be removed, at the rate of the last frame
+    int64_t debt_ = 0;
+    int sample_rate_ = 0;
+    uint32_t removed_samples_ = 0;
+    PlaybackRateStats stats_;
+
+    // Best lag in [min_period, max_period] for a splice at start, 0 if none fits
+    size_t FindPeriod(const int16_t* pcm, size_t size, size_t start, size_t min_period, size_t max_period, size_t overlap) const;
+};
+
+#endif // PLAYBACK_RATE_CONTROLLER_H
@@ -1,5 +1,7 @@
 #include "afe_audio_processor.h"
 #include <esp_log.h>
+#include <algorithm>
+#include <cstring>
 
 #define PROCESSOR_RUNNING 0x01
 
@@ -14,9 +16,6 @@ void AfeAudioProcessor::Initialize(AudioCodec* codec, int frame_duration_ms, srm
     codec_ = codec;
     frame_samples_ = frame_duration_ms * 16000 / 1000;
 
-    // Pre-allocate output buffer capacity
-    output_buffer_.reserve(frame_samples_);
-
     int ref_num = codec_->input_reference() ? 1 : 0;
 
     std::string input_format;
@@ -74,6 +73,10 @@ void AfeAudioProcessor::Initialize(AudioCodec* codec, int frame_duration_ms, srm
     }, "audio_communication", 4096, this, 3, NULL);
 }
 
+void AfeAudioProcessor::SetFrameDuration(int frame_duration_ms) {
+    frame_samples_ = frame_duration_ms * 16000 / 1000;
+}
+
 AfeAudioProcessor::~AfeAudioProcessor() {
     if (afe_data_ != nullptr) {
         afe_iface_->destroy(afe_data_);
@@ -110,7 +113,7 @@ bool AfeAudioProcessor::IsRunning() {
     return xEventGroupGetBits(event_group_) & PROCESSOR_RUNNING;
 }
 
-void AfeAudioProcessor::OnOutput(std::function<void(std::vector<int16_t>&& data)> callback) {
+void AfeAudioProcessor::OnOutput(std::function<void(const int16_t* data, size_t samples)> callback) {
     output_callback_ = callback;
 }
 
@@ -150,25 +153,39 @@ void AfeAudioProcessor::AudioProcessorTask() {
         }
 
         if (output_callback_) {
-            size_t samples = res->data_size / sizeof(int16_t);
-            
-            // Add data to buffer
-            output_buffer_.insert(output_buffer_.end(), res->data, res->data + samples);
-            
-            // Output complete frames when buffer has enough data
-            while (output_buffer_.size() >= frame_samples_) {
-                if (output_buffer_.size() == frame_samples_) {
-                    // If buffer size equals frame size, move the entire buffer
-                    output_callback_(std::move(output_buffer_));
-                    output_buffer_.clear();
-                    output_buffer_.reserve(frame_samples_);
-                } else {
-                    // If buffer size exceeds frame size, copy one frame and remove it
-                    output_callback_(std::vector<int16_t>(output_buffer_.begin(), output_buffer_.begin() + frame_samples_));
-                    output_buffer_.erase(output_buffer_.begin(), output_buffer_.begin() + frame_samples_);
-                }
-            }
+            OutputFrames(res->data, res->data_size / sizeof(int16_t));
+        }
+    }
+}
+
+void AfeAudioProcessor::OutputFrames(const int16_t* data, size_t samples) {
+    while (true) {
+        size_t frame_samples = std::min<size_t>(frame_samples_, AFE_OUTPUT_MAX_FRAME_SAMPLES);
+        if (frame_samples == 0) {
+            return;
+        }
+        if (output_fill_ >= frame_samples) {
+            // A complete frame was collected, or the frame got shorter while filling
+            output_callback_(output_buffer_, frame_samples);
+            output_fill_ -= frame_samples;
+            memmove(output_buffer_, output_buffer_ + frame_samples, output_fill_ * sizeof(int16_t));
+            continue;
+        }
+        if (samples == 0) {
+            break;
+        }
+        if (output_fill_ == 0 && samples >= frame_samples) {
+            // Hand the frame straight from the AFE result, it stays valid until the next fetch
+            output_callback_(data, frame_samples);
+            data += frame_samples;
+            samples -= frame_samples;
+            continue;
         }
+        size_t count = std::min(samples, frame_samples - output_fill_);
+        memcpy(output_buffer_ + output_fill_, data, count * sizeof(int16_t));
+        output_fill_ += count;
+        data += count;
+        samples -= count;
     }
 }
 
@@ -9,21 +9,26 @@
 #include <string>
 #include <vector>
 #include <functional>
+#include <atomic>
 
 #include "audio_processor.h"
 #include "audio_codec.h"
 
+// Longest uplink frame, 60 ms at 16 kHz
+#define AFE_OUTPUT_MAX_FRAME_SAMPLES (60 * 16000 / 1000)
+
 class AfeAudioProcessor : public AudioProcessor {
 public:
     AfeAudioProcessor();
     ~AfeAudioProcessor();
 
     void Initialize(AudioCodec* codec, int frame_duration_ms, srmodel_list_t* models_list) override;
+    void SetFrameDuration(int frame_duration_ms) override;
     void Feed(std::vector<int16_t>&& data) override;
     void Start() override;
     void Stop() override;
     bool IsRunning() override;
-    void OnOutput(std::function<void(std::vector<int16_t>&& data)> callback) override;
+    void OnOutput(std::function<void(const int16_t* data, size_t samples)> callback) override;
     void OnVadStateChange(std::function<void(bool speaking)> callback) override;
     size_t GetFeedSize() override;
     void EnableDeviceAec(bool enable) override;
@@ -32,14 +37,17 @@ private:
     EventGroupHandle_t event_group_ = nullptr;
     const esp_afe_sr_iface_t* afe_iface_ = nullptr;
     esp_afe_sr_data_t* afe_data_ = nullptr;
-    std::function<void(std::vector<int16_t>&& data)> output_callback_;
+    std::function<void(const int16_t* data, size_t samples)> output_callback_;
     std::function<void(bool speaking)> vad_state_change_callback_;
     AudioCodec* codec_ = nullptr;
-    int frame_samples_ = 0;
+    std::atomic<int> frame_samples_{0};
     bool is_speaking_ = false;
-    std::vector<int16_t> output_buffer_;
+    // Samples of a frame spread over several AFE fetches, only touched by the processor task
+    int16_t output_buffer_[AFE_OUTPUT_MAX_FRAME_SAMPLES];
+    size_t output_fill_ = 0;
 
     void AudioProcessorTask();
+    void OutputFrames(const int16_t* data, size_t samples);
 };
 
 #endif 
\ No newline at end of file
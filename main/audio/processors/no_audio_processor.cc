@@ -1,4 +1,5 @@
 #include "no_audio_processor.h"
+#include "sample_kernels.h"
 #include <esp_log.h>
 
 #define TAG "NoAudioProcessor"
@@ -8,20 +9,22 @@ void NoAudioProcessor::Initialize(AudioCodec* codec, int frame_duration_ms, srmo
     frame_samples_ = frame_duration_ms * 16000 / 1000;
 }
 
+void NoAudioProcessor::SetFrameDuration(int frame_duration_ms) {
+    frame_samples_ = frame_duration_ms * 16000 / 1000;
+}
+
 void NoAudioProcessor::Feed(std::vector<int16_t>&& data) {
     if (!is_running_ || !output_callback_) {
         return;
     }
 
     if (codec_->input_channels() == 2) {
-        // If input channels is 2, we need to fetch the left channel data
-        auto mono_data = std::vector<int16_t>(data.size() / 2);
-        for (size_t i = 0, j = 0; i < mono_data.size(); ++i, j += 2) {
-            mono_data[i] = data[j];
-        }
-        output_callback_(std::move(mono_data));
+        // If input channels is 2, we need to fetch the left channel data, in place
+        size_t samples = data.size() / 2;
+        ExtractChannelS16(data.data(), data.data(), samples, 2, 0);
+        output_callback_(data.data(), samples);
     } else {
-        output_callback_(std::move(data));
+        output_callback_(data.data(), data.size());
     }
 }
 
@@ -37,7 +40,7 @@ bool NoAudioProcessor::IsRunning() {
     return is_running_;
 }
 
-void NoAudioProcessor::OnOutput(std::function<void(std::vector<int16_t>&& data)> callback) {
+void NoAudioProcessor::OnOutput(std::function<void(const int16_t* data, size_t samples)> callback) {
     output_callback_ = callback;
 }
 
@@ -0,0 +1,227 @@
+#include "prompt_sound_cache.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
+#include <opus_decoder.h>
+#include <opus_resampler.h>
+#include <cstring>
+
+#define TAG "PromptSoundCache"
+
+// Longest Opus frame, used to bound the decoded size before decoding
+#define PROMPT_SOUND_MAX_FRAME_MS 120
+
+PromptSoundCache::~PromptSoundCache() {
+    for (auto& sound : sounds_) {
+        heap_caps_free(sound->pcm);
+    }
+}
+
+const PromptSound* PromptSoundCache::Get(const std::string_view& ogg, int output_sample_rate) {
+    // First pass, bound the decoded size so the PCM goes straight into one PSRAM buffer
+    int sample_rate = 0;
+    size_t max_samples = MaxSamples(ogg, output_sample_rate, sample_rate);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        bool found = false;
+        auto cached = FindLocked(ogg, output_sample_rate, found);
+        if (found || max_samples == 0) {
+            return cached;
+        }
+        if (total_bytes_ + reserved_bytes_ + max_samples * sizeof(int16_t) > PROMPT_SOUND_CACHE_MAX_BYTES) {
+            ESP_LOGW(TAG, "Prompt sound does not fit the cache (%u bytes used)", (unsigned)total_bytes_);
+            return nullptr;
+        }
+        reserved_bytes_ += max_samples * sizeof(int16_t);
+    }
+
+    auto start_time = esp_timer_get_time();
+    auto sound = Decode(ogg, output_sample_rate, sample_rate, max_samples);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    reserved_bytes_ -= max_samples * sizeof(int16_t);
+    if (!sound) {
+        return nullptr;
+    }
+    total_bytes_ += sound->samples * sizeof(int16_t);
+    ESP_LOGI(TAG, "Cached prompt sound: %u samples at %d Hz in %ld ms, %u bytes in total",
+        (unsigned)sound->samples, sound->sample_rate, (long)((esp_timer_get_time() - start_time) / 1000),
+        (unsigned)total_bytes_);
+    sounds_.push_back(std::move(sound));
+    return sounds_.back().get();
+}
+
+const PromptSound* PromptSoundCache::Find(const std::string_view& ogg, int output_sample_rate) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    bool found = false;
+    return FindLocked(ogg, output_sample_rate, found);
+}
+
+bool PromptSoundCache::Fits(const std::string_view& ogg, int output_sample_rate) {
+    int sample_rate = 0;
+    size_t max_samples = MaxSamples(ogg, output_sample_rate, sample_rate);
+    std::lock_guard<std::mutex> lock(mutex_);
+    return max_samples > 0 && total_bytes_ + reserved_bytes_ + max_samples * sizeof(int16_t) <= PROMPT_SOUND_CACHE_MAX_BYTES;
+}
+
+const PromptSound* PromptSoundCache::FindLocked(const std::string_view& ogg, int output_sample_rate, bool& found) {
+    for (auto& sound : sounds_) {
+        if (sound->key == ogg.data() && sound->key_size == ogg.size()) {
+            // The codec output rate does not change at runtime, a mismatch falls back to decoding
+            found = true;
+            return sound->sample_rate == output_sample_rate ? sound.get() : nullptr;
+        }
+    }
+    found = false;
+    return nullptr;
+}
+
+size_t PromptSoundCache::MaxSamples(const std::string_view& ogg, int output_sample_rate, int& sample_rate) {
+    size_t packets = 0;
+    if (!ParseOgg(ogg, [&](int rate, const uint8_t*, size_t) {
+        sample_rate = rate;
+        packets++;
+    })) {
+        return 0;
+    }
+    return packets * output_sample_rate / 1000 * PROMPT_SOUND_MAX_FRAME_MS;
+}
+
+std::unique_ptr<PromptSound> PromptSoundCache::Decode(const std::string_view& ogg, int output_sample_rate,
+    int sample_rate, size_t max_samples) {
+    auto pcm = (int16_t*)heap_caps_malloc(max_samples * sizeof(int16_t), MALLOC_CAP_SPIRAM);
+    if (pcm == nullptr) {
+        return nullptr;
+    }
+
+    OpusDecoderWrapper decoder(sample_rate, 1, PROMPT_SOUND_MAX_FRAME_MS);
+    OpusResampler resampler;
+    bool resample = sample_rate != output_sample_rate;
+    if (resample) {
+        resampler.Configure(sample_rate, output_sample_rate);
+    }
+
+    size_t samples = 0;
+    std::vector<int16_t> decoded;
+    std::vector<uint8_t> payload;
+    ParseOgg(ogg, [&](int, const uint8_t* packet, size_t size) {
+        payload.assign(packet, packet + size);
+        if (!decoder.Decode(std::move(payload), decoded)) {
+            return;
+        }
+        size_t count = resample ? resampler.GetOutputSamples(decoded.size()) : decoded.size();
+        if (samples + count > max_samples) {
+            return;
+        }
+        if (resample) {
+            resampler.Process(decoded.data(), decoded.size(), pcm + samples);
+        } else {
+            memcpy(pcm + samples, decoded.data(), count * sizeof(int16_t));
+        }
+        samples += count;
+    });
+    if (samples == 0) {
+        heap_caps_free(pcm);
+        return nullptr;
+    }
+
+    // Give back the unused tail of the worst-case allocation
+    auto shrunk = (int16_t*)heap_caps_realloc(pcm, samples * sizeof(int16_t), MALLOC_CAP_SPIRAM);
+    if (shrunk != nullptr) {
+        pcm = shrunk;
+    }
+
+    auto sound = std::make_unique<PromptSound>();
+    sound->key = ogg.data();
+    sound->key_size = ogg.size();
+    sound->sample_rate = output_sample_rate;
+    sound->pcm = pcm;
+    sound->samples = samples;
+    return sound;
+}
+
+bool PromptSoundCache::ParseOgg(const std::string_view& ogg,
+    const std::function<void(int sample_rate, const uint8_t* packet, size_t size)>& on_packet) {
+    const uint8_t* buf = reinterpret_cast<const uint8_t*>(ogg.data());
+    size_t size = ogg.size();
+    size_t offset = 0;
+
+    auto find_page = [&](size_t start)->size_t {
+        for (size_t i = start; i + 4 <= size; ++i) {
+            if (buf[i] == 'O' && buf[i+1] == 'g' && buf[i+2] == 'g' && buf[i+3] == 'S') return i;
+        }
+        return static_cast<size_t>(-1);
+    };
+
+    bool seen_head = false;
+    bool seen_tags = false;
+    bool seen_audio = false;
+    int sample_rate = 16000; // 默认值
+
+    while (true) {
+        size_t pos = find_page(offset);
+        if (pos == static_cast<size_t>(-1)) break;
+        offset = pos;
+        if (offset + 27 > size) break;
+
+        const uint8_t* page = buf + offset;
+        uint8_t page_segments = page[26];
+        size_t seg_table_off = offset + 27;
+        if (seg_table_off + page_segments > size) break;
+
+        size_t body_size = 0;
+        for (size_t i = 0; i < page_segments; ++i) body_size += page[27 + i];
+
+        size_t body_off = seg_table_off + page_segments;
+        if (body_off + body_size > size) break;
+
+        // Parse packets using lacing
+        size_t cur = body_off;
+        size_t seg_idx = 0;
+        while (seg_idx < page_segments) {
+            size_t pkt_len = 0;
+            size_t pkt_start = cur;
+            bool continued = false;
+            do {
+                uint8_t l = page[27 + seg_idx++];
+                pkt_len += l;
+                cur += l;
+                continued = (l == 255);
+            } while (continued && seg_idx < page_segments);
+
+            if (pkt_len == 0) continue;
+            const uint8_t* pkt_ptr = buf + pkt_start;
+
+            if (!seen_head) {
+                // 解析OpusHead包
+                if (pkt_len >= 19 && std::memcmp(pkt_ptr, "OpusHead", 8) == 0) {
+                    seen_head = true;
+
+                    // OpusHead结构：[0-7] "OpusHead", [8] version, [9] channel_count, [10-11] pre_skip
+                    // [12-15] input_sample_rate, [16-17] output_gain, [18] mapping_family
+                    // 读取输入采样率 (little-endian)
+                    sample_rate = pkt_ptr[12] | (pkt_ptr[13] << 8) |
+                                (pkt_ptr[14] << 16) | (pkt_ptr[15] << 24);
+                    ESP_LOGD(TAG, "OpusHead: version=%d, channels=%d, sample_rate=%d",
+                           pkt_ptr[8], pkt_ptr[9], sample_rate);
+                }
+                continue;
+            }
+            if (!seen_tags) {
+                // Expect OpusTags in second packet
+                if (pkt_len >= 8 && std::memcmp(pkt_ptr, "OpusTags", 8) == 0) {
+                    seen_tags = true;
+                }
+                continue;
+            }
+
+            // Audio packet (Opus)
+            seen_audio = true;
+            on_packet(sample_rate, pkt_ptr, pkt_len);
+        }
+
+        offset = body_off + body_size;
+    }
+    return seen_audio;
+}
@@ -0,0 +1,65 @@
+#ifndef PROMPT_SOUND_CACHE_H
+#define PROMPT_SOUND_CACHE_H
+
+#include <string_view>
+#include <functional>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+#include <cstddef>
+
+// PSRAM budget for decoded prompt sounds, sounds that do not fit are decoded on every play
+#define PROMPT_SOUND_CACHE_MAX_BYTES (256 * 1024)
+
+struct PromptSound {
+    const char* key = nullptr;  // ogg.data() of the embedded sound
+    size_t key_size = 0;
+    int sample_rate = 0;        // Sample rate of pcm, the codec output rate at decode time
+    int16_t* pcm = nullptr;     // Mono PCM in PSRAM
+    size_t samples = 0;
+};
+
+/*
+ * Decoded PCM of the prompt sounds played with AudioService::PlaySound().
+ *
+ * The sounds are embedded OGG files, so the data pointer identifies them. Each sound is
+ * decoded once, resampled to the codec output rate and kept in PSRAM. Entries are never
+ * evicted, so a returned PromptSound stays valid for the lifetime of the cache.
+ * Decoding a sound takes a while and an Opus decoder's worth of stack, so Get() is only
+ * called from the opus decode task. It decodes outside the lock, so Find() and Fits() from
+ * other tasks do not wait for it.
+ */
+class PromptSoundCache {
+public:
+    PromptSoundCache() = default;
+    ~PromptSoundCache();
+
+    PromptSoundCache(const PromptSoundCache&) = delete;
+    PromptSoundCache& operator=(const PromptSoundCache&) = delete;
+
+    // Decodes the sound on first use, returns nullptr if it cannot be cached
+    const PromptSound* Get(const std::string_view& ogg, int output_sample_rate);
+    // Lookup only, returns nullptr if the sound has not been decoded yet
+    const PromptSound* Find(const std::string_view& ogg, int output_sample_rate);
+    // Whether Get() would find room for the sound, only parses the OGG pages
+    bool Fits(const std::string_view& ogg, int output_sample_rate);
+
+    // Calls on_packet for every Opus audio packet of an Ogg Opus file, returns false if there is none
+    static bool ParseOgg(const std::string_view& ogg,
+        const std::function<void(int sample_rate, const uint8_t* packet, size_t size)>& on_packet);
+
+private:
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<PromptSound>> sounds_;
+    size_t total_bytes_ = 0;
+    // Worst-case bytes of the sounds being decoded, kept free until they are inserted
+    size_t reserved_bytes_ = 0;
+
+    std::unique_ptr<PromptSound> Decode(const std::string_view& ogg, int output_sample_rate,
+        int sample_rate, size_t max_samples);
+    const PromptSound* FindLocked(const std::string_view& ogg, int output_sample_rate, bool& found);
+    static size_t MaxSamples(const std::string_view& ogg, int output_sample_rate, int& sample_rate);
+};
+
+#endif // PROMPT_SOUND_CACHE_H
@@ -0,0 +1,108 @@
+#include "sample_kernels.h"
+
+#include <cstring>
+
+void MixSaturateS16(int16_t* dst, const int16_t* src, size_t samples, int32_t gain_q15) {
+    if (gain_q15 == SAMPLE_KERNELS_UNITY_GAIN_Q15) {
+        for (size_t i = 0; i < samples; i++) {
+            dst[i] = SaturateS16(dst[i] + src[i]);
+        }
+        return;
+    }
+    for (size_t i = 0; i < samples; i++) {
+        dst[i] = SaturateS16(dst[i] + ((src[i] * gain_q15) >> 15));
+    }
+}
+
+void ApplyGainRampS16(int16_t* dst, size_t samples, int32_t from_q15, int32_t to_q15) {
+    if (from_q15 == to_q15) {
+        if (from_q15 == SAMPLE_KERNELS_UNITY_GAIN_Q15) {
+            return;
+        }
+        for (size_t i = 0; i < samples; i++) {
+            dst[i] = SaturateS16((dst[i] * from_q15) >> 15);
+        }
+        return;
+    }
+    if (samples == 0) {
+        return;
+    }
+    // Gain in Q15 with 16 extra fraction bits, so short blocks still ramp smoothly
+    // Multiplied rather than shifted, a falling ramp has a negative step
+    int64_t gain = static_cast<int64_t>(from_q15) * 65536;
+    int64_t step = (static_cast<int64_t>(to_q15) - from_q15) * 65536 / static_cast<int64_t>(samples);
+    for (size_t i = 0; i < samples; i++) {
+        gain += step;
+        dst[i] = SaturateS16(static_cast<int32_t>((dst[i] * (gain >> 16)) >> 15));
+    }
+}
+
+void AmplifyS16(int16_t* pcm, size_t samples, int32_t factor) {
+    if (factor == 1) {
+        return;
+    }
+    // Gains above 65536 would overflow the product, nothing but full scale is left at that point anyway.
+    // A negative gain is not an input gain, and -32768 * -65536 would overflow too
+    factor = std::clamp<int32_t>(factor, 0, 65536);
+    for (size_t i = 0; i < samples; i++) {
+        pcm[i] = SaturateS16(pcm[i] * factor);
+    }
+}
+
+void ScaleS16ToS32(const int16_t* src, int32_t* dst, size_t samples, int32_t gain_q16) {
+    if (gain_q16 >= 0 && gain_q16 <= 65536) {
+        // |src * gain| <= 2^31, only -32768 * 65536 reaches the limit and that is INT32_MIN itself
+        for (size_t i = 0; i < samples; i++) {
+            dst[i] = src[i] * gain_q16;
+        }
+        return;
+    }
+    for (size_t i = 0; i < samples; i++) {
+        int64_t value = static_cast<int64_t>(src[i]) * gain_q16;
+        dst[i] = static_cast<int32_t>(std::clamp<int64_t>(value, INT32_MIN, INT32_MAX));
+    }
+}
+
+void NarrowS32ToS16(const int32_t* src, int16_t* dst, size_t samples, int shift) {
+    for (size_t i = 0; i < samples; i++) {
+        dst[i] = SaturateS16(src[i] >> shift);
+    }
+}
+
+void ExtractChannelS16(const int16_t* src, int16_t* dst, size_t frames, int channels, int channel) {
+    if (channels == 1) {
+        if (dst != src) {
+            memcpy(dst, src, frames * sizeof(int16_t));
+        }
+        return;
+    }
+    if (channels == 2) {
+        // One 32-bit load per frame, the wanted half is picked by shifting
+        int shift = channel * 16;
+        for (size_t i = 0; i < frames; i++) {
+            uint32_t pair;
+            memcpy(&pair, src + 2 * i, sizeof(pair));
+            dst[i] = static_cast<int16_t>(pair >> shift);
+        }
+        return;
+    }
+    for (size_t i = 0; i < frames; i++) {
+        dst[i] = src[i * channels + channel];
+    }
+}
+
+void DeinterleaveS16(const int16_t* src, int16_t* first, int16_t* second, size_t frames) {
+    for (size_t i = 0; i < frames; i++) {
+        uint32_t pair;
+        memcpy(&pair, src + 2 * i, sizeof(pair));
+        second[i] = static_cast<int16_t>(pair >> 16);
+        first[i] = static_cast<int16_t>(pair);
+    }
+}
+
+void InterleaveS16(const int16_t* first, const int16_t* second, int16_t* dst, size_t frames) {
+    for (size_t i = 0; i < frames; i++) {
+        uint32_t pair = static_cast<uint16_t>(first[i]) | (static_cast<uint32_t>(static_cast<uint16_t>(second[i])) << 16);
+        memcpy(dst + 2 * i, &pair, sizeof(pair));
+    }
+}
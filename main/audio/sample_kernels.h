@@ -0,0 +1,39 @@
+#ifndef SAMPLE_KERNELS_H
+#define SAMPLE_KERNELS_H
+
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+
+/*
+ * Sample format kernels shared by the codec drivers, the audio service and the mixer.
+ *
+ * Every per-sample loop over PCM in the audio path goes through here, so a target-specific
+ * variant only has to be added in one place. The loops are kept branch free: saturation
+ * is written as a clamp, which the Xtensa compiler turns into CLAMPS, and channel
+ * shuffles read and write whole 32-bit words where the layout allows it (little endian).
+ */
+
+#define SAMPLE_KERNELS_UNITY_GAIN_Q15 32768
+
+inline int16_t SaturateS16(int32_t value) {
+    return static_cast<int16_t>(std::clamp<int32_t>(value, INT16_MIN, INT16_MAX));
+}
+
+// dst[i] = saturate(dst[i] + src[i] * gain_q15 / 32768)
+void MixSaturateS16(int16_t* dst, const int16_t* src, size_t samples, int32_t gain_q15);
+// dst[i] = saturate(dst[i] * gain), the gain moves linearly from from_q15 to to_q15 over the block
+void ApplyGainRampS16(int16_t* dst, size_t samples, int32_t from_q15, int32_t to_q15);
+// pcm[i] = saturate(pcm[i] * factor), for whole number input gains, factor is clamped to [0, 65536]
+void AmplifyS16(int16_t* pcm, size_t samples, int32_t factor);
+// dst[i] = saturate(src[i] * gain_q16), widening to 32-bit I2S slots, gain 65536 is unity
+void ScaleS16ToS32(const int16_t* src, int32_t* dst, size_t samples, int32_t gain_q16);
+// dst[i] = saturate(src[i] >> shift), narrowing 32-bit I2S slots
+void NarrowS32ToS16(const int32_t* src, int16_t* dst, size_t samples, int shift);
+// dst[i] = src[i * channels + channel], dst may be src
+void ExtractChannelS16(const int16_t* src, int16_t* dst, size_t frames, int channels, int channel);
+// Split stereo, first may be src
+void DeinterleaveS16(const int16_t* src, int16_t* first, int16_t* second, size_t frames);
+void InterleaveS16(const int16_t* first, const int16_t* second, int16_t* dst, size_t frames);
+
+#endif // SAMPLE_KERNELS_H
@@ -0,0 +1,107 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <atomic>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+/*
+ * Fixed-capacity single-producer / single-consumer ring buffer.
+ *
+ * Push() must only be called from one task at a time and Pop() from one task at a time,
+ * neither of them takes a lock. Size() and Clear() may be called from any task.
+ *
+ * Clear() does not touch the slots itself, it only moves a flush mark to the current tail.
+ * The consumer destroys the flushed items on its next Pop() or ReleaseFlushed(), so the
+ * producer may observe the old occupancy until the consumer has run once. Notify the
+ * consumer after Clear().
+ */
+template <typename T>
+class SpscQueue {
+public:
+    explicit SpscQueue(size_t capacity) {
+        size_t size = 1;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        capacity_ = size;
+        mask_ = size - 1;
+        slots_ = std::make_unique<T[]>(size);
+    }
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    // Producer only, returns false if the ring is full
+    bool Push(T&& item) {
+        uint32_t tail = tail_.load(std::memory_order_relaxed);
+        uint32_t head = head_.load(std::memory_order_acquire);
+        if (tail - head >= capacity_) {
+            return false;
+        }
+        slots_[tail & mask_] = std::move(item);
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer only, returns false if the ring is empty
+    bool Pop(T& item) {
+        uint32_t head = ReleaseFlushed();
+        uint32_t tail = tail_.load(std::memory_order_acquire);
+        if (head == tail) {
+            return false;
+        }
+        item = std::move(slots_[head & mask_]);
+        slots_[head & mask_] = T();
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer only, destroys the items discarded by Clear() so the producer can reuse their slots
+    uint32_t ReleaseFlushed() {
+        uint32_t head = head_.load(std::memory_order_relaxed);
+        uint32_t flush = flush_.load(std::memory_order_acquire);
+        if (static_cast<int32_t>(flush - head) <= 0) {
+            return head;
+        }
+        while (head != flush) {
+            slots_[head & mask_] = T();
+            head++;
+        }
+        head_.store(head, std::memory_order_release);
+        return head;
+    }
+
+    // Discard everything pushed so far
+    void Clear() {
+        uint32_t tail = tail_.load(std::memory_order_acquire);
+        uint32_t flush = flush_.load(std::memory_order_relaxed);
+        while (static_cast<int32_t>(tail - flush) > 0 &&
+            !flush_.compare_exchange_weak(flush, tail, std::memory_order_release, std::memory_order_relaxed)) {
+        }
+    }
+
+    // Occupied slots, including flushed items the consumer has not released yet
+    size_t Size() const {
+        uint32_t head = head_.load(std::memory_order_acquire);
+        uint32_t tail = tail_.load(std::memory_order_acquire);
+        return tail - head;
+    }
+
+    bool Empty() const {
+        return Size() == 0;
+    }
+
+    size_t capacity() const { return capacity_; }
+
+private:
+    std::unique_ptr<T[]> slots_;
+    size_t capacity_ = 0;
+    uint32_t mask_ = 0;
+    std::atomic<uint32_t> head_{0};
+    std::atomic<uint32_t> tail_{0};
+    std::atomic<uint32_t> flush_{0};
+};
+
+#endif // SPSC_QUEUE_H
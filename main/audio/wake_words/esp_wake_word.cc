@@ -79,6 +79,9 @@ size_t EspWakeWord::GetFeedSize() {
     return wakenet_iface_->get_samp_chunksize(wakenet_data_);
 }
 
+void EspWakeWord::SetEncodeFrameDuration(int frame_duration_ms) {
+}
+
 void EspWakeWord::EncodeWakeWordData() {
 }
 
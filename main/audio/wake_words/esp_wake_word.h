@@ -24,6 +24,7 @@ public:
     void Start();
     void Stop();
     size_t GetFeedSize();
+    void SetEncodeFrameDuration(int frame_duration_ms);
     void EncodeWakeWordData();
     bool GetWakeWordOpus(std::vector<uint8_t>& opus);
     const std::string& GetLastDetectedWakeWord() const { return last_detected_wake_word_; }
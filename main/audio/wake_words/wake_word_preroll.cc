@@ -0,0 +1,181 @@
+#include "wake_word_preroll.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <cassert>
+#include <algorithm>
+
+#define TAG "WakeWordPreroll"
+
+#define PREROLL_ENCODE_TASK_STACK_SIZE (4096 * 7)
+#define PREROLL_MAX_PACKETS (WAKE_WORD_PREROLL_MS / 20)
+#define PREROLL_PACKET_RESERVE 256
+
+WakeWordPreroll::WakeWordPreroll() {
+    pcm_ring_ = (int16_t*)heap_caps_malloc(WAKE_WORD_PREROLL_PCM_SAMPLES * sizeof(int16_t), MALLOC_CAP_SPIRAM);
+    assert(pcm_ring_ != nullptr);
+    packets_.resize(PREROLL_MAX_PACKETS);
+    for (auto& packet : packets_) {
+        packet.reserve(PREROLL_PACKET_RESERVE);
+    }
+    frame_.reserve(16000 / 1000 * 60);
+}
+
+WakeWordPreroll::~WakeWordPreroll() {
+    if (encode_task_ != nullptr) {
+        vTaskDelete(encode_task_);
+    }
+    if (encode_task_stack_ != nullptr) {
+        heap_caps_free(encode_task_stack_);
+    }
+    if (encode_task_buffer_ != nullptr) {
+        heap_caps_free(encode_task_buffer_);
+    }
+    if (pcm_ring_ != nullptr) {
+        heap_caps_free(pcm_ring_);
+    }
+}
+
+void WakeWordPreroll::SetFrameDuration(int frame_duration_ms) {
+    frame_duration_ = frame_duration_ms;
+}
+
+void WakeWordPreroll::Reset() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        generation_++;
+        pcm_read_ = 0;
+        pcm_count_ = 0;
+        packet_head_ = 0;
+        packet_count_ = 0;
+        sealing_ = false;
+        sealed_ = false;
+        frame_samples_ = 16000 / 1000 * frame_duration_.load();
+        max_packets_ = std::min<size_t>(WAKE_WORD_PREROLL_MS / frame_duration_.load(), packets_.size());
+    }
+
+    if (encode_task_ == nullptr) {
+        encode_task_stack_ = (StackType_t*)heap_caps_malloc(PREROLL_ENCODE_TASK_STACK_SIZE, MALLOC_CAP_SPIRAM);
+        assert(encode_task_stack_ != nullptr);
+        encode_task_buffer_ = (StaticTask_t*)heap_caps_malloc(sizeof(StaticTask_t), MALLOC_CAP_INTERNAL);
+        assert(encode_task_buffer_ != nullptr);
+
+        encode_task_ = xTaskCreateStatic([](void* arg) {
+            auto this_ = (WakeWordPreroll*)arg;
+            this_->EncodeTask();
+            vTaskDelete(NULL);
+        }, "encode_wake_word", PREROLL_ENCODE_TASK_STACK_SIZE, this, 2, encode_task_stack_, encode_task_buffer_);
+    }
+}
+
+void WakeWordPreroll::Store(const int16_t* data, size_t samples) {
+    bool frame_ready;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (sealing_) {
+            return;
+        }
+        for (size_t i = 0; i < samples; i++) {
+            size_t write = (pcm_read_ + pcm_count_) % WAKE_WORD_PREROLL_PCM_SAMPLES;
+            pcm_ring_[write] = data[i];
+            if (pcm_count_ < WAKE_WORD_PREROLL_PCM_SAMPLES) {
+                pcm_count_++;
+            } else {
+                // The encoder fell behind, drop the oldest samples
+                pcm_read_ = (pcm_read_ + 1) % WAKE_WORD_PREROLL_PCM_SAMPLES;
+            }
+        }
+        frame_ready = pcm_count_ >= static_cast<size_t>(frame_samples_);
+    }
+    if (frame_ready && encode_task_ != nullptr) {
+        xTaskNotifyGive(encode_task_);
+    }
+}
+
+void WakeWordPreroll::Seal() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        sealing_ = true;
+    }
+    if (encode_task_ != nullptr) {
+        xTaskNotifyGive(encode_task_);
+    }
+}
+
+bool WakeWordPreroll::GetOpus(std::vector<uint8_t>& opus) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this]() {
+        return packet_count_ > 0 || sealed_;
+    });
+    if (packet_count_ == 0) {
+        opus.clear();
+        return false;
+    }
+    // Swap so the slot keeps a reserved buffer for the next packet
+    opus.swap(packets_[packet_head_]);
+    packets_[packet_head_].clear();
+    packet_head_ = (packet_head_ + 1) % packets_.size();
+    packet_count_--;
+    return true;
+}
+
+void WakeWordPreroll::EncodeTask() {
+    std::vector<uint8_t> packet;
+    packet.reserve(PREROLL_PACKET_RESERVE);
+    uint32_t encoder_generation = 0;
+
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        while (true) {
+            uint32_t generation;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                generation = generation_;
+                if (pcm_count_ < static_cast<size_t>(frame_samples_)) {
+                    if (sealing_ && !sealed_) {
+                        // The partial frame left at detection is dropped
+                        sealed_ = true;
+                        ESP_LOGI(TAG, "Wake word pre-roll sealed with %u packets", (unsigned)packet_count_);
+                        cv_.notify_all();
+                    }
+                    break;
+                }
+                frame_.resize(frame_samples_);
+                for (int i = 0; i < frame_samples_; i++) {
+                    frame_[i] = pcm_ring_[pcm_read_];
+                    pcm_read_ = (pcm_read_ + 1) % WAKE_WORD_PREROLL_PCM_SAMPLES;
+                }
+                pcm_count_ -= frame_samples_;
+            }
+
+            if (encoder_ == nullptr || encoder_->frame_size() != frame_.size()) {
+                encoder_ = std::make_unique<OpusEncoderWrapper>(16000, 1, frame_.size() * 1000 / 16000);
+                encoder_->SetComplexity(0); // 0 is the fastest
+            } else if (encoder_generation != generation) {
+                encoder_->ResetState();
+            }
+            encoder_generation = generation;
+
+            packet.clear();
+            if (!encoder_->Encode(std::move(frame_), packet)) {
+                continue;
+            }
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (generation != generation_) {
+                // Reset() while encoding, the packet belongs to the old pre-roll
+                continue;
+            }
+            if (packet_count_ == max_packets_) {
+                // Keep only the last WAKE_WORD_PREROLL_MS
+                packet_head_ = (packet_head_ + 1) % packets_.size();
+                packet_count_--;
+            }
+            size_t tail = (packet_head_ + packet_count_) % packets_.size();
+            packets_[tail].swap(packet);
+            packet_count_++;
+            cv_.notify_all();
+        }
+    }
+}
@@ -0,0 +1,73 @@
+#ifndef WAKE_WORD_PREROLL_H
+#define WAKE_WORD_PREROLL_H
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#include <opus_encoder.h>
+
+// Audio kept before the wake word is detected
+#define WAKE_WORD_PREROLL_MS 2000
+// PCM that may wait for the background encoder
+#define WAKE_WORD_PREROLL_PCM_SAMPLES (16000 / 2)
+
+/*
+ * Keeps the audio before a wake word as ready-to-send Opus packets.
+ *
+ * Store() copies the detector input into one preallocated PCM ring, a background task
+ * encodes every complete frame as soon as it is available and keeps the last
+ * WAKE_WORD_PREROLL_MS of packets in a fixed packet ring. At detection only the last
+ * partial frame is left, so Seal() finishes almost immediately and GetOpus() can hand
+ * out the first packet right away.
+ */
+class WakeWordPreroll {
+public:
+    WakeWordPreroll();
+    ~WakeWordPreroll();
+
+    // Takes effect on the next Reset()
+    void SetFrameDuration(int frame_duration_ms);
+    // Drop the collected audio and start a new pre-roll
+    void Reset();
+    void Store(const int16_t* data, size_t samples);
+    // Stop collecting, GetOpus() returns false once the packets before this call are consumed
+    void Seal();
+    bool GetOpus(std::vector<uint8_t>& opus);
+
+private:
+    TaskHandle_t encode_task_ = nullptr;
+    StaticTask_t* encode_task_buffer_ = nullptr;
+    StackType_t* encode_task_stack_ = nullptr;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    uint32_t generation_ = 0;
+    bool sealing_ = false;
+    bool sealed_ = false;
+    std::atomic<int> frame_duration_{60};
+    int frame_samples_ = 960;
+
+    // PCM waiting for the encoder
+    int16_t* pcm_ring_ = nullptr;
+    size_t pcm_read_ = 0;
+    size_t pcm_count_ = 0;
+
+    // Encoded packets, oldest first
+    std::vector<std::vector<uint8_t>> packets_;
+    size_t packet_head_ = 0;
+    size_t packet_count_ = 0;
+    size_t max_packets_ = 0;
+
+    std::unique_ptr<OpusEncoderWrapper> encoder_;
+    std::vector<int16_t> frame_;
+
+    void EncodeTask();
+};
+
+#endif // WAKE_WORD_PREROLL_H
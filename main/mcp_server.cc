@@ -17,6 +17,8 @@
 #include "settings.h"
 #include "lvgl_theme.h"
 #include "lvgl_display.h"
+#include "latency_trace.h"
+#include "audio_recorder.h"
 
 #define TAG "MCP"
 
@@ -135,6 +137,55 @@ void McpServer::AddUserOnlyTools() {
             return board.GetSystemInfoJson();
         });
 
+#if CONFIG_USE_AUDIO_LATENCY_TRACE
+    AddUserOnlyTool("self.get_audio_latency",
+        "Get the latency percentiles of every audio pipeline stage, from the microphone to the socket and from the socket to the speaker",
+        PropertyList(),
+        [](const PropertyList& properties) -> ReturnValue {
+            return LatencyTracer::GetInstance().GetStatsJson();
+        });
+#endif
+
+#if CONFIG_USE_AUDIO_DEBUGGER
+    AddUserOnlyTool("self.audio_recorder.start",
+        "Start recording pipeline audio into the device buffer. `taps` lists the stages to record: mic, processed, decoded, speaker",
+        PropertyList({
+            Property("taps", kPropertyTypeString, std::string("mic,processed,decoded,speaker")),
+            Property("opus", kPropertyTypeBoolean, true)
+        }),
+        [](const PropertyList& properties) -> ReturnValue {
+            auto taps = AudioRecorder::ParseTaps(properties["taps"].value<std::string>());
+            return AudioRecorder::GetInstance().Start(taps, properties["opus"].value<bool>());
+        });
+
+    AddUserOnlyTool("self.audio_recorder.stop",
+        "Stop recording pipeline audio, the recorded audio stays in the buffer",
+        PropertyList(),
+        [](const PropertyList& properties) -> ReturnValue {
+            AudioRecorder::GetInstance().Stop();
+            return true;
+        });
+
+    AddUserOnlyTool("self.audio_recorder.dump",
+        "Send the recorded audio to the audio debug server and empty the buffer",
+        PropertyList(),
+        [](const PropertyList& properties) -> ReturnValue {
+            // Sending takes a while, keep it off the main task
+            xTaskCreate([](void* arg) {
+                AudioRecorder::GetInstance().Dump();
+                vTaskDelete(NULL);
+            }, "audio_dump", 4096, nullptr, 2, nullptr);
+            return true;
+        });
+
+    AddUserOnlyTool("self.audio_recorder.get_status",
+        "Get the recorded taps, format and buffer usage of the audio recorder",
+        PropertyList(),
+        [](const PropertyList& properties) -> ReturnValue {
+            return AudioRecorder::GetInstance().GetStatusJson();
+        });
+#endif
+
     AddUserOnlyTool("self.reboot", "Reboot the system",
         PropertyList(),
         [this](const PropertyList& properties) -> ReturnValue {
@@ -1,6 +1,7 @@
 #include "ota.h"
 #include "system_info.h"
 #include "settings.h"
+#include "network_context.h"
 #include "assets/lang_config.h"
 
 #include <cJSON.h>
@@ -91,6 +92,7 @@ esp_err_t Ota::CheckVersion() {
         ESP_LOGE(TAG, "Check version URL is not properly set");
         return ESP_ERR_INVALID_ARG;
     }
+    NetworkContext::GetInstance().AddHost(url);
 
     auto http = SetupHttp();
 
@@ -224,6 +226,7 @@ esp_err_t Ota::CheckVersion() {
         cJSON *url = cJSON_GetObjectItem(firmware, "url");
         if (cJSON_IsString(url)) {
             firmware_url_ = url->valuestring;
+            NetworkContext::GetInstance().AddHost(firmware_url_);
         }
 
         if (cJSON_IsString(version) && cJSON_IsString(url)) {
@@ -270,6 +273,7 @@ void Ota::MarkCurrentVersionValid() {
 
 bool Ota::Upgrade(const std::string& firmware_url) {
     ESP_LOGI(TAG, "Upgrading firmware from %s", firmware_url.c_str());
+    NetworkContext::GetInstance().AddHost(firmware_url);
     esp_ota_handle_t update_handle = 0;
     auto update_partition = esp_ota_get_next_update_partition(NULL);
     if (update_partition == NULL) {
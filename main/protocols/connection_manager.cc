@@ -0,0 +1,214 @@
+#include "connection_manager.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <algorithm>
+
+#define TAG "Connection"
+
+static const char* const kOpenKindNames[kConnectionOpenKindCount] = {
+    "opened on demand",
+    "warmed up",
+    "reused",
+};
+
+void ConnectionManager::Initialize(Protocol* protocol, std::function<void(std::function<void()>)> schedule) {
+    protocol_ = protocol;
+    schedule_ = std::move(schedule);
+}
+
+void ConnectionManager::OnTurnTriggered(const char* trigger) {
+    if (protocol_ == nullptr) {
+        return;
+    }
+
+    int64_t now = esp_timer_get_time();
+    std::lock_guard<std::mutex> lock(mutex_);
+    idle_since_us_ = 0;
+    // Reused unless the channel has to be opened for this turn
+    open_kind_ = kConnectionOpenReused;
+    ready_us_ = now;
+    warm_up_failed_ = false;
+    trigger_us_ = now;
+    ESP_LOGI(TAG, "Turn triggered by %s", trigger);
+
+#if CONFIG_AUDIO_CHANNEL_WARM_UP
+    if (warming_up_) {
+        return;
+    }
+    {
+        // A channel kept open from the last turn needs no warm-up, the turn goes straight on
+        std::unique_lock<std::mutex> channel_lock(channel_mutex_, std::try_to_lock);
+        if (channel_lock.owns_lock() && protocol_->IsAudioChannelOpened()) {
+            return;
+        }
+    }
+    warming_up_ = true;
+    warm_up_finished_ = false;
+    if (xTaskCreate(WarmUpTask, "warm_up", CONNECTION_WARM_UP_TASK_STACK_SIZE, this,
+            CONNECTION_WARM_UP_TASK_PRIORITY, nullptr) != pdPASS) {
+        ESP_LOGW(TAG, "Failed to create the warm-up task, the channel opens on demand");
+        warming_up_ = false;
+    }
+#endif
+}
+
+void ConnectionManager::WarmUpTask(void* arg) {
+    auto manager = (ConnectionManager*)arg;
+    {
+        std::lock_guard<std::mutex> lock(manager->channel_mutex_);
+        if (!manager->protocol_->IsAudioChannelOpened()) {
+            bool opened = manager->Open(kConnectionOpenWarmedUp);
+            std::lock_guard<std::mutex> state_lock(manager->mutex_);
+            // The main task reports the failure, it must not start over
+            manager->warm_up_failed_ = !opened;
+        }
+    }
+    manager->warm_up_finished_ = true;
+    // The result goes back to the main task, which runs the work that waited for it
+    manager->schedule_([manager]() {
+        manager->CollectWarmUp();
+    });
+    vTaskDelete(NULL);
+}
+
+void ConnectionManager::CollectWarmUp() {
+    std::vector<std::function<void()>> callbacks;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!warming_up_ || !warm_up_finished_) {
+            return;
+        }
+        warming_up_ = false;
+        warm_up_finished_ = false;
+        callbacks.swap(settled_callbacks_);
+    }
+    for (auto& callback : callbacks) {
+        callback();
+    }
+}
+
+void ConnectionManager::WhenSettled(std::function<void()> callback) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (warming_up_) {
+            settled_callbacks_.push_back(std::move(callback));
+            return;
+        }
+    }
+    callback();
+}
+
+bool ConnectionManager::Open(ConnectionOpenKind kind) {
+    int64_t start_us = esp_timer_get_time();
+    bool opened = protocol_->OpenAudioChannel();
+    int64_t now = esp_timer_get_time();
+    ESP_LOGI(TAG, "Audio channel %s in %ld ms", opened ? kOpenKindNames[kind] : "failed to open",
+        (long)((now - start_us) / 1000));
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (opened) {
+        open_kind_ = kind;
+        ready_us_ = now;
+    }
+    return opened;
+}
+
+bool ConnectionManager::OpenNow() {
+    std::lock_guard<std::mutex> lock(channel_mutex_);
+    if (protocol_->IsAudioChannelOpened()) {
+        return true;
+    }
+    {
+        std::lock_guard<std::mutex> state_lock(mutex_);
+        if (warm_up_failed_) {
+            warm_up_failed_ = false;
+            trigger_us_ = 0;
+            return false;
+        }
+    }
+    if (!Open(kConnectionOpenCold)) {
+        trigger_us_ = 0;
+        return false;
+    }
+    return true;
+}
+
+void ConnectionManager::OpenAudioChannel(std::function<void(bool opened)> on_opened) {
+    if (protocol_ == nullptr) {
+        on_opened(false);
+        return;
+    }
+    WhenSettled([this, on_opened = std::move(on_opened)]() {
+        on_opened(OpenNow());
+    });
+}
+
+void ConnectionManager::CloseAudioChannel() {
+    if (protocol_ == nullptr) {
+        return;
+    }
+    WhenSettled([this]() {
+        std::lock_guard<std::mutex> lock(channel_mutex_);
+        protocol_->CloseAudioChannel();
+    });
+}
+
+bool ConnectionManager::IsAudioChannelOpened() {
+    if (protocol_ == nullptr || warming_up_) {
+        return false;
+    }
+    std::unique_lock<std::mutex> lock(channel_mutex_, std::try_to_lock);
+    return lock.owns_lock() && protocol_->IsAudioChannelOpened();
+}
+
+void ConnectionManager::OnIdle() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    idle_since_us_ = esp_timer_get_time();
+    trigger_us_ = 0;
+}
+
+void ConnectionManager::CloseIfIdle() {
+#if CONFIG_AUDIO_CHANNEL_IDLE_GRACE_S > 0
+    if (protocol_ == nullptr) {
+        return;
+    }
+
+    // Checked again on the next tick, the main loop never waits for a warm-up
+    if (warming_up_) {
+        return;
+    }
+    // A trigger after this point makes the warm-up wait until the channel is closed, then it opens a new one
+    std::lock_guard<std::mutex> lock(channel_mutex_);
+    {
+        std::lock_guard<std::mutex> state_lock(mutex_);
+        if (idle_since_us_ == 0 || esp_timer_get_time() - idle_since_us_ < CONFIG_AUDIO_CHANNEL_IDLE_GRACE_S * 1000000LL) {
+            return;
+        }
+        idle_since_us_ = 0;
+    }
+    if (protocol_->IsAudioChannelOpened()) {
+        ESP_LOGI(TAG, "Closing the audio channel, idle for %d s", CONFIG_AUDIO_CHANNEL_IDLE_GRACE_S);
+        protocol_->CloseAudioChannel();
+    }
+#endif
+}
+
+void ConnectionManager::OnAudioSent() {
+    int64_t trigger_us = trigger_us_.load();
+    if (trigger_us == 0 || !trigger_us_.compare_exchange_strong(trigger_us, 0)) {
+        return;
+    }
+
+    int64_t now = esp_timer_get_time();
+    std::lock_guard<std::mutex> lock(mutex_);
+    long first_audio_ms = (now - trigger_us) / 1000;
+    long ready_ms = std::max<int64_t>(ready_us_ - trigger_us, 0) / 1000;
+    auto& stats = stats_[open_kind_];
+    stats.turns++;
+    stats.total_ms += first_audio_ms;
+    ESP_LOGI(TAG, "Time to first audio: %ld ms, channel %s and ready after %ld ms, average %ld ms over %lu turns",
+        first_audio_ms, kOpenKindNames[open_kind_], ready_ms, (long)(stats.total_ms / stats.turns), stats.turns);
+}
@@ -0,0 +1,96 @@
+#ifndef CONNECTION_MANAGER_H
+#define CONNECTION_MANAGER_H
+
+#include <sdkconfig.h>
+#include <cstdint>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <vector>
+
+#include "protocol.h"
+
+// The warm-up task runs the DNS lookup and the TLS handshake, same stack as the main task
+#define CONNECTION_WARM_UP_TASK_STACK_SIZE (2048 * 4)
+#define CONNECTION_WARM_UP_TASK_PRIORITY 3
+
+enum ConnectionOpenKind {
+    kConnectionOpenCold,        // Opened by the main task after the trigger reached it
+    kConnectionOpenWarmedUp,    // Opened in the background from the moment of the trigger
+    kConnectionOpenReused,      // Still open from an earlier turn
+    kConnectionOpenKindCount,
+};
+
+/*
+ * Decides when the audio channel opens and closes.
+ *
+ * A wake word or a button press calls OnTurnTriggered() from the task that saw it. With
+ * CONFIG_AUDIO_CHANNEL_WARM_UP and a closed channel, the channel (DNS, TCP, TLS, WebSocket
+ * upgrade and hello) starts opening on a background task right away, while the main task
+ * prepares the input and seals the wake word pre-roll. The main task never blocks on it and
+ * does not touch the channel meanwhile: OpenAudioChannel(), CloseAudioChannel() and
+ * WhenSettled() queue their work, and the warm-up hands its result back through the schedule
+ * callback of the main loop, which runs the queued work. After a turn the
+ * open channel is kept for CONFIG_AUDIO_CHANNEL_IDLE_GRACE_S, so a follow-up turn starts
+ * without any handshake. Every turn logs the time from the trigger to the first uplink audio
+ * with an average per ConnectionOpenKind, turning warm-up off gives the numbers to compare.
+ */
+class ConnectionManager {
+public:
+    // schedule runs a callback on the main task
+    void Initialize(Protocol* protocol, std::function<void(std::function<void()>)> schedule);
+
+    // A turn is about to start, any task
+    void OnTurnTriggered(const char* trigger);
+    // Calls on_opened once the channel is open or failed to open, opening it unless the warm-up
+    // is doing so. Main task only, on_opened runs on the main task
+    void OpenAudioChannel(std::function<void(bool opened)> on_opened);
+    // Main task only, waits for a warm-up in progress without blocking
+    void CloseAudioChannel();
+    // Runs callback on the main task once no warm-up is using the protocol, right away if none is
+    void WhenSettled(std::function<void()> callback);
+    // False while the warm-up is still opening the channel
+    bool IsAudioChannelOpened();
+    bool IsConnecting() const { return warming_up_.load(); }
+    // Finishes a warm-up whose result did not make it into the main loop schedule, main task only
+    void CollectWarmUp();
+
+    // The device went idle, the grace period starts
+    void OnIdle();
+    // Closes the channel once the grace period is over, called periodically while idle
+    void CloseIfIdle();
+    // Uplink audio was sent, the first one after a trigger ends the time to first audio
+    void OnAudioSent();
+
+private:
+    struct OpenStats {
+        uint32_t turns = 0;
+        int64_t total_ms = 0;
+    };
+
+    Protocol* protocol_ = nullptr;
+    std::function<void(std::function<void()>)> schedule_;
+    // Held while the protocol opens or closes the channel
+    std::mutex channel_mutex_;
+    std::mutex mutex_;
+    // Set by OnTurnTriggered(), cleared on the main task once the warm-up result has been collected
+    std::atomic<bool> warming_up_{false};
+    std::atomic<bool> warm_up_finished_{false};
+    // Main task work waiting for the warm-up, guarded by mutex_
+    std::vector<std::function<void()>> settled_callbacks_;
+    // Trigger time of the turn waiting for its first audio, 0 if none
+    std::atomic<int64_t> trigger_us_{0};
+    ConnectionOpenKind open_kind_ = kConnectionOpenReused;
+    int64_t ready_us_ = 0;
+    bool warm_up_failed_ = false;
+    int64_t idle_since_us_ = 0;
+    OpenStats stats_[kConnectionOpenKindCount];
+
+    // channel_mutex_ must be held
+    bool Open(ConnectionOpenKind kind);
+    // Main task only, no warm-up in progress
+    bool OpenNow();
+    static void WarmUpTask(void* arg);
+};
+
+#endif // CONNECTION_MANAGER_H
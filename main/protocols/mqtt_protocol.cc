@@ -2,6 +2,7 @@
 #include "board.h"
 #include "application.h"
 #include "settings.h"
+#include "network_context.h"
 
 #include <esp_log.h>
 #include <cstring>
@@ -70,6 +71,7 @@ bool MqttProtocol::StartMqttClient(bool report_error) {
         }
         return false;
     }
+    NetworkContext::GetInstance().AddHost(endpoint);
 
     auto network = Board::GetInstance().GetNetwork();
     mqtt_ = network->CreateMqtt(0);
@@ -152,36 +154,67 @@ bool MqttProtocol::SendText(const std::string& text) {
     return true;
 }
 
-bool MqttProtocol::SendAudio(std::unique_ptr<AudioStreamPacket> packet) {
+bool MqttProtocol::SendAudio(AudioStreamPacketPtr packet) {
     std::lock_guard<std::mutex> lock(channel_mutex_);
     if (udp_ == nullptr) {
         return false;
     }
+    return SendDatagram(0x01, 0, packet->timestamp, packet->payload.data(), packet->payload.size());
+}
 
-    std::string nonce(aes_nonce_);
-    *(uint16_t*)&nonce[2] = htons(packet->payload.size());
-    *(uint32_t*)&nonce[8] = htonl(packet->timestamp);
-    *(uint32_t*)&nonce[12] = htonl(++local_sequence_);
+bool MqttProtocol::SendAudioBatch(const std::vector<AudioStreamPacketPtr>& packets) {
+    std::lock_guard<std::mutex> lock(channel_mutex_);
+    if (udp_ == nullptr) {
+        return false;
+    }
 
-    std::string encrypted;
-    encrypted.resize(aes_nonce_.size() + packet->payload.size());
-    memcpy(encrypted.data(), nonce.data(), nonce.size());
+    size_t first = 0;
+    while (first < packets.size()) {
+        batch_buffer_.clear();
+        size_t end = SerializeAudioBatch(packets, first, batch_buffer_);
+        if (!SendDatagram(0x02, end - first, packets[first]->timestamp, batch_buffer_.data(), batch_buffer_.size())) {
+            return false;
+        }
+        first = end;
+    }
+    return true;
+}
 
+bool MqttProtocol::SendDatagram(uint8_t type, uint8_t flags, uint32_t timestamp, const uint8_t* payload, size_t size) {
+    // Build the datagram in a reused member buffer to avoid heap traffic per packet
+    size_t nonce_size = aes_nonce_.size();
+    encrypt_buffer_.resize(nonce_size + size);
+    memcpy(encrypt_buffer_.data(), aes_nonce_.data(), nonce_size);
+    encrypt_buffer_[0] = type;
+    encrypt_buffer_[1] = flags;
+    *(uint16_t*)&encrypt_buffer_[2] = htons(size);
+    *(uint32_t*)&encrypt_buffer_[8] = htonl(timestamp);
+    *(uint32_t*)&encrypt_buffer_[12] = htonl(++local_sequence_);
+
+    // AES-CTR advances the counter in place, so it works on a copy of the nonce
+    uint8_t nonce_counter[16];
+    memcpy(nonce_counter, encrypt_buffer_.data(), sizeof(nonce_counter));
     size_t nc_off = 0;
     uint8_t stream_block[16] = {0};
-    if (mbedtls_aes_crypt_ctr(&aes_ctx_, packet->payload.size(), &nc_off, (uint8_t*)nonce.c_str(), stream_block,
-        (uint8_t*)packet->payload.data(), (uint8_t*)&encrypted[nonce.size()]) != 0) {
+    if (mbedtls_aes_crypt_ctr(&aes_ctx_, size, &nc_off, nonce_counter, stream_block,
+        payload, (uint8_t*)&encrypt_buffer_[nonce_size]) != 0) {
         ESP_LOGE(TAG, "Failed to encrypt audio data");
         return false;
     }
 
-    return udp_->Send(encrypted) > 0;
+    uplink_frames_ += type == 0x02 ? flags : 1;
+    uplink_messages_++;
+    return udp_->Send(encrypt_buffer_) > 0;
 }
 
 void MqttProtocol::CloseAudioChannel() {
     {
         std::lock_guard<std::mutex> lock(channel_mutex_);
         udp_.reset();
+        LogUplinkStats();
+        auto stats = remote_window_.stats();
+        ESP_LOGI(TAG, "Downlink: %lu packets, %lu reordered, %lu duplicates, %lu too old, %lu unconfirmed jumps",
+            stats.accepted, stats.reordered, stats.duplicates, stats.too_old, stats.unconfirmed);
     }
 
     // 使用 cJSON 安全构建 JSON，防止注入攻击
@@ -243,23 +276,25 @@ bool MqttProtocol::OpenAudioChannel() {
         }
         uint32_t timestamp = ntohl(*(uint32_t*)&data[8]);
         uint32_t sequence = ntohl(*(uint32_t*)&data[12]);
-        if (sequence < remote_sequence_) {
-            ESP_LOGW(TAG, "Received audio packet with old sequence: %lu, expected: %lu", sequence, remote_sequence_);
+        // Reordered packets in the window go on to the jitter buffer in AudioService, which puts them back in order
+        auto check = remote_window_.Check(sequence);
+        if (check == ReplayWindow::kDuplicate || check == ReplayWindow::kTooOld || check == ReplayWindow::kUnconfirmed) {
+            ESP_LOGD(TAG, "Dropped %s audio packet, sequence: %lu", check == ReplayWindow::kDuplicate ? "duplicate" :
+                check == ReplayWindow::kTooOld ? "old" : "unconfirmed", sequence);
             return;
         }
-        if (sequence != remote_sequence_ + 1) {
-            ESP_LOGW(TAG, "Received audio packet with wrong sequence: %lu, expected: %lu", sequence, remote_sequence_ + 1);
-        }
 
         size_t decrypted_size = data.size() - aes_nonce_.size();
         size_t nc_off = 0;
         uint8_t stream_block[16] = {0};
         auto nonce = (uint8_t*)data.data();
         auto encrypted = (uint8_t*)data.data() + aes_nonce_.size();
-        auto packet = std::make_unique<AudioStreamPacket>();
+        auto packet = AllocateAudioStreamPacket();
         packet->sample_rate = server_sample_rate_;
         packet->frame_duration = server_frame_duration_;
         packet->timestamp = timestamp;
+        packet->sequence = sequence;
+        LATENCY_TRACE_BEGIN(packet->trace);
         packet->payload.resize(decrypted_size);
         int ret = mbedtls_aes_crypt_ctr(&aes_ctx_, decrypted_size, &nc_off, nonce, stream_block, encrypted, (uint8_t*)packet->payload.data());
         if (ret != 0) {
@@ -269,7 +304,6 @@ bool MqttProtocol::OpenAudioChannel() {
         if (on_incoming_audio_ != nullptr) {
             on_incoming_audio_(std::move(packet));
         }
-        remote_sequence_ = sequence;
         last_incoming_time_ = std::chrono::steady_clock::now();
     });
 
@@ -292,6 +326,7 @@ std::string MqttProtocol::GetHelloMessage() {
     cJSON_AddBoolToObject(features, "aec", true);
 #endif
     cJSON_AddBoolToObject(features, "mcp", true);
+    cJSON_AddBoolToObject(features, "audio_batch", true);
     cJSON_AddItemToObject(root, "features", features);
     cJSON* audio_params = cJSON_CreateObject();
     cJSON_AddStringToObject(audio_params, "format", "opus");
@@ -323,7 +358,12 @@ void MqttProtocol::ParseServerHello(const cJSON* root) {
         ESP_LOGI(TAG, "Session ID: %s", session_id_.c_str());
     }
 
+    // 服务器声明支持后才发送批量音频数据包
+    auto features = cJSON_GetObjectItem(root, "features");
+    audio_batch_supported_ = cJSON_IsObject(features) && cJSON_IsTrue(cJSON_GetObjectItem(features, "audio_batch"));
+
     // Get sample rate from hello message with range validation
+    uplink_frame_duration_ = OPUS_FRAME_DURATION_MS;
     auto audio_params = cJSON_GetObjectItem(root, "audio_params");
     if (cJSON_IsObject(audio_params)) {
         auto sample_rate = cJSON_GetObjectItem(audio_params, "sample_rate");
@@ -346,6 +386,16 @@ void MqttProtocol::ParseServerHello(const cJSON* root) {
                 ESP_LOGW(TAG, "帧时长超出有效范围(%d)，使用默认值", duration);
             }
         }
+        // 服务器可选指定上行帧时长: 20 / 40 / 60 ms
+        auto uplink_frame_duration = cJSON_GetObjectItem(audio_params, "uplink_frame_duration");
+        if (cJSON_IsNumber(uplink_frame_duration)) {
+            int duration = uplink_frame_duration->valueint;
+            if (duration == 20 || duration == 40 || duration == 60) {
+                uplink_frame_duration_ = duration;
+            } else {
+                ESP_LOGW(TAG, "不支持的上行帧时长(%d)，使用 %d ms", duration, uplink_frame_duration_);
+            }
+        }
     }
 
     auto udp = cJSON_GetObjectItem(root, "udp");
@@ -397,7 +447,7 @@ void MqttProtocol::ParseServerHello(const cJSON* root) {
         // 使用随机初始序列号防止跨会话的nonce重用
         // 每个会话服务器都会提供新的key/nonce，但增加随机起始点作为额外安全层
         local_sequence_ = esp_random() & 0x00FFFFFF;  // 使用24位随机数，保留高位给递增空间
-        remote_sequence_ = 0;
+        remote_window_.Reset();
     }
     ESP_LOGI(TAG, "AES加密初始化完成，初始序列号=%lu", local_sequence_);
     xEventGroupSetBits(event_group_handle_, MQTT_PROTOCOL_SERVER_HELLO_EVENT);
@@ -3,6 +3,7 @@
 
 
 #include "protocol.h"
+#include "replay_window.h"
 #include <mqtt.h>
 #include <udp.h>
 #include <cJSON.h>
@@ -27,7 +28,8 @@ public:
     ~MqttProtocol();
 
     bool Start() override;
-    bool SendAudio(std::unique_ptr<AudioStreamPacket> packet) override;
+    bool SendAudio(AudioStreamPacketPtr packet) override;
+    bool SendAudioBatch(const std::vector<AudioStreamPacketPtr>& packets) override;
     bool OpenAudioChannel() override;
     void CloseAudioChannel() override;
     bool IsAudioChannelOpened() const override;
@@ -42,13 +44,19 @@ private:
     std::unique_ptr<Udp> udp_;
     mbedtls_aes_context aes_ctx_;
     std::string aes_nonce_;
+    std::string encrypt_buffer_;
+    // Plain batch payload before encryption
+    std::vector<uint8_t> batch_buffer_;
     std::string udp_server_;
     int udp_port_;
     uint32_t local_sequence_;
-    uint32_t remote_sequence_;
+    // Downlink sequence numbers, only used by the UDP receive callback once the channel is open
+    ReplayWindow remote_window_;
     esp_timer_handle_t reconnect_timer_;
 
     bool StartMqttClient(bool report_error=false);
+    // Encrypts and sends one audio datagram, channel_mutex_ must be held
+    bool SendDatagram(uint8_t type, uint8_t flags, uint32_t timestamp, const uint8_t* payload, size_t size);
     void ParseServerHello(const cJSON* root);
     std::string DecodeHexString(const std::string& hex_string);
 
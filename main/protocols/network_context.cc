@@ -0,0 +1,118 @@
+#include "network_context.h"
+#include "board.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <algorithm>
+
+#define TAG "NetworkContext"
+
+std::string NetworkContext::ParseHost(const std::string& url) {
+    size_t start = url.find("://");
+    start = start == std::string::npos ? 0 : start + 3;
+    if (start < url.size() && url[start] == '[') {
+        // IPv6 literal
+        return "";
+    }
+    size_t end = url.find_first_of(":/?#", start);
+    auto host = url.substr(start, end == std::string::npos ? std::string::npos : end - start);
+
+    struct in_addr addr;
+    if (host.empty() || inet_pton(AF_INET, host.c_str(), &addr) == 1) {
+        return "";
+    }
+    return host;
+}
+
+void NetworkContext::AddHost(const std::string& url) {
+    auto host = ParseHost(url);
+    if (host.empty()) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = std::find_if(hosts_.begin(), hosts_.end(), [&host](const HostEntry& entry) {
+        return entry.host == host;
+    });
+    if (it != hosts_.end()) {
+        return;
+    }
+    if (hosts_.size() >= NETWORK_CONTEXT_MAX_HOSTS) {
+        ESP_LOGW(TAG, "Too many hosts, %s is not prefetched", host.c_str());
+        return;
+    }
+    hosts_.push_back({ .host = host });
+}
+
+void NetworkContext::Prefetch() {
+    // ML307 resolves host names in the modem, the lwIP resolver is not used
+    if (Board::GetInstance().GetBoardType() != "wifi") {
+        return;
+    }
+    if (prefetching_.exchange(true)) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        last_prefetch_us_ = esp_timer_get_time();
+    }
+    if (xTaskCreate(PrefetchTask, "dns_prefetch", NETWORK_CONTEXT_TASK_STACK_SIZE, this, 1, nullptr) != pdPASS) {
+        ESP_LOGW(TAG, "Failed to create the prefetch task");
+        prefetching_ = false;
+    }
+}
+
+void NetworkContext::PrefetchIfDue() {
+#if CONFIG_DNS_PREFETCH_INTERVAL_S > 0
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (esp_timer_get_time() - last_prefetch_us_ < CONFIG_DNS_PREFETCH_INTERVAL_S * 1000000LL) {
+            return;
+        }
+    }
+    Prefetch();
+#endif
+}
+
+void NetworkContext::PrefetchTask(void* arg) {
+    auto context = (NetworkContext*)arg;
+    std::vector<std::string> hosts;
+    {
+        std::lock_guard<std::mutex> lock(context->mutex_);
+        for (auto& entry : context->hosts_) {
+            hosts.push_back(entry.host);
+        }
+    }
+
+    for (auto& host : hosts) {
+        struct addrinfo hints = {};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        struct addrinfo* result = nullptr;
+        int err = getaddrinfo(host.c_str(), nullptr, &hints, &result);
+        if (result != nullptr) {
+            freeaddrinfo(result);
+        }
+
+        std::lock_guard<std::mutex> lock(context->mutex_);
+        for (auto& entry : context->hosts_) {
+            if (entry.host != host) {
+                continue;
+            }
+            entry.lookups++;
+            if (err != 0) {
+                entry.failures++;
+                ESP_LOGW(TAG, "Failed to resolve %s: %d (%lu of %lu lookups failed)", host.c_str(), err,
+                    entry.failures, entry.lookups);
+            }
+        }
+    }
+
+    context->prefetching_ = false;
+    vTaskDelete(NULL);
+}
@@ -0,0 +1,62 @@
+#ifndef NETWORK_CONTEXT_H
+#define NETWORK_CONTEXT_H
+
+#include <sdkconfig.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+
+// Host names remembered for prefetching, the lwIP resolver table is not much larger
+#define NETWORK_CONTEXT_MAX_HOSTS 4
+#define NETWORK_CONTEXT_TASK_STACK_SIZE 4096
+
+/*
+ * Re-resolves the host names the device connects to: the OTA, firmware, assets, WebSocket and
+ * MQTT servers.
+ *
+ * This is not a DNS cache. The clients of the network component look their host up on every
+ * connect, and on Wi-Fi boards the lookup goes through the lwIP resolver, which keeps its own
+ * table of recent answers until their TTL runs out. Prefetch() calls getaddrinfo() for the
+ * remembered hosts on a background task, so an expired entry is renewed by that lookup rather
+ * than by the next connect. Whether a lookup was answered from the table or went to the server
+ * is up to lwIP and is not tracked here. ML307 boards resolve inside the modem and are left alone.
+ *
+ * TLS sessions are not resumed. The HTTP, WebSocket and MQTT clients of the esp-ml307 component
+ * own their esp-tls connections and expose no hook for esp_tls_get_client_session(), so every
+ * connect still does a full handshake.
+ */
+class NetworkContext {
+public:
+    static NetworkContext& GetInstance() {
+        static NetworkContext instance;
+        return instance;
+    }
+
+    // Remembers the host of a URL ("wss://host:port/path") or an endpoint ("host:port")
+    void AddHost(const std::string& url);
+    // Looks the remembered hosts up in the background, any task
+    void Prefetch();
+    // Prefetch() if the last one is CONFIG_DNS_PREFETCH_INTERVAL_S ago, called periodically while idle
+    void PrefetchIfDue();
+    // Host name of a URL or endpoint, empty for IP literals that need no lookup
+    static std::string ParseHost(const std::string& url);
+
+private:
+    struct HostEntry {
+        std::string host;
+        uint32_t lookups = 0;
+        uint32_t failures = 0;
+    };
+
+    std::mutex mutex_;
+    std::vector<HostEntry> hosts_;
+    std::atomic<bool> prefetching_{false};
+    int64_t last_prefetch_us_ = 0;
+
+    NetworkContext() = default;
+    static void PrefetchTask(void* arg);
+};
+
+#endif // NETWORK_CONTEXT_H
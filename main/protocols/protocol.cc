@@ -2,14 +2,43 @@
 
 #include <esp_log.h>
 #include <cJSON.h>
+#include <cstring>
+#include <arpa/inet.h>
 
 #define TAG "Protocol"
 
+static ObjectPool<AudioStreamPacket>& GetAudioStreamPacketPool() {
+    static ObjectPool<AudioStreamPacket> pool(AUDIO_PACKET_POOL_SIZE, [](AudioStreamPacket& packet) {
+        packet.sample_rate = 0;
+        packet.frame_duration = 0;
+        packet.timestamp = 0;
+        packet.sequence = 0;
+        if (packet.payload.capacity() > AUDIO_PACKET_PAYLOAD_KEEP_MAX) {
+            // Do not let a rare large packet pin its buffer in the pool
+            std::vector<uint8_t>().swap(packet.payload);
+        }
+        packet.payload.clear();
+#if CONFIG_USE_AUDIO_LATENCY_TRACE
+        packet.trace = LatencyStamp();
+#endif
+        packet.payload.reserve(AUDIO_PACKET_PAYLOAD_RESERVE);
+    });
+    return pool;
+}
+
+AudioStreamPacketPtr AllocateAudioStreamPacket() {
+    return GetAudioStreamPacketPool().Acquire();
+}
+
+void ReserveAudioStreamPackets(size_t count) {
+    GetAudioStreamPacketPool().Reserve(count);
+}
+
 void Protocol::OnIncomingJson(std::function<void(const cJSON* root)> callback) {
     on_incoming_json_ = callback;
 }
 
-void Protocol::OnIncomingAudio(std::function<void(std::unique_ptr<AudioStreamPacket> packet)> callback) {
+void Protocol::OnIncomingAudio(std::function<void(AudioStreamPacketPtr packet)> callback) {
     on_incoming_audio_ = callback;
 }
 
@@ -123,6 +152,34 @@ void Protocol::SendMcpMessage(const std::string& payload) {
     SendText(message);
 }
 
+size_t Protocol::SerializeAudioBatch(const std::vector<AudioStreamPacketPtr>& packets, size_t first, std::vector<uint8_t>& buffer) {
+    size_t start = buffer.size();
+    size_t index = first;
+    for (; index < packets.size() && index - first < AUDIO_BATCH_MAX_FRAMES; index++) {
+        auto& payload = packets[index]->payload;
+        size_t offset = buffer.size();
+        size_t frame_size = sizeof(AudioBatchFrame) + payload.size();
+        if (index > first && offset - start + frame_size > AUDIO_BATCH_MAX_BYTES) {
+            break;
+        }
+        buffer.resize(offset + frame_size);
+        auto frame = (AudioBatchFrame*)&buffer[offset];
+        frame->timestamp = htonl(packets[index]->timestamp);
+        frame->payload_size = htons(payload.size());
+        memcpy(frame->payload, payload.data(), payload.size());
+    }
+    return index;
+}
+
+void Protocol::LogUplinkStats() {
+    if (uplink_frames_ > 0) {
+        ESP_LOGI(TAG, "Uplink: %lu frames in %lu messages%s", uplink_frames_, uplink_messages_,
+            audio_batch_supported_ ? ", batching enabled" : "");
+    }
+    uplink_frames_ = 0;
+    uplink_messages_ = 0;
+}
+
 bool Protocol::IsTimeout() const {
     const int kTimeoutSeconds = 120;
     auto now = std::chrono::steady_clock::now();
@@ -7,13 +7,33 @@
 #include <chrono>
 #include <vector>
 
+#include "object_pool.h"
+#include "latency_trace.h"
+
+// Payload bytes reserved in every pooled packet, larger packets grow the buffer once and keep it
+#define AUDIO_PACKET_PAYLOAD_RESERVE 320
+// A payload buffer grown beyond this goes back to the pool at AUDIO_PACKET_PAYLOAD_RESERVE
+#define AUDIO_PACKET_PAYLOAD_KEEP_MAX 1024
+// Maximum number of idle packets cached by the pool
+#define AUDIO_PACKET_POOL_SIZE 96
+
 struct AudioStreamPacket {
     int sample_rate = 0;
     int frame_duration = 0;
     uint32_t timestamp = 0;
+    uint32_t sequence = 0;  // Downlink order for the jitter buffer, 0 means unsequenced (e.g. local sounds)
     std::vector<uint8_t> payload;
+#if CONFIG_USE_AUDIO_LATENCY_TRACE
+    LatencyStamp trace;
+#endif
 };
 
+using AudioStreamPacketPtr = ObjectPool<AudioStreamPacket>::Ptr;
+
+// Get a packet from the shared pool, it returns to the pool when the pointer is destroyed
+AudioStreamPacketPtr AllocateAudioStreamPacket();
+void ReserveAudioStreamPackets(size_t count);
+
 struct BinaryProtocol2 {
     uint16_t version;
     uint16_t type;          // Message type (0: OPUS, 1: JSON)
@@ -30,6 +50,27 @@ struct BinaryProtocol3 {
     uint8_t payload[];
 } __attribute__((packed));
 
+/*
+ * Version 4 keeps the BinaryProtocol3 header and adds a message carrying several audio
+ * frames: type is BINARY_PROTOCOL_TYPE_AUDIO_BATCH, reserved holds the frame count and the
+ * payload is that many AudioBatchFrame entries back to back. MQTT UDP uses the same payload
+ * in datagrams of type 0x02 when the server hello has the audio_batch feature.
+ */
+#define BINARY_PROTOCOL_TYPE_AUDIO 0
+#define BINARY_PROTOCOL_TYPE_AUDIO_BATCH 2
+
+struct AudioBatchFrame {
+    uint32_t timestamp;
+    uint16_t payload_size;
+    uint8_t payload[];
+} __attribute__((packed));
+
+// Uplink frames are batched while more than this many packets are waiting to be sent
+#define AUDIO_BATCH_QUEUE_THRESHOLD 2
+#define AUDIO_BATCH_MAX_FRAMES 8
+// Batch payload limit, keeps a batch within one UDP datagram
+#define AUDIO_BATCH_MAX_BYTES 1200
+
 enum AbortReason {
     kAbortReasonNone,
     kAbortReasonWakeWordDetected
@@ -51,11 +92,17 @@ public:
     inline int server_frame_duration() const {
         return server_frame_duration_;
     }
+    inline int uplink_frame_duration() const {
+        return uplink_frame_duration_;
+    }
     inline const std::string& session_id() const {
         return session_id_;
     }
+    inline bool audio_batch_supported() const {
+        return audio_batch_supported_;
+    }
 
-    void OnIncomingAudio(std::function<void(std::unique_ptr<AudioStreamPacket> packet)> callback);
+    void OnIncomingAudio(std::function<void(AudioStreamPacketPtr packet)> callback);
     void OnIncomingJson(std::function<void(const cJSON* root)> callback);
     void OnAudioChannelOpened(std::function<void()> callback);
     void OnAudioChannelClosed(std::function<void()> callback);
@@ -67,7 +114,9 @@ public:
     virtual bool OpenAudioChannel() = 0;
     virtual void CloseAudioChannel() = 0;
     virtual bool IsAudioChannelOpened() const = 0;
-    virtual bool SendAudio(std::unique_ptr<AudioStreamPacket> packet) = 0;
+    virtual bool SendAudio(AudioStreamPacketPtr packet) = 0;
+    // Sends the packets in as few messages as possible, only used when audio_batch_supported()
+    virtual bool SendAudioBatch(const std::vector<AudioStreamPacketPtr>& packets) = 0;
     virtual void SendWakeWordDetected(const std::string& wake_word);
     virtual void SendStartListening(ListeningMode mode);
     virtual void SendStopListening();
@@ -76,7 +125,7 @@ public:
 
 protected:
     std::function<void(const cJSON* root)> on_incoming_json_;
-    std::function<void(std::unique_ptr<AudioStreamPacket> packet)> on_incoming_audio_;
+    std::function<void(AudioStreamPacketPtr packet)> on_incoming_audio_;
     std::function<void()> on_audio_channel_opened_;
     std::function<void()> on_audio_channel_closed_;
     std::function<void(const std::string& message)> on_network_error_;
@@ -85,13 +134,22 @@ protected:
 
     int server_sample_rate_ = 24000;
     int server_frame_duration_ = 60;
+    int uplink_frame_duration_ = 60;
     bool error_occurred_ = false;
+    bool audio_batch_supported_ = false;
+    // Uplink frames and the messages they went out in, since the audio channel was opened
+    uint32_t uplink_frames_ = 0;
+    uint32_t uplink_messages_ = 0;
     std::string session_id_;
     std::chrono::time_point<std::chrono::steady_clock> last_incoming_time_;
 
     virtual bool SendText(const std::string& text) = 0;
     virtual void SetError(const std::string& message);
     virtual bool IsTimeout() const;
+    // Appends AudioBatchFrame entries from packets[first] on to buffer, as many as fit into
+    // AUDIO_BATCH_MAX_BYTES but at least one. Returns the index after the last one written
+    static size_t SerializeAudioBatch(const std::vector<AudioStreamPacketPtr>& packets, size_t first, std::vector<uint8_t>& buffer);
+    void LogUplinkStats();
 };
 
 #endif // PROTOCOL_H
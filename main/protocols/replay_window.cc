@@ -0,0 +1,60 @@
+#include "replay_window.h"
+
+ReplayWindow::Result ReplayWindow::Check(uint32_t sequence) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    int32_t ahead = static_cast<int32_t>(sequence - newest_);
+    if (started_ && ahead >= REPLAY_WINDOW_SIZE) {
+        int32_t jump_ahead = static_cast<int32_t>(sequence - jump_newest_);
+        if (jump_run_ > 0 && jump_ahead > 0 && jump_ahead < REPLAY_WINDOW_SIZE) {
+            jump_run_++;
+        } else {
+            jump_run_ = 1;
+        }
+        jump_newest_ = sequence;
+        if (jump_run_ < REPLAY_WINDOW_JUMP_PACKETS) {
+            stats_.unconfirmed++;
+            return kUnconfirmed;
+        }
+    }
+
+    if (!started_ || ahead > 0) {
+        received_ = !started_ || ahead >= REPLAY_WINDOW_SIZE ? 0 : received_ << ahead;
+        received_ |= 1;
+        newest_ = sequence;
+        started_ = true;
+        jump_run_ = 0;
+        stats_.accepted++;
+        return kAccepted;
+    }
+
+    uint32_t behind = -ahead;
+    if (behind >= REPLAY_WINDOW_SIZE) {
+        stats_.too_old++;
+        return kTooOld;
+    }
+    uint64_t bit = 1ULL << behind;
+    if (received_ & bit) {
+        stats_.duplicates++;
+        return kDuplicate;
+    }
+    received_ |= bit;
+    jump_run_ = 0;
+    stats_.accepted++;
+    stats_.reordered++;
+    return kReordered;
+}
+
+void ReplayWindow::Reset() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    newest_ = 0;
+    received_ = 0;
+    started_ = false;
+    jump_newest_ = 0;
+    jump_run_ = 0;
+    stats_ = {};
+}
+
+ReplayWindowStats ReplayWindow::stats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
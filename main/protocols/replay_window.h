@@ -0,0 +1,65 @@
+#ifndef REPLAY_WINDOW_H
+#define REPLAY_WINDOW_H
+
+#include <cstdint>
+#include <mutex>
+
+// Sequence numbers remembered behind the newest one, at most 64
+#define REPLAY_WINDOW_SIZE 64
+// Packets in a row that must agree before the window jumps further ahead than its size
+#define REPLAY_WINDOW_JUMP_PACKETS 3
+
+struct ReplayWindowStats {
+    uint32_t accepted = 0;
+    uint32_t reordered = 0;     // Accepted although a newer packet had arrived before
+    uint32_t duplicates = 0;    // Sequence already received, duplicated by the network or replayed
+    uint32_t too_old = 0;       // Older than the window
+    uint32_t unconfirmed = 0;   // Too far ahead and not yet confirmed by the packets after it
+};
+
+/*
+ * Sliding window over the sequence numbers of received datagrams, as in RFC 4303.
+ *
+ * A packet newer than any before moves the window forward. An older one is accepted once while
+ * it is still inside the window, so reordered packets reach the jitter buffer, which puts them
+ * back in order, while duplicated and replayed ones are dropped. Packets older than the window
+ * are dropped as well, the jitter buffer would take them for the start of a new stream and
+ * throw away what it holds.
+ *
+ * The sequence is checked before anything else about the datagram, and AES-CTR does not
+ * authenticate it, so a single packet must not carry the window far ahead: every real packet
+ * after it would be too old. A packet further ahead than the window size is dropped until
+ * REPLAY_WINDOW_JUMP_PACKETS packets in a row, each a little ahead of the one before, agree on
+ * the new range, as after a long loss. Any packet accepted in between cancels the jump. Old
+ * packets never restart the window, only the server hello of a new session calls Reset().
+ *
+ * Check() runs on the UDP receive task, Reset() and stats() on others.
+ */
+class ReplayWindow {
+public:
+    enum Result {
+        kAccepted,
+        kReordered,
+        kDuplicate,
+        kTooOld,
+        kUnconfirmed,
+    };
+
+    // Marks the sequence as received unless it is rejected
+    Result Check(uint32_t sequence);
+    void Reset();
+    ReplayWindowStats stats();
+
+private:
+    std::mutex mutex_;
+    uint32_t newest_ = 0;
+    // Bit n is set when newest_ - n was received
+    uint64_t received_ = 0;
+    bool started_ = false;
+    // Last packet too far ahead and how many agreed in a row
+    uint32_t jump_newest_ = 0;
+    int jump_run_ = 0;
+    ReplayWindowStats stats_;
+};
+
+#endif // REPLAY_WINDOW_H
@@ -3,6 +3,7 @@
 #include "system_info.h"
 #include "application.h"
 #include "settings.h"
+#include "network_context.h"
 
 #include <cstring>
 #include <cJSON.h>
@@ -14,6 +15,7 @@
 
 WebsocketProtocol::WebsocketProtocol() {
     event_group_handle_ = xEventGroupCreate();
+    send_buffer_.reserve(sizeof(BinaryProtocol2) + AUDIO_PACKET_PAYLOAD_RESERVE);
 
     // 初始化重连定时器
     esp_timer_create_args_t reconnect_timer_args = {
@@ -40,19 +42,23 @@ WebsocketProtocol::~WebsocketProtocol() {
 }
 
 bool WebsocketProtocol::Start() {
-    // Only connect to server when audio channel is needed
+    // Only connect to server when audio channel is needed, have the host resolved by then
+    Settings settings("websocket", false);
+    NetworkContext::GetInstance().AddHost(settings.GetString("url"));
     return true;
 }
 
-bool WebsocketProtocol::SendAudio(std::unique_ptr<AudioStreamPacket> packet) {
+bool WebsocketProtocol::SendAudio(AudioStreamPacketPtr packet) {
     if (websocket_ == nullptr || !websocket_->IsConnected()) {
         return false;
     }
 
+    uplink_frames_++;
+    uplink_messages_++;
+    // The frame is built in a reused member buffer instead of a new string per packet
     if (version_ == 2) {
-        std::string serialized;
-        serialized.resize(sizeof(BinaryProtocol2) + packet->payload.size());
-        auto bp2 = (BinaryProtocol2*)serialized.data();
+        send_buffer_.resize(sizeof(BinaryProtocol2) + packet->payload.size());
+        auto bp2 = (BinaryProtocol2*)send_buffer_.data();
         bp2->version = htons(version_);
         bp2->type = 0;
         bp2->reserved = 0;
@@ -60,22 +66,44 @@ bool WebsocketProtocol::SendAudio(std::unique_ptr<AudioStreamPacket> packet) {
         bp2->payload_size = htonl(packet->payload.size());
         memcpy(bp2->payload, packet->payload.data(), packet->payload.size());
 
-        return websocket_->Send(serialized.data(), serialized.size(), true);
-    } else if (version_ == 3) {
-        std::string serialized;
-        serialized.resize(sizeof(BinaryProtocol3) + packet->payload.size());
-        auto bp3 = (BinaryProtocol3*)serialized.data();
-        bp3->type = 0;
+        return websocket_->Send(send_buffer_.data(), send_buffer_.size(), true);
+    } else if (version_ >= 3) {
+        send_buffer_.resize(sizeof(BinaryProtocol3) + packet->payload.size());
+        auto bp3 = (BinaryProtocol3*)send_buffer_.data();
+        bp3->type = BINARY_PROTOCOL_TYPE_AUDIO;
         bp3->reserved = 0;
         bp3->payload_size = htons(packet->payload.size());
         memcpy(bp3->payload, packet->payload.data(), packet->payload.size());
 
-        return websocket_->Send(serialized.data(), serialized.size(), true);
+        return websocket_->Send(send_buffer_.data(), send_buffer_.size(), true);
     } else {
         return websocket_->Send(packet->payload.data(), packet->payload.size(), true);
     }
 }
 
+bool WebsocketProtocol::SendAudioBatch(const std::vector<AudioStreamPacketPtr>& packets) {
+    if (websocket_ == nullptr || !websocket_->IsConnected()) {
+        return false;
+    }
+
+    size_t first = 0;
+    while (first < packets.size()) {
+        send_buffer_.resize(sizeof(BinaryProtocol3));
+        size_t end = SerializeAudioBatch(packets, first, send_buffer_);
+        auto bp3 = (BinaryProtocol3*)send_buffer_.data();
+        bp3->type = BINARY_PROTOCOL_TYPE_AUDIO_BATCH;
+        bp3->reserved = end - first;
+        bp3->payload_size = htons(send_buffer_.size() - sizeof(BinaryProtocol3));
+        if (!websocket_->Send(send_buffer_.data(), send_buffer_.size(), true)) {
+            return false;
+        }
+        uplink_frames_ += end - first;
+        uplink_messages_++;
+        first = end;
+    }
+    return true;
+}
+
 bool WebsocketProtocol::SendText(const std::string& text) {
     if (websocket_ == nullptr || !websocket_->IsConnected()) {
         return false;
@@ -96,6 +124,7 @@ bool WebsocketProtocol::IsAudioChannelOpened() const {
 }
 
 void WebsocketProtocol::CloseAudioChannel() {
+    LogUplinkStats();
     websocket_.reset();
 }
 
@@ -202,13 +231,15 @@ bool WebsocketProtocol::OpenAudioChannel() {
                     }
 
                     auto payload = (uint8_t*)bp2->payload;
-                    on_incoming_audio_(std::make_unique<AudioStreamPacket>(AudioStreamPacket{
-                        .sample_rate = server_sample_rate_,
-                        .frame_duration = server_frame_duration_,
-                        .timestamp = bp2->timestamp,
-                        .payload = std::vector<uint8_t>(payload, payload + bp2->payload_size)
-                    }));
-                } else if (version_ == 3) {
+                    auto packet = AllocateAudioStreamPacket();
+                    packet->sample_rate = server_sample_rate_;
+                    packet->frame_duration = server_frame_duration_;
+                    packet->sequence = ++incoming_sequence_;
+                    LATENCY_TRACE_BEGIN(packet->trace);
+                    packet->timestamp = bp2->timestamp;
+                    packet->payload.assign(payload, payload + bp2->payload_size);
+                    on_incoming_audio_(std::move(packet));
+                } else if (version_ >= 3) {
                     // 检查数据长度是否足够包含协议头
                     if (len < sizeof(BinaryProtocol3)) {
                         ESP_LOGE(TAG, "数据包太短，无法解析v3协议头: len=%zu", len);
@@ -226,19 +257,26 @@ bool WebsocketProtocol::OpenAudioChannel() {
                     }
 
                     auto payload = (uint8_t*)bp3->payload;
-                    on_incoming_audio_(std::make_unique<AudioStreamPacket>(AudioStreamPacket{
-                        .sample_rate = server_sample_rate_,
-                        .frame_duration = server_frame_duration_,
-                        .timestamp = 0,
-                        .payload = std::vector<uint8_t>(payload, payload + bp3->payload_size)
-                    }));
+                    if (version_ >= 4 && bp3->type == BINARY_PROTOCOL_TYPE_AUDIO_BATCH) {
+                        ParseAudioBatch(payload, bp3->payload_size);
+                        last_incoming_time_ = std::chrono::steady_clock::now();
+                        return;
+                    }
+                    auto packet = AllocateAudioStreamPacket();
+                    packet->sample_rate = server_sample_rate_;
+                    packet->frame_duration = server_frame_duration_;
+                    packet->sequence = ++incoming_sequence_;
+                    LATENCY_TRACE_BEGIN(packet->trace);
+                    packet->payload.assign(payload, payload + bp3->payload_size);
+                    on_incoming_audio_(std::move(packet));
                 } else {
-                    on_incoming_audio_(std::make_unique<AudioStreamPacket>(AudioStreamPacket{
-                        .sample_rate = server_sample_rate_,
-                        .frame_duration = server_frame_duration_,
-                        .timestamp = 0,
-                        .payload = std::vector<uint8_t>((uint8_t*)data, (uint8_t*)data + len)
-                    }));
+                    auto packet = AllocateAudioStreamPacket();
+                    packet->sample_rate = server_sample_rate_;
+                    packet->frame_duration = server_frame_duration_;
+                    packet->sequence = ++incoming_sequence_;
+                    LATENCY_TRACE_BEGIN(packet->trace);
+                    packet->payload.assign((uint8_t*)data, (uint8_t*)data + len);
+                    on_incoming_audio_(std::move(packet));
                 }
             }
         } else {
@@ -294,6 +332,27 @@ bool WebsocketProtocol::OpenAudioChannel() {
     return true;
 }
 
+void WebsocketProtocol::ParseAudioBatch(const uint8_t* data, size_t size) {
+    while (size >= sizeof(AudioBatchFrame)) {
+        auto frame = (const AudioBatchFrame*)data;
+        size_t payload_size = ntohs(frame->payload_size);
+        if (payload_size > size - sizeof(AudioBatchFrame)) {
+            ESP_LOGE(TAG, "批量音频帧长度(%u)超过可用数据(%zu)", payload_size, size - sizeof(AudioBatchFrame));
+            return;
+        }
+        auto packet = AllocateAudioStreamPacket();
+        packet->sample_rate = server_sample_rate_;
+        packet->frame_duration = server_frame_duration_;
+        packet->sequence = ++incoming_sequence_;
+        LATENCY_TRACE_BEGIN(packet->trace);
+        packet->timestamp = ntohl(frame->timestamp);
+        packet->payload.assign(frame->payload, frame->payload + payload_size);
+        on_incoming_audio_(std::move(packet));
+        data += sizeof(AudioBatchFrame) + payload_size;
+        size -= sizeof(AudioBatchFrame) + payload_size;
+    }
+}
+
 std::string WebsocketProtocol::GetHelloMessage() {
     // keys: message type, version, audio_params (format, sample_rate, channels)
     cJSON* root = cJSON_CreateObject();
@@ -304,6 +363,9 @@ std::string WebsocketProtocol::GetHelloMessage() {
     cJSON_AddBoolToObject(features, "aec", true);
 #endif
     cJSON_AddBoolToObject(features, "mcp", true);
+    if (version_ >= 4) {
+        cJSON_AddBoolToObject(features, "audio_batch", true);
+    }
     cJSON_AddItemToObject(root, "features", features);
     cJSON_AddStringToObject(root, "transport", "websocket");
     cJSON* audio_params = cJSON_CreateObject();
@@ -336,7 +398,13 @@ void WebsocketProtocol::ParseServerHello(const cJSON* root) {
         ESP_LOGI(TAG, "Session ID: %s", session_id_.c_str());
     }
 
+    // 版本4支持批量音频消息，但只有服务器 hello 确认 audio_batch 后才发送
+    auto features = cJSON_GetObjectItem(root, "features");
+    audio_batch_supported_ = version_ >= 4 && cJSON_IsObject(features) &&
+        cJSON_IsTrue(cJSON_GetObjectItem(features, "audio_batch"));
+
     // 解析音频参数并进行范围验证
+    uplink_frame_duration_ = OPUS_FRAME_DURATION_MS;
     auto audio_params = cJSON_GetObjectItem(root, "audio_params");
     if (cJSON_IsObject(audio_params)) {
         auto sample_rate = cJSON_GetObjectItem(audio_params, "sample_rate");
@@ -359,6 +427,16 @@ void WebsocketProtocol::ParseServerHello(const cJSON* root) {
                 ESP_LOGW(TAG, "帧时长超出有效范围(%d)，使用默认值", duration);
             }
         }
+        // 服务器可选指定上行帧时长: 20 / 40 / 60 ms
+        auto uplink_frame_duration = cJSON_GetObjectItem(audio_params, "uplink_frame_duration");
+        if (cJSON_IsNumber(uplink_frame_duration)) {
+            int duration = uplink_frame_duration->valueint;
+            if (duration == 20 || duration == 40 || duration == 60) {
+                uplink_frame_duration_ = duration;
+            } else {
+                ESP_LOGW(TAG, "不支持的上行帧时长(%d)，使用 %d ms", duration, uplink_frame_duration_);
+            }
+        }
     }
 
     xEventGroupSetBits(event_group_handle_, WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT);
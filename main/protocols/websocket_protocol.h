@@ -21,7 +21,8 @@ public:
     ~WebsocketProtocol();
 
     bool Start() override;
-    bool SendAudio(std::unique_ptr<AudioStreamPacket> packet) override;
+    bool SendAudio(AudioStreamPacketPtr packet) override;
+    bool SendAudioBatch(const std::vector<AudioStreamPacketPtr>& packets) override;
     bool OpenAudioChannel() override;
     void CloseAudioChannel() override;
     bool IsAudioChannelOpened() const override;
@@ -30,11 +31,15 @@ private:
     EventGroupHandle_t event_group_handle_;
     std::unique_ptr<WebSocket> websocket_;
     int version_ = 1;
+    uint32_t incoming_sequence_ = 0;  // WebSocket 没有序列号，按到达顺序编号
     int connect_retry_count_ = 0;
     esp_timer_handle_t reconnect_timer_ = nullptr;
     bool reconnect_scheduled_ = false;
+    // Binary frame of SendAudio, only used by the main task
+    std::vector<uint8_t> send_buffer_;
 
     void ParseServerHello(const cJSON* root);
+    void ParseAudioBatch(const uint8_t* data, size_t size);
     bool SendText(const std::string& text) override;
     std::string GetHelloMessage();
     bool TryConnect();
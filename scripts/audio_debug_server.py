@@ -1,54 +1,143 @@
+import os
 import socket
+import struct
 import wave
+import time
 import argparse
 
 
 '''
-  Create a UDP socket and bind it to the server's IP:8000.
-  Listen for incoming messages and print them to the console.
-  Save the audio to a WAV file.
+  Receive the audio recorder dumps of the device (CONFIG_USE_AUDIO_DEBUGGER) over UDP.
+  Every datagram is one record: a 16 byte header followed by PCM or Opus payload.
+  The records are demuxed by tap and each tap is saved to its own WAV file, placed on a
+  common timeline so the stages can be compared side by side.
+  Opus records need opuslib (pip install opuslib).
 '''
-def main(samplerate, channels):
-    # Create a UDP socket
+
+# magic, tap, format, channels, sample_rate, payload_size, sequence, timestamp_ms
+HEADER = struct.Struct('<BBBBHHII')
+RECORD_MAGIC = 0xA7
+FORMAT_PCM = 0
+FORMAT_OPUS = 1
+TAP_END = 0xFF
+TAP_NAMES = ['mic', 'processed', 'decoded', 'speaker']
+# A timestamp this far ahead of the audio written so far is a gap, filled with silence
+GAP_MS = 100
+
+
+class TapWriter:
+    def __init__(self, path, tap, channels, sample_rate, start_ms):
+        self.path = path
+        self.tap = tap
+        self.channels = channels
+        self.sample_rate = sample_rate
+        self.start_ms = start_ms
+        self.frames = 0
+        self.records = 0
+        self.lost = 0
+        self.sequence = None
+        self.decoder = None
+        self.wav = wave.open(path, 'wb')
+        self.wav.setnchannels(channels)
+        self.wav.setsampwidth(2)
+        self.wav.setframerate(sample_rate)
+
+    def write(self, fmt, sequence, timestamp_ms, payload):
+        if self.sequence is not None and sequence != self.sequence + 1:
+            self.lost += sequence - self.sequence - 1
+        self.sequence = sequence
+        self.records += 1
+
+        if fmt == FORMAT_OPUS:
+            if self.decoder is None:
+                import opuslib
+                self.decoder = opuslib.Decoder(self.sample_rate, self.channels)
+            # The recorder encodes 20 ms frames
+            pcm = self.decoder.decode(payload, self.sample_rate // 50)
+        else:
+            pcm = payload
+
+        target = (timestamp_ms - self.start_ms) * self.sample_rate // 1000
+        if target - self.frames > GAP_MS * self.sample_rate // 1000:
+            self.wav.writeframes(b'\x00' * (target - self.frames) * 2 * self.channels)
+            self.frames = target
+        self.wav.writeframes(pcm)
+        self.frames += len(pcm) // 2 // self.channels
+        return pcm
+
+    def close(self):
+        self.wav.close()
+        print(f"  {os.path.basename(self.path)}: {self.records} records, {self.frames / self.sample_rate:.1f} s, "
+              f"{self.channels} ch @ {self.sample_rate} Hz, {self.lost} records missing")
+
+
+def main(port, output_dir, relay_port):
     server_socket = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
-    server_socket.bind(('0.0.0.0', 8000))
+    server_socket.bind(('0.0.0.0', port))
+    relay_socket = socket.socket(socket.AF_INET, socket.SOCK_DGRAM) if relay_port else None
+    os.makedirs(output_dir, exist_ok=True)
 
-    # Create WAV file with parameters
-    filename = f"{samplerate}_{channels}.wav"
-    wav_file = wave.open(filename, "wb")
-    wav_file.setnchannels(channels)     # channels parameter
-    wav_file.setsampwidth(2)            # 2 bytes per sample (16-bit)
-    wav_file.setframerate(samplerate)   # samplerate parameter
+    writers = {}
+    start_ms = None
+    prefix = None
+    dumps = 0
 
-    print(f"Start saving audio from 0.0.0.0:8000 to {filename}...")
+    def finish():
+        nonlocal writers, start_ms
+        if writers:
+            print(f"Dump {prefix} saved:")
+            for writer in writers.values():
+                writer.close()
+        writers = {}
+        start_ms = None
 
+    print(f"Waiting for audio recorder dumps on 0.0.0.0:{port}...")
     try:
         while True:
-            # Receive a message from the client
-            message, address = server_socket.recvfrom(8000)
-            
-            # Write PCM data to WAV file
-            wav_file.writeframes(message)
-
-            # Print length of the message
-            print(f"Received {len(message)} bytes from {address}")
-    
+            message, address = server_socket.recvfrom(4096)
+            if len(message) < HEADER.size:
+                continue
+            magic, tap, fmt, channels, sample_rate, payload_size, sequence, timestamp_ms = HEADER.unpack_from(message)
+            if magic != RECORD_MAGIC:
+                print(f"Ignored {len(message)} bytes from {address}, not an audio record")
+                continue
+            if tap == TAP_END:
+                print(f"End of dump from {address}, {sequence} records sent")
+                finish()
+                continue
+
+            payload = message[HEADER.size:HEADER.size + payload_size]
+            if start_ms is None:
+                start_ms = timestamp_ms
+                dumps += 1
+                prefix = f"{time.strftime('%Y%m%d_%H%M%S')}_{dumps}"
+            if tap not in writers:
+                name = TAP_NAMES[tap] if tap < len(TAP_NAMES) else f"tap{tap}"
+                path = os.path.join(output_dir, f"{prefix}_{name}.wav")
+                writers[tap] = TapWriter(path, tap, channels, sample_rate, start_ms)
+            pcm = writers[tap].write(fmt, sequence, timestamp_ms, payload)
+
+            # The acoustic check GUI takes the mono microphone stream
+            if relay_socket and tap == 0:
+                mono = b''.join(pcm[i:i + 2] for i in range(0, len(pcm), 2 * channels))
+                relay_socket.sendto(mono, ('127.0.0.1', relay_port))
+
     except KeyboardInterrupt:
-        print("\nStopping recording...")
-    
+        print("\nStopping...")
+
     finally:
-        # Close files and socket
-        wav_file.close()
+        finish()
         server_socket.close()
-        print(f"WAV file '{filename}' saved successfully")
 
 
 if __name__ == "__main__":
-    parser = argparse.ArgumentParser(description='UDP音频数据接收器，保存为WAV文件')
-    parser.add_argument('--samplerate', '-s', type=int, default=16000, 
-                        help='采样率 (默认: 16000)')
-    parser.add_argument('--channels', '-c', type=int, default=2, 
-                        help='声道数 (默认: 2)')
-    
+    parser = argparse.ArgumentParser(description='音频录制数据接收器，按采集点分别保存为WAV文件')
+    parser.add_argument('--port', '-p', type=int, default=8000,
+                        help='UDP端口 (默认: 8000)')
+    parser.add_argument('--output-dir', '-o', default='audio_dumps',
+                        help='WAV文件保存目录 (默认: audio_dumps)')
+    parser.add_argument('--relay', '-r', type=int, default=0,
+                        help='把麦克风单声道PCM转发到本机该UDP端口, 供acoustic_check使用 (默认: 不转发)')
+
     args = parser.parse_args()
-    main(args.samplerate, args.channels)
+    main(args.port, args.output_dir, args.relay)
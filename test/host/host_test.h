@@ -0,0 +1,36 @@
+#ifndef HOST_TEST_H
+#define HOST_TEST_H
+
+#include <cstdio>
+#include <cstdlib>
+
+// Minimal checks for the host tests, a failed check prints its location and the test exits non-zero
+
+static int host_test_failures = 0;
+
+#define CHECK(condition) do { \
+    if (!(condition)) { \
+        std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+        host_test_failures++; \
+    } \
+} while (0)
+
+#define CHECK_EQ(actual, expected) do { \
+    long long actual_value = static_cast<long long>(actual); \
+    long long expected_value = static_cast<long long>(expected); \
+    if (actual_value != expected_value) { \
+        std::fprintf(stderr, "%s:%d: CHECK_EQ(%s, %s) failed: %lld != %lld\n", __FILE__, __LINE__, \
+            #actual, #expected, actual_value, expected_value); \
+        host_test_failures++; \
+    } \
+} while (0)
+
+#define RUN_TEST(test) do { \
+    int failures_before = host_test_failures; \
+    test(); \
+    std::printf("%s %s\n", host_test_failures == failures_before ? "PASS" : "FAIL", #test); \
+} while (0)
+
+#define HOST_TEST_RESULT() (host_test_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE)
+
+#endif // HOST_TEST_H
@@ -0,0 +1,36 @@
+// No-op cJSON for units that link protocol.cc. Tests must not send JSON messages,
+// cJSON_PrintUnformatted returns nullptr
+
+#include "cJSON.h"
+
+#include <cstddef>
+
+extern "C" {
+
+cJSON* cJSON_CreateObject(void) {
+    return nullptr;
+}
+
+cJSON* cJSON_Parse(const char*) {
+    return nullptr;
+}
+
+cJSON* cJSON_AddStringToObject(cJSON*, const char*, const char*) {
+    return nullptr;
+}
+
+cJSON_bool cJSON_AddItemToObject(cJSON*, const char*, cJSON*) {
+    return 0;
+}
+
+char* cJSON_PrintUnformatted(const cJSON*) {
+    return nullptr;
+}
+
+void cJSON_Delete(cJSON*) {
+}
+
+void cJSON_free(void*) {
+}
+
+}
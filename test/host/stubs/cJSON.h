@@ -0,0 +1,26 @@
+#ifndef CJSON_STUB_H
+#define CJSON_STUB_H
+
+// Host stand-in for cJSON.h. protocol.h only passes cJSON pointers around, protocol.cc builds
+// its JSON messages with the functions below. They do nothing, see cJSON.cc
+
+typedef struct cJSON cJSON;
+typedef int cJSON_bool;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+cJSON* cJSON_CreateObject(void);
+cJSON* cJSON_Parse(const char* value);
+cJSON* cJSON_AddStringToObject(cJSON* object, const char* name, const char* string);
+cJSON_bool cJSON_AddItemToObject(cJSON* object, const char* string, cJSON* item);
+char* cJSON_PrintUnformatted(const cJSON* item);
+void cJSON_Delete(cJSON* item);
+void cJSON_free(void* object);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CJSON_STUB_H
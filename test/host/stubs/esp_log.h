@@ -0,0 +1,15 @@
+#ifndef ESP_LOG_H
+#define ESP_LOG_H
+
+// Host stand-in for esp_log.h, the arguments are evaluated and dropped.
+// The format is not checked, uint32_t is unsigned long on Xtensa and %lu would not match here
+
+static inline void esp_log_stub(const char*, ...) {}
+
+#define ESP_LOGE(tag, ...) esp_log_stub(tag, __VA_ARGS__)
+#define ESP_LOGW(tag, ...) esp_log_stub(tag, __VA_ARGS__)
+#define ESP_LOGI(tag, ...) esp_log_stub(tag, __VA_ARGS__)
+#define ESP_LOGD(tag, ...) esp_log_stub(tag, __VA_ARGS__)
+#define ESP_LOGV(tag, ...) esp_log_stub(tag, __VA_ARGS__)
+
+#endif // ESP_LOG_H
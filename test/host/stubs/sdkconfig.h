@@ -0,0 +1,14 @@
+#ifndef SDKCONFIG_H
+#define SDKCONFIG_H
+
+// Host stand-in for the generated sdkconfig.h, only the options the tested units read.
+// Optional units are switched on so they are compiled, values are the Kconfig defaults.
+// Some of them exclude each other in Kconfig, each unit only reads its own option
+
+#define CONFIG_USE_SERVER_AEC 1
+#define CONFIG_USE_AUDIO_INPUT_GATE 1
+#define CONFIG_USE_LOCAL_ENDPOINTING 1
+#define CONFIG_ENDPOINT_HANGOVER_MS 700
+#define CONFIG_ENDPOINT_MIN_SPEECH_MS 300
+
+#endif // SDKCONFIG_H
@@ -0,0 +1,205 @@
+// AecTimeline: reference timestamps against simulated I2S DMA clocks with drift and scheduling jitter
+
+#include "host_test.h"
+#include "aec_timeline.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <random>
+#include <vector>
+#include <algorithm>
+
+static const int kOutputRate = 24000;
+static const int kDmaDescNum = 6;
+static const int kDmaFrameNum = 240;
+static const int64_t kDmaDepth = kDmaDescNum * kDmaFrameNum;
+static const size_t kPlayFrame = kOutputRate * 60 / 1000;
+static const size_t kCaptureChunk = 512;
+static const size_t kUplinkFrame = 16000 * 60 / 1000;
+
+/*
+ * Both DMA streams run on their own crystal, off from esp_timer by a few hundred ppm. The
+ * output task writes whole frames and blocks while the DMA is full, the input task reads
+ * chunks and blocks until they were captured. Both see a random scheduling delay before a
+ * blocking call returns. The true playback position at the capture time of every uplink
+ * frame is known, so the timestamp the timeline returns can be checked against it.
+ */
+class DmaSimulation {
+public:
+    DmaSimulation(double playback_ppm, double capture_ppm)
+        : playback_rate_(kOutputRate * (1 + playback_ppm / 1e6)), capture_rate_(16000 * (1 + capture_ppm / 1e6)), rng_(3) {
+        timeline_.Reset(kOutputRate, kDmaDescNum, kDmaFrameNum);
+    }
+
+    // Plays frames with the given server timestamp (0 for local prompts) while capturing
+    void Play(int frames, uint32_t timestamp) {
+        for (int i = 0; i < frames; i++) {
+            Write(timestamp == 0 ? 0 : timestamp + i * 60);
+        }
+    }
+
+    // The output task waits for more TTS while capture goes on
+    void Pause(int64_t duration_us) {
+        CaptureUntil(output_time_ + duration_us);
+        output_time_ += duration_us;
+    }
+
+    AecTimeline& timeline() { return timeline_; }
+    int64_t max_error_ms() const { return max_error_ms_; }
+    // Error once the playback clock had two seconds of blocking writes
+    int64_t settled_error_ms() const { return settled_error_ms_; }
+    int stamped() const { return stamped_; }
+    int missed() const { return missed_; }
+    int false_stamps() const { return false_stamps_; }
+
+private:
+    struct Segment {
+        int64_t start;
+        uint32_t timestamp;
+    };
+
+    AecTimeline timeline_;
+    double playback_rate_;
+    double capture_rate_;
+    std::mt19937 rng_;
+    // Playback: sample play_base_ is audible at play_base_us_, playback stops at written_
+    double play_base_us_ = 0;
+    int64_t play_base_ = 0;
+    int64_t written_ = 0;
+    double output_time_ = 1000000;
+    // Capture starts at time 0
+    int64_t captured_ = 0;
+    int64_t processed_ = 0;
+    double input_time_ = 0;
+    std::vector<Segment> segments_;
+    int64_t max_error_ms_ = 0;
+    int64_t settled_error_ms_ = 0;
+    int stamped_ = 0;
+    int missed_ = 0;
+    int false_stamps_ = 0;
+
+    double Jitter() {
+        return std::uniform_real_distribution<double>(0, 2000)(rng_);
+    }
+
+    double PlayedAt(double time_us) const {
+        return std::min<double>(written_, play_base_ + std::max(0.0, time_us - play_base_us_) * playback_rate_ / 1e6);
+    }
+
+    double CaptureTimeOf(int64_t sample) const {
+        return sample * 1e6 / capture_rate_;
+    }
+
+    void Write(uint32_t timestamp) {
+        double start = output_time_;
+        if (PlayedAt(start) >= written_) {
+            // Ran dry, the first sample goes out after the DMA buffer that is being sent, at a random phase
+            play_base_ = written_;
+            play_base_us_ = start + std::uniform_real_distribution<double>(0, kDmaFrameNum * 1e6 / kOutputRate)(rng_);
+        }
+        // Blocks until all but the DMA depth has been played
+        double needed = written_ + kPlayFrame - kDmaDepth;
+        double end = start + 100;
+        if (needed > PlayedAt(end)) {
+            end = play_base_us_ + (needed - play_base_) * 1e6 / playback_rate_ + Jitter();
+        }
+        CaptureUntil(end);
+        segments_.push_back({written_, timestamp});
+        written_ += kPlayFrame;
+        timeline_.OnPlayed(timestamp, kPlayFrame, static_cast<int64_t>(start), static_cast<int64_t>(end));
+        output_time_ = end + 200;
+    }
+
+    void CaptureUntil(double time_us) {
+        while (true) {
+            double start = input_time_;
+            double end = std::max(start + 100, CaptureTimeOf(captured_ + kCaptureChunk) + Jitter());
+            if (end > time_us) {
+                return;
+            }
+            captured_ += kCaptureChunk;
+            timeline_.OnCaptured(kCaptureChunk, static_cast<int64_t>(start), static_cast<int64_t>(end));
+            input_time_ = end + 100;
+            while (processed_ + static_cast<int64_t>(kUplinkFrame) <= captured_) {
+                Check(timeline_.OnProcessed(kUplinkFrame));
+            }
+        }
+    }
+
+    // TTS segment audible at a time, null for silence and prompts. Sets the audible sample position
+    const Segment* AudibleAt(double time_us, double& position) const {
+        position = PlayedAt(time_us);
+        if (time_us < play_base_us_ || position >= written_) {
+            return nullptr;
+        }
+        auto segment = std::upper_bound(segments_.begin(), segments_.end(), static_cast<int64_t>(position),
+            [](int64_t value, const Segment& s) { return value < s.start; }) - 1;
+        return segment->timestamp != 0 ? &*segment : nullptr;
+    }
+
+    void Check(uint32_t timestamp) {
+        double time_us = CaptureTimeOf(processed_);
+        processed_ += kUplinkFrame;
+        double position;
+        auto segment = AudibleAt(time_us, position);
+        // Frames within two DMA buffers of where TTS starts or stops may go either way
+        double margin_us = kDmaFrameNum * 2 * 1e6 / kOutputRate;
+        double other;
+        if ((AudibleAt(time_us - margin_us, other) == nullptr) != (segment == nullptr) ||
+            (AudibleAt(time_us + margin_us, other) == nullptr) != (segment == nullptr)) {
+            return;
+        }
+        if (segment == nullptr) {
+            false_stamps_ += timestamp != 0;
+            return;
+        }
+        if (timestamp == 0) {
+            missed_++;
+            return;
+        }
+        int64_t expected_ms = segment->timestamp + static_cast<int64_t>((position - segment->start) * 1000 / kOutputRate);
+        int64_t error_ms = std::abs(static_cast<int64_t>(timestamp) - expected_ms);
+        max_error_ms_ = std::max(max_error_ms_, error_ms);
+        if (time_us - play_base_us_ > 2000000) {
+            settled_error_ms_ = std::max(settled_error_ms_, error_ms);
+        }
+        stamped_++;
+    }
+};
+
+static void TestStampsFollowPlayback() {
+    DmaSimulation sim(300, -200);
+    sim.Play(1000, 1000);
+    // A minute of playback, the 2 ms of scheduling jitter is within 50 ppm of the baseline
+    auto stats = sim.timeline().stats();
+    CHECK(std::abs(stats.playback_drift_ppm - 300) <= 50);
+    CHECK(std::abs(stats.capture_drift_ppm + 200) <= 50);
+    CHECK(sim.stamped() > 900);
+    CHECK_EQ(sim.missed(), 0);
+    // The start of playback is only known to a DMA buffer, blocking writes pull the clock in
+    CHECK(sim.max_error_ms() <= kDmaFrameNum * 1000 / kOutputRate);
+    CHECK(sim.settled_error_ms() <= 3);
+}
+
+static void TestPausesAndPromptsAreNotStamped() {
+    DmaSimulation sim(-800, 500);
+    sim.Play(200, 1000);
+    // Frames captured in the pause are processed after the next block was written
+    sim.Pause(3000000);
+    sim.Play(20, 0);
+    sim.Pause(1500000);
+    sim.Play(150, 40000);
+    sim.Pause(500000);
+    CHECK_EQ(sim.false_stamps(), 0);
+    CHECK_EQ(sim.missed(), 0);
+    CHECK(sim.max_error_ms() <= kDmaFrameNum * 1000 / kOutputRate);
+    CHECK(sim.settled_error_ms() <= 3);
+    CHECK(sim.timeline().stats().stamped_frames > 0);
+}
+
+int main() {
+    RUN_TEST(TestStampsFollowPlayback);
+    RUN_TEST(TestPausesAndPromptsAreNotStamped);
+    return HOST_TEST_RESULT();
+}
@@ -0,0 +1,113 @@
+// EndpointDetector: minimum speech, bridged pauses, the hangover and the noise floor
+
+#include "host_test.h"
+#include "endpoint_detector.h"
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+static const int kSampleRate = 16000;
+static const int kFrameMs = 30;
+static const size_t kFrameSamples = kSampleRate * kFrameMs / 1000;
+
+// Feeds frames of a tone at the given amplitude, returns the time in ms the endpoint fired or -1
+class Session {
+public:
+    int Feed(EndpointDetector& detector, bool vad, int amplitude, int duration_ms) {
+        detector.OnVadChange(vad);
+        int fired_ms = -1;
+        for (int elapsed = 0; elapsed < duration_ms; elapsed += kFrameMs) {
+            std::vector<int16_t> pcm(kFrameSamples);
+            for (auto& sample : pcm) {
+                sample = static_cast<int16_t>(amplitude * sin(2 * M_PI * 200 * position_++ / kSampleRate));
+            }
+            now_ms_ += kFrameMs;
+            if (detector.Process(pcm.data(), pcm.size(), kSampleRate) && fired_ms < 0) {
+                fired_ms = now_ms_;
+            }
+        }
+        return fired_ms;
+    }
+
+    int now_ms() const { return now_ms_; }
+
+private:
+    uint64_t position_ = 0;
+    int now_ms_ = 0;
+};
+
+static void TestEndpointAfterHangover() {
+    EndpointDetector detector;
+    Session session;
+    CHECK_EQ(session.Feed(detector, false, 50, 600), -1);
+    CHECK_EQ(session.Feed(detector, true, 8000, 900), -1);
+    int speech_end_ms = session.now_ms();
+    int fired_ms = session.Feed(detector, false, 50, 2000);
+    // Fires on the first frame that completes the hangover
+    CHECK(fired_ms >= speech_end_ms + CONFIG_ENDPOINT_HANGOVER_MS);
+    CHECK(fired_ms < speech_end_ms + CONFIG_ENDPOINT_HANGOVER_MS + kFrameMs);
+    CHECK_EQ(detector.stats().speech_ms, 900);
+    CHECK_EQ(detector.stats().endpoints, 1);
+}
+
+static void TestShortClickIsIgnored() {
+    EndpointDetector detector;
+    Session session;
+    session.Feed(detector, false, 50, 600);
+    CHECK_EQ(session.Feed(detector, true, 8000, CONFIG_ENDPOINT_MIN_SPEECH_MS - 2 * kFrameMs), -1);
+    CHECK_EQ(session.Feed(detector, false, 50, 2000), -1);
+    // The click is forgotten, a real turn afterwards still needs its full minimum
+    CHECK_EQ(session.Feed(detector, true, 8000, CONFIG_ENDPOINT_MIN_SPEECH_MS - 2 * kFrameMs), -1);
+    CHECK_EQ(session.Feed(detector, false, 50, 2000), -1);
+    CHECK_EQ(detector.stats().endpoints, 0);
+}
+
+static void TestPauseIsBridged() {
+    EndpointDetector detector;
+    Session session;
+    session.Feed(detector, false, 50, 600);
+    session.Feed(detector, true, 8000, 600);
+    // A breath between phrases is shorter than the hangover
+    CHECK_EQ(session.Feed(detector, false, 50, 300), -1);
+    CHECK_EQ(session.Feed(detector, true, 8000, 600), -1);
+    int speech_end_ms = session.now_ms();
+    int fired_ms = session.Feed(detector, false, 50, 2000);
+    CHECK(fired_ms >= speech_end_ms + CONFIG_ENDPOINT_HANGOVER_MS);
+    CHECK_EQ(detector.stats().speech_ms, 1200);
+}
+
+static void TestFiresOncePerReset() {
+    EndpointDetector detector;
+    Session session;
+    session.Feed(detector, true, 8000, 600);
+    CHECK(session.Feed(detector, false, 50, 1000) > 0);
+    session.Feed(detector, true, 8000, 600);
+    CHECK_EQ(session.Feed(detector, false, 50, 1000), -1);
+    detector.Reset();
+    session.Feed(detector, true, 8000, 600);
+    CHECK(session.Feed(detector, false, 50, 1000) > 0);
+    CHECK_EQ(detector.stats().endpoints, 2);
+}
+
+static void TestVadOnNoiseIsNotSpeech() {
+    EndpointDetector detector;
+    Session session;
+    // A steady fan the VAD mistakes for speech stays at the learned noise floor
+    session.Feed(detector, false, 1000, 2000);
+    CHECK_EQ(session.Feed(detector, true, 1000, 1500), -1);
+    CHECK_EQ(session.Feed(detector, false, 1000, 2000), -1);
+    // Speech over the same noise still ends the turn
+    session.Feed(detector, true, 8000, 600);
+    CHECK(session.Feed(detector, false, 1000, 1000) > 0);
+    CHECK_EQ(detector.stats().speech_ms, 600);
+}
+
+int main() {
+    RUN_TEST(TestEndpointAfterHangover);
+    RUN_TEST(TestShortClickIsIgnored);
+    RUN_TEST(TestPauseIsBridged);
+    RUN_TEST(TestFiresOncePerReset);
+    RUN_TEST(TestVadOnNoiseIsNotSpeech);
+    return HOST_TEST_RESULT();
+}
@@ -0,0 +1,167 @@
+// InputGate: bypass of silent input, the lookahead flush on onset, the hangover and keep_open
+
+#include "host_test.h"
+#include "input_gate.h"
+
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+static const size_t kChunkSamples = 160;          // 10 ms at 16 kHz
+static const int kFrameDurationMs = 60;
+static const size_t kFrameSamples = 16000 * kFrameDurationMs / 1000;
+
+// Drives the gate with numbered chunks and records what reaches the processor
+class GateHarness {
+public:
+    explicit GateHarness(int channels = 1) : channels_(channels), rng_(11) {
+        gate_.Initialize(channels, kFrameDurationMs);
+        gate_.OnFeed([this](std::vector<int16_t>& chunk) {
+            CHECK_EQ(chunk.size(), kChunkSamples * channels_);
+            fed_.push_back(chunk[channels_]);
+        });
+        gate_.OnSilence([this](size_t samples) {
+            CHECK_EQ(samples, kFrameSamples);
+            silence_samples_ += samples;
+        });
+    }
+
+    // Quiet noise, the chunk number is in the second mic sample so the order can be checked
+    void Quiet(int chunks, bool keep_open = false, int reference_amplitude = 0) {
+        std::uniform_int_distribution<int> noise(-10, 10);
+        for (int c = 0; c < chunks; c++) {
+            for (size_t i = 0; i < kChunkSamples; i++) {
+                buffer_[i * channels_] = static_cast<int16_t>(noise(rng_));
+                if (channels_ > 1) {
+                    buffer_[i * channels_ + 1] = static_cast<int16_t>(reference_amplitude * sin(0.3 * i));
+                }
+            }
+            Push(keep_open);
+        }
+    }
+
+    void Speech(int chunks) {
+        for (int c = 0; c < chunks; c++) {
+            for (size_t i = 0; i < kChunkSamples; i++) {
+                buffer_[i * channels_] = static_cast<int16_t>(6000 * sin(2 * M_PI * 220 * (position_ + i) / 16000));
+            }
+            Push(false);
+        }
+    }
+
+    InputGate& gate() { return gate_; }
+    const std::vector<int>& fed() const { return fed_; }
+    size_t silence_samples() const { return silence_samples_; }
+    int pushed() const { return next_id_; }
+
+private:
+    int channels_;
+    InputGate gate_;
+    std::mt19937 rng_;
+    std::vector<int16_t> buffer_ = std::vector<int16_t>(kChunkSamples * channels_);
+    std::vector<int> fed_;
+    size_t silence_samples_ = 0;
+    uint64_t position_ = 0;
+    int next_id_ = 0;
+
+    void Push(bool keep_open) {
+        buffer_[channels_] = static_cast<int16_t>(next_id_++ % 30);
+        position_ += kChunkSamples;
+        // The gate may swap the buffer, the input task keeps reading into whatever it got back
+        gate_.Process(buffer_, keep_open);
+        buffer_.resize(kChunkSamples * channels_);
+    }
+};
+
+static const int kHangoverChunks = INPUT_GATE_HANGOVER_MS / 10;
+
+static void TestSilenceIsBypassed() {
+    GateHarness harness;
+    harness.Quiet(kHangoverChunks - 1);
+    CHECK(harness.gate().is_open());
+    harness.Quiet(1);
+    CHECK(!harness.gate().is_open());
+    CHECK_EQ(harness.fed().size(), static_cast<size_t>(kHangoverChunks));
+
+    // Closed, nothing more reaches the processor and the uplink gets whole silence frames
+    harness.Quiet(300);
+    CHECK_EQ(harness.fed().size(), static_cast<size_t>(kHangoverChunks));
+    size_t held = harness.pushed() * kChunkSamples - harness.fed().size() * kChunkSamples - harness.silence_samples();
+    CHECK(held >= INPUT_GATE_MAX_LOOKAHEAD_CHUNKS * kChunkSamples);
+    CHECK(held < INPUT_GATE_MAX_LOOKAHEAD_CHUNKS * kChunkSamples + kFrameSamples);
+    CHECK_EQ(harness.gate().stats().bypassed_chunks, 300 - INPUT_GATE_MAX_LOOKAHEAD_CHUNKS);
+}
+
+static void TestOnsetFlushesLookahead() {
+    GateHarness harness;
+    harness.Quiet(kHangoverChunks + 50);
+    CHECK(!harness.gate().is_open());
+    size_t before = harness.fed().size();
+    harness.Speech(1);
+    CHECK(harness.gate().is_open());
+    CHECK_EQ(harness.gate().stats().openings, 1);
+    // The held back chunks and the onset go to the processor in input order
+    CHECK_EQ(harness.fed().size(), before + INPUT_GATE_MAX_LOOKAHEAD_CHUNKS + 1);
+    for (size_t i = before + 1; i < harness.fed().size(); i++) {
+        CHECK_EQ(harness.fed()[i], (harness.fed()[i - 1] + 1) % 30);
+    }
+    CHECK_EQ(harness.fed().back(), (harness.pushed() - 1) % 30);
+}
+
+static void TestClosesAfterHangover() {
+    GateHarness harness;
+    harness.Speech(100);
+    harness.Quiet(kHangoverChunks - 1);
+    CHECK(harness.gate().is_open());
+    // Speech inside the hangover restarts it
+    harness.Speech(1);
+    harness.Quiet(kHangoverChunks - 1);
+    CHECK(harness.gate().is_open());
+    harness.Quiet(1);
+    CHECK(!harness.gate().is_open());
+    CHECK_EQ(harness.silence_samples(), 0);
+}
+
+static void TestKeepOpen() {
+    GateHarness harness;
+    // VAD speech or playback hold the gate open on quiet input
+    harness.Quiet(kHangoverChunks * 2, true);
+    CHECK(harness.gate().is_open());
+    harness.Quiet(kHangoverChunks);
+    CHECK(!harness.gate().is_open());
+    harness.Quiet(20);
+    harness.Quiet(1, true);
+    CHECK(harness.gate().is_open());
+    CHECK_EQ(harness.fed().size(), static_cast<size_t>(harness.pushed()) - (20 + 1 - INPUT_GATE_MAX_LOOKAHEAD_CHUNKS - 1));
+}
+
+static void TestReferenceChannelIsIgnored() {
+    // Loud playback on the reference channel alone does not count as activity
+    GateHarness harness(2);
+    harness.Quiet(kHangoverChunks, false, 10000);
+    CHECK(!harness.gate().is_open());
+}
+
+static void TestResetOpens() {
+    GateHarness harness;
+    harness.Quiet(kHangoverChunks + 20);
+    CHECK(!harness.gate().is_open());
+    size_t before = harness.fed().size();
+    harness.gate().Reset();
+    CHECK(harness.gate().is_open());
+    // The held back input is dropped, the next chunk goes straight through
+    harness.Quiet(1);
+    CHECK_EQ(harness.fed().size(), before + 1);
+    CHECK_EQ(harness.fed().back(), (harness.pushed() - 1) % 30);
+}
+
+int main() {
+    RUN_TEST(TestSilenceIsBypassed);
+    RUN_TEST(TestOnsetFlushesLookahead);
+    RUN_TEST(TestClosesAfterHangover);
+    RUN_TEST(TestKeepOpen);
+    RUN_TEST(TestReferenceChannelIsIgnored);
+    RUN_TEST(TestResetOpens);
+    return HOST_TEST_RESULT();
+}
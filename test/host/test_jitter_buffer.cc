@@ -0,0 +1,153 @@
+// JitterBuffer: reordering, concealment, late and duplicate packets, and the jitter estimate
+
+#include "host_test.h"
+#include "jitter_buffer.h"
+
+#include <cstdint>
+#include <random>
+#include <vector>
+
+static const int64_t kFrameUs = 60 * 1000;
+
+static void Put(JitterBuffer& buffer, uint32_t sequence, int64_t now_us) {
+    auto packet = AllocateAudioStreamPacket();
+    packet->sample_rate = 24000;
+    packet->frame_duration = 60;
+    packet->sequence = sequence;
+    packet->payload.assign(1, static_cast<uint8_t>(sequence));
+    buffer.Put(std::move(packet), now_us);
+}
+
+// Sequence of the next frame, negative for concealment, 0 while waiting
+static int64_t Next(JitterBuffer& buffer, int64_t now_us) {
+    AudioStreamPacketPtr packet;
+    auto result = buffer.Get(packet, now_us);
+    if (result == JitterBuffer::kWait) {
+        return 0;
+    }
+    CHECK(packet != nullptr);
+    if (result == JitterBuffer::kConceal) {
+        CHECK(packet->payload.empty());
+        return -static_cast<int64_t>(packet->sequence);
+    }
+    return packet->sequence;
+}
+
+static void TestReorder() {
+    JitterBuffer buffer;
+    Put(buffer, 1, 0);
+    Put(buffer, 3, 0);
+    Put(buffer, 2, 0);
+    CHECK_EQ(Next(buffer, 0), 1);
+    CHECK_EQ(Next(buffer, 0), 2);
+    CHECK_EQ(Next(buffer, 0), 3);
+    CHECK_EQ(Next(buffer, 0), 0);
+    CHECK(buffer.Empty());
+}
+
+static void TestConcealAndLate() {
+    JitterBuffer buffer;
+    Put(buffer, 1, 0);
+    Put(buffer, 2, 0);
+    Put(buffer, 4, 0);
+    Put(buffer, 5, 0);
+    CHECK_EQ(Next(buffer, 0), 1);
+    CHECK_EQ(Next(buffer, 0), 2);
+    // 3 is missing while later packets are buffered, so it is concealed
+    CHECK_EQ(Next(buffer, 0), -3);
+    CHECK_EQ(Next(buffer, 0), 4);
+    // 3 shows up after its frame was concealed
+    Put(buffer, 3, kFrameUs);
+    Put(buffer, 5, kFrameUs);
+    CHECK_EQ(Next(buffer, kFrameUs), 5);
+    // The end of the stream is never padded with concealment
+    CHECK_EQ(Next(buffer, 10 * kFrameUs), 0);
+
+    auto& stats = buffer.stats();
+    CHECK_EQ(stats.received, 6);
+    CHECK_EQ(stats.concealed, 1);
+    CHECK_EQ(stats.late_drops, 1);
+    CHECK_EQ(stats.duplicates, 1);
+}
+
+static void TestWaitForReordered() {
+    JitterBuffer buffer;
+    Put(buffer, 1, 0);
+    CHECK_EQ(Next(buffer, 0), 1);
+    // Only one packet is held, the missing one gets a frame to arrive
+    Put(buffer, 3, kFrameUs);
+    CHECK_EQ(Next(buffer, kFrameUs), 0);
+    Put(buffer, 2, kFrameUs + 10000);
+    CHECK_EQ(Next(buffer, kFrameUs + 10000), 2);
+    CHECK_EQ(Next(buffer, kFrameUs + 10000), 3);
+    CHECK_EQ(buffer.stats().concealed, 0);
+}
+
+static void TestUnderrunAndResync() {
+    JitterBuffer buffer;
+    Put(buffer, 1, 0);
+    CHECK_EQ(Next(buffer, 0), 1);
+    CHECK_EQ(Next(buffer, kFrameUs), 0);
+    // The stream goes on after the buffer ran dry
+    Put(buffer, 2, 2 * kFrameUs);
+    CHECK_EQ(buffer.stats().underruns, 1);
+    CHECK_EQ(Next(buffer, 2 * kFrameUs), 2);
+    // A sequence far from the window starts a new stream
+    Put(buffer, 1000, 3 * kFrameUs);
+    CHECK_EQ(Next(buffer, 3 * kFrameUs), 1000);
+}
+
+// Sends sentences paced in real time and returns the jitter estimate in ms
+static uint32_t PlaySentences(JitterBuffer& buffer, int sentences, int frames, int64_t pause_us, int64_t max_lateness_us) {
+    std::mt19937 rng(7);
+    std::uniform_int_distribution<int64_t> lateness(0, max_lateness_us);
+    uint32_t sequence = 1;
+    int64_t start_us = 0;
+    for (int s = 0; s < sentences; s++) {
+        std::vector<int64_t> arrivals;
+        for (int i = 0; i < frames; i++) {
+            arrivals.push_back(start_us + i * kFrameUs + lateness(rng));
+        }
+        // Play the sentence out in 10 ms steps
+        int next = 0;
+        for (int64_t now = start_us; now < start_us + (frames + 20) * kFrameUs; now += 10000) {
+            while (next < frames && arrivals[next] <= now) {
+                Put(buffer, sequence + next, arrivals[next]);
+                next++;
+            }
+            if (now % kFrameUs == 0) {
+                Next(buffer, now);
+            }
+        }
+        sequence += frames;
+        start_us += (frames + 20) * kFrameUs + pause_us;
+    }
+    return buffer.stats().jitter_ms;
+}
+
+static void TestPausesAreNotJitter() {
+    // Sentences arrive on time, the sequence keeps counting across seconds-long pauses
+    JitterBuffer buffer;
+    CHECK_EQ(PlaySentences(buffer, 5, 30, 3000 * 1000, 0), 0);
+    CHECK_EQ(buffer.stats().target_depth, 1);
+    CHECK_EQ(buffer.stats().concealed, 0);
+}
+
+static void TestJitterRaisesDepth() {
+    JitterBuffer buffer;
+    uint32_t jitter_ms = PlaySentences(buffer, 3, 50, 2000 * 1000, 120 * 1000);
+    CHECK(jitter_ms >= 10);
+    CHECK(buffer.stats().target_depth >= 2);
+    // The estimate is still on the scale of the arrival jitter, the pauses did not add to it
+    CHECK(jitter_ms <= 120);
+}
+
+int main() {
+    RUN_TEST(TestReorder);
+    RUN_TEST(TestConcealAndLate);
+    RUN_TEST(TestWaitForReordered);
+    RUN_TEST(TestUnderrunAndResync);
+    RUN_TEST(TestPausesAreNotJitter);
+    RUN_TEST(TestJitterRaisesDepth);
+    return HOST_TEST_RESULT();
+}
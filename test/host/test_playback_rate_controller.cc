@@ -0,0 +1,135 @@
+// PlaybackRateController: rate control from the backlog and pitch preserving time compression
+
+#include "host_test.h"
+#include "playback_rate_controller.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+#include <algorithm>
+
+static const int kSampleRate = 24000;
+static const size_t kFrameSamples = kSampleRate * 60 / 1000;
+
+// Harmonic tone gliding from 120 to 240 Hz, like a voiced TTS segment
+class GlidingTone {
+public:
+    std::vector<int16_t> Next(size_t samples) {
+        std::vector<int16_t> pcm(samples);
+        for (auto& sample : pcm) {
+            double t = static_cast<double>(position_++) / kSampleRate;
+            double frequency = 120.0 + 60.0 * t;
+            phase_ += 2 * M_PI * frequency / kSampleRate;
+            sample = static_cast<int16_t>(6000 * sin(phase_) + 3000 * sin(2 * phase_) + 1500 * sin(3 * phase_));
+        }
+        return pcm;
+    }
+
+private:
+    uint64_t position_ = 0;
+    double phase_ = 0;
+};
+
+static int MaxStep(const std::vector<int16_t>& pcm) {
+    int step = 0;
+    for (size_t i = 1; i < pcm.size(); i++) {
+        step = std::max(step, std::abs(pcm[i] - pcm[i - 1]));
+    }
+    return step;
+}
+
+static void TestRateFollowsBacklog() {
+    PlaybackRateController controller;
+    controller.Update(PLAYBACK_RATE_TARGET_MS);
+    CHECK_EQ(controller.stats().rate_percent, 100);
+
+    // The rate moves by at most 1% per frame up to the maximum
+    for (int i = 0; i < 10; i++) {
+        controller.Update(PLAYBACK_RATE_TARGET_MS + PLAYBACK_RATE_FULL_SPEED_MS * 2);
+    }
+    CHECK_EQ(controller.stats().rate_percent, 110);
+    for (int i = 0; i < 100; i++) {
+        controller.Update(PLAYBACK_RATE_TARGET_MS + PLAYBACK_RATE_FULL_SPEED_MS * 2);
+    }
+    CHECK_EQ(controller.stats().rate_percent, PLAYBACK_RATE_MAX_PERCENT);
+
+    // Inside the hysteresis band the rate holds, below it the rate relaxes to 1x
+    for (int i = 0; i < 100; i++) {
+        controller.Update(PLAYBACK_RATE_TARGET_MS - PLAYBACK_RATE_HYSTERESIS_MS / 2);
+    }
+    CHECK_EQ(controller.stats().rate_percent, PLAYBACK_RATE_MAX_PERCENT);
+    for (int i = 0; i < 100; i++) {
+        controller.Update(PLAYBACK_RATE_TARGET_MS - PLAYBACK_RATE_HYSTERESIS_MS - 1);
+    }
+    CHECK_EQ(controller.stats().rate_percent, 100);
+}
+
+static void TestNormalRateIsUntouched() {
+    PlaybackRateController controller;
+    GlidingTone tone;
+    for (int i = 0; i < 20; i++) {
+        controller.Update(100);
+        auto pcm = tone.Next(kFrameSamples);
+        auto original = pcm;
+        controller.Process(pcm, kSampleRate);
+        CHECK(pcm == original);
+    }
+    CHECK(!controller.active());
+    CHECK_EQ(controller.stats().stretched_frames, 0);
+}
+
+static void TestCompressionKeepsWaveform() {
+    PlaybackRateController controller;
+    GlidingTone tone;
+    std::vector<int16_t> input;
+    std::vector<int16_t> output;
+    // A 2 s backlog that drains towards the target as playback catches up
+    int backlog_ms = 2000;
+    for (int frame = 0; frame < 200; frame++) {
+        controller.Update(backlog_ms);
+        auto pcm = tone.Next(kFrameSamples);
+        input.insert(input.end(), pcm.begin(), pcm.end());
+        controller.Process(pcm, kSampleRate);
+        output.insert(output.end(), pcm.begin(), pcm.end());
+        // A new frame arrives for each one played, the backlog shrinks by what was skipped
+        backlog_ms -= static_cast<int>((kFrameSamples - pcm.size()) * 1000 / kSampleRate);
+    }
+    CHECK(backlog_ms < 1000);
+    CHECK(backlog_ms > PLAYBACK_RATE_TARGET_MS);
+
+    double speed = static_cast<double>(input.size()) / output.size();
+    CHECK(speed > 1.05);
+    CHECK(speed <= PLAYBACK_RATE_MAX_PERCENT / 100.0);
+    // Splices crossfade similar periods, so they add no step larger than the signal's own slope
+    CHECK(MaxStep(output) <= MaxStep(input));
+    auto stats = controller.stats();
+    CHECK(stats.stretched_frames > 0);
+    CHECK_EQ(stats.removed_ms, (input.size() - output.size()) * 1000 / kSampleRate);
+}
+
+static void TestSampleRateChangeDropsDebt() {
+    PlaybackRateController controller;
+    GlidingTone tone;
+    for (int i = 0; i < 30; i++) {
+        controller.Update(3000);
+    }
+    auto pcm = tone.Next(kFrameSamples);
+    controller.Process(pcm, kSampleRate);
+    CHECK(pcm.size() < kFrameSamples);
+
+    controller.Reset();
+    CHECK(!controller.active());
+    auto other = tone.Next(16000 * 60 / 1000);
+    auto original = other;
+    controller.Process(other, 16000);
+    CHECK(other == original);
+}
+
+int main() {
+    RUN_TEST(TestRateFollowsBacklog);
+    RUN_TEST(TestNormalRateIsUntouched);
+    RUN_TEST(TestCompressionKeepsWaveform);
+    RUN_TEST(TestSampleRateChangeDropsDebt);
+    return HOST_TEST_RESULT();
+}
@@ -0,0 +1,102 @@
+// Protocol: the AudioBatchFrame layout and the frame and byte limits of a batch
+
+#include "host_test.h"
+#include "protocol.h"
+
+#include <arpa/inet.h>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Gives the test access to the serializer, the channel methods are never called
+class BatchSerializer : public Protocol {
+public:
+    using Protocol::SerializeAudioBatch;
+};
+
+static std::vector<AudioStreamPacketPtr> MakePackets(const std::vector<size_t>& sizes) {
+    std::vector<AudioStreamPacketPtr> packets;
+    for (size_t i = 0; i < sizes.size(); i++) {
+        auto packet = AllocateAudioStreamPacket();
+        packet->timestamp = 0x01020300 + i * 60;
+        packet->payload.assign(sizes[i], static_cast<uint8_t>(i + 1));
+        packets.push_back(std::move(packet));
+    }
+    return packets;
+}
+
+// Parses the frames from offset on and checks them against packets[first..]
+static size_t CheckFrames(const std::vector<uint8_t>& buffer, size_t offset, const std::vector<AudioStreamPacketPtr>& packets, size_t first) {
+    size_t count = 0;
+    while (offset < buffer.size()) {
+        CHECK(offset + sizeof(AudioBatchFrame) <= buffer.size());
+        AudioBatchFrame header;
+        memcpy(&header, &buffer[offset], sizeof(header));
+        auto& packet = packets[first + count];
+        CHECK_EQ(ntohl(header.timestamp), packet->timestamp);
+        CHECK_EQ(ntohs(header.payload_size), packet->payload.size());
+        offset += sizeof(AudioBatchFrame);
+        CHECK(offset + packet->payload.size() <= buffer.size());
+        CHECK(memcmp(&buffer[offset], packet->payload.data(), packet->payload.size()) == 0);
+        offset += packet->payload.size();
+        count++;
+    }
+    return count;
+}
+
+static void TestLayout() {
+    static_assert(sizeof(AudioBatchFrame) == 6, "timestamp and size, packed");
+    auto packets = MakePackets({ 40, 0, 130 });
+    // The caller's header stays in front of the frames
+    std::vector<uint8_t> buffer(16, 0xee);
+    CHECK_EQ(BatchSerializer::SerializeAudioBatch(packets, 0, buffer), 3);
+    CHECK_EQ(buffer.size(), 16 + 3 * sizeof(AudioBatchFrame) + 170);
+    CHECK_EQ(buffer[15], 0xee);
+    CHECK_EQ(CheckFrames(buffer, 16, packets, 0), 3);
+}
+
+static void TestFrameLimit() {
+    auto packets = MakePackets(std::vector<size_t>(AUDIO_BATCH_MAX_FRAMES * 2 + 3, 20));
+    size_t first = 0;
+    std::vector<size_t> batches;
+    while (first < packets.size()) {
+        std::vector<uint8_t> buffer;
+        size_t end = BatchSerializer::SerializeAudioBatch(packets, first, buffer);
+        CHECK_EQ(CheckFrames(buffer, 0, packets, first), end - first);
+        batches.push_back(end - first);
+        first = end;
+    }
+    CHECK(batches == std::vector<size_t>({ AUDIO_BATCH_MAX_FRAMES, AUDIO_BATCH_MAX_FRAMES, 3 }));
+}
+
+static void TestByteLimit() {
+    // Three frames of 306 bytes fit, the fourth would exceed the limit
+    static_assert(3 * 306 <= AUDIO_BATCH_MAX_BYTES && 4 * 306 > AUDIO_BATCH_MAX_BYTES, "sizes below assume the default limit");
+    auto packets = MakePackets({ 300, 300, 300, 300, 300 });
+    std::vector<uint8_t> buffer(16);
+    CHECK_EQ(BatchSerializer::SerializeAudioBatch(packets, 0, buffer), 3);
+    // The limit counts the frames only, not what the caller put in front
+    CHECK_EQ(buffer.size() - 16, 3 * 306);
+
+    buffer.clear();
+    CHECK_EQ(BatchSerializer::SerializeAudioBatch(packets, 3, buffer), 5);
+    CHECK_EQ(CheckFrames(buffer, 0, packets, 3), 2);
+}
+
+static void TestOversizedFrame() {
+    // A frame larger than the limit still goes out, on its own
+    auto packets = MakePackets({ AUDIO_BATCH_MAX_BYTES + 100, 10 });
+    std::vector<uint8_t> buffer;
+    CHECK_EQ(BatchSerializer::SerializeAudioBatch(packets, 0, buffer), 1);
+    CHECK_EQ(CheckFrames(buffer, 0, packets, 0), 1);
+    buffer.clear();
+    CHECK_EQ(BatchSerializer::SerializeAudioBatch(packets, 1, buffer), 2);
+}
+
+int main() {
+    RUN_TEST(TestLayout);
+    RUN_TEST(TestFrameLimit);
+    RUN_TEST(TestByteLimit);
+    RUN_TEST(TestOversizedFrame);
+    return HOST_TEST_RESULT();
+}
@@ -0,0 +1,111 @@
+// ReplayWindow: reordering, duplicates, stale packets and confirmation of large sequence jumps
+
+#include "host_test.h"
+#include "replay_window.h"
+
+#include <cstdint>
+
+static void TestInOrderAndReordered() {
+    ReplayWindow window;
+    CHECK_EQ(window.Check(100), ReplayWindow::kAccepted);
+    CHECK_EQ(window.Check(101), ReplayWindow::kAccepted);
+    CHECK_EQ(window.Check(104), ReplayWindow::kAccepted);
+    // 102 and 103 arrive late but inside the window
+    CHECK_EQ(window.Check(103), ReplayWindow::kReordered);
+    CHECK_EQ(window.Check(102), ReplayWindow::kReordered);
+    CHECK_EQ(window.Check(103), ReplayWindow::kDuplicate);
+    CHECK_EQ(window.Check(104), ReplayWindow::kDuplicate);
+    // The oldest sequence still inside the window
+    CHECK_EQ(window.Check(104 - (REPLAY_WINDOW_SIZE - 1)), ReplayWindow::kReordered);
+    CHECK_EQ(window.Check(104 - REPLAY_WINDOW_SIZE), ReplayWindow::kTooOld);
+
+    auto stats = window.stats();
+    CHECK_EQ(stats.accepted, 6);
+    CHECK_EQ(stats.reordered, 3);
+    CHECK_EQ(stats.duplicates, 2);
+    CHECK_EQ(stats.too_old, 1);
+}
+
+static void TestStalePacketsNeverRestart() {
+    ReplayWindow window;
+    for (uint32_t sequence = 1000; sequence < 1200; sequence++) {
+        CHECK_EQ(window.Check(sequence), ReplayWindow::kAccepted);
+    }
+    // A replay of old datagrams, however long, is dropped
+    for (uint32_t sequence = 1000; sequence < 1100; sequence++) {
+        CHECK_EQ(window.Check(sequence), ReplayWindow::kTooOld);
+    }
+    CHECK_EQ(window.Check(1000), ReplayWindow::kTooOld);
+    CHECK_EQ(window.Check(1200), ReplayWindow::kAccepted);
+}
+
+static void TestSingleJumpIsIgnored() {
+    ReplayWindow window;
+    for (uint32_t sequence = 1; sequence <= 10; sequence++) {
+        window.Check(sequence);
+    }
+    // A corrupt or spoofed sequence far ahead must not push the window away from the real stream
+    CHECK_EQ(window.Check(0x7fff0000), ReplayWindow::kUnconfirmed);
+    CHECK_EQ(window.Check(11), ReplayWindow::kAccepted);
+    CHECK_EQ(window.Check(12), ReplayWindow::kAccepted);
+    // Two forged packets in a row, then a real one cancels the jump
+    CHECK_EQ(window.Check(5000), ReplayWindow::kUnconfirmed);
+    CHECK_EQ(window.Check(5001), ReplayWindow::kUnconfirmed);
+    CHECK_EQ(window.Check(13), ReplayWindow::kAccepted);
+    CHECK_EQ(window.Check(5002), ReplayWindow::kUnconfirmed);
+    CHECK_EQ(window.Check(14), ReplayWindow::kAccepted);
+    // Packets far ahead of each other do not agree on a range
+    CHECK_EQ(window.Check(10000), ReplayWindow::kUnconfirmed);
+    CHECK_EQ(window.Check(20000), ReplayWindow::kUnconfirmed);
+    CHECK_EQ(window.Check(30000), ReplayWindow::kUnconfirmed);
+    CHECK_EQ(window.Check(15), ReplayWindow::kAccepted);
+    CHECK_EQ(window.stats().unconfirmed, 7);
+}
+
+static void TestConfirmedJump() {
+    ReplayWindow window;
+    for (uint32_t sequence = 1; sequence <= 10; sequence++) {
+        window.Check(sequence);
+    }
+    // A long loss: the stream continues far ahead, with some loss and reordering in the new range
+    CHECK_EQ(window.Check(1000), ReplayWindow::kUnconfirmed);
+    CHECK_EQ(window.Check(1002), ReplayWindow::kUnconfirmed);
+    static_assert(REPLAY_WINDOW_JUMP_PACKETS == 3, "the sequence below confirms on the third packet");
+    CHECK_EQ(window.Check(1003), ReplayWindow::kAccepted);
+    // The unconfirmed packets were never delivered, a late copy of them is still new
+    CHECK_EQ(window.Check(1001), ReplayWindow::kReordered);
+    CHECK_EQ(window.Check(1000), ReplayWindow::kReordered);
+    CHECK_EQ(window.Check(1004), ReplayWindow::kAccepted);
+    CHECK_EQ(window.Check(10), ReplayWindow::kTooOld);
+}
+
+static void TestWrapAround() {
+    ReplayWindow window;
+    CHECK_EQ(window.Check(UINT32_MAX - 1), ReplayWindow::kAccepted);
+    CHECK_EQ(window.Check(UINT32_MAX), ReplayWindow::kAccepted);
+    CHECK_EQ(window.Check(0), ReplayWindow::kAccepted);
+    CHECK_EQ(window.Check(1), ReplayWindow::kAccepted);
+    CHECK_EQ(window.Check(UINT32_MAX), ReplayWindow::kDuplicate);
+}
+
+static void TestReset() {
+    ReplayWindow window;
+    window.Check(5000);
+    window.Check(5000);
+    window.Reset();
+    CHECK_EQ(window.stats().accepted, 0);
+    CHECK_EQ(window.stats().duplicates, 0);
+    // A new session may start anywhere, including below the old range
+    CHECK_EQ(window.Check(7), ReplayWindow::kAccepted);
+    CHECK_EQ(window.Check(8), ReplayWindow::kAccepted);
+}
+
+int main() {
+    RUN_TEST(TestInOrderAndReordered);
+    RUN_TEST(TestStalePacketsNeverRestart);
+    RUN_TEST(TestSingleJumpIsIgnored);
+    RUN_TEST(TestConfirmedJump);
+    RUN_TEST(TestWrapAround);
+    RUN_TEST(TestReset);
+    return HOST_TEST_RESULT();
+}
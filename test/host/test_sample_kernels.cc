@@ -0,0 +1,154 @@
+// Compares the sample kernels against plain 64-bit reference loops on random and edge input
+
+#include "host_test.h"
+#include "sample_kernels.h"
+
+#include <cstdint>
+#include <random>
+#include <vector>
+#include <algorithm>
+
+static const int16_t kEdges[] = { INT16_MIN, INT16_MIN + 1, -1, 0, 1, INT16_MAX - 1, INT16_MAX };
+
+static int16_t RefSaturate(int64_t value) {
+    return static_cast<int16_t>(std::clamp<int64_t>(value, INT16_MIN, INT16_MAX));
+}
+
+static std::vector<int16_t> RandomPcm(std::mt19937& rng, size_t samples) {
+    std::uniform_int_distribution<int> dist(INT16_MIN, INT16_MAX);
+    std::vector<int16_t> pcm(samples);
+    for (size_t i = 0; i < samples; i++) {
+        pcm[i] = i < std::size(kEdges) ? kEdges[i] : static_cast<int16_t>(dist(rng));
+    }
+    return pcm;
+}
+
+static void TestMixSaturate() {
+    std::mt19937 rng(1);
+    for (int32_t gain : { 0, 8192, 16384, 32768, 40000 }) {
+        auto dst = RandomPcm(rng, 997);
+        auto src = RandomPcm(rng, 997);
+        std::reverse(src.begin(), src.end());
+        auto expected = dst;
+        for (size_t i = 0; i < dst.size(); i++) {
+            expected[i] = RefSaturate(dst[i] + ((static_cast<int64_t>(src[i]) * gain) >> 15));
+        }
+        MixSaturateS16(dst.data(), src.data(), dst.size(), gain);
+        CHECK(dst == expected);
+    }
+}
+
+static void TestGainRamp() {
+    std::mt19937 rng(2);
+    // A constant gain is exact
+    for (int32_t gain : { 0, 16384, 32768, 49152 }) {
+        auto pcm = RandomPcm(rng, 480);
+        auto expected = pcm;
+        for (auto& sample : expected) {
+            sample = RefSaturate((static_cast<int64_t>(sample) * gain) >> 15);
+        }
+        ApplyGainRampS16(pcm.data(), pcm.size(), gain, gain);
+        CHECK(pcm == expected);
+    }
+    // A ramp ends within rounding of the target gain and moves monotonically
+    auto pcm = std::vector<int16_t>(480, INT16_MAX);
+    ApplyGainRampS16(pcm.data(), pcm.size(), 32768, 0);
+    CHECK_EQ(pcm.back(), 0);
+    for (size_t i = 1; i < pcm.size(); i++) {
+        CHECK(pcm[i] <= pcm[i - 1]);
+    }
+    pcm.assign(480, INT16_MAX);
+    ApplyGainRampS16(pcm.data(), pcm.size(), 0, 32768);
+    CHECK(pcm.back() >= INT16_MAX - 2);
+    CHECK(pcm.front() < 100);
+    for (size_t i = 1; i < pcm.size(); i++) {
+        CHECK(pcm[i] >= pcm[i - 1]);
+    }
+}
+
+static void TestAmplify() {
+    std::mt19937 rng(3);
+    for (int32_t factor : { -65536, -2, 0, 1, 2, 8, 40, 65536, 100000 }) {
+        auto pcm = RandomPcm(rng, 512);
+        auto expected = pcm;
+        int64_t clamped = std::clamp<int64_t>(factor, 0, 65536);
+        for (auto& sample : expected) {
+            sample = RefSaturate(sample * clamped);
+        }
+        AmplifyS16(pcm.data(), pcm.size(), factor);
+        CHECK(pcm == expected);
+    }
+}
+
+static void TestScaleToS32() {
+    std::mt19937 rng(4);
+    for (int32_t gain : { 0, 1, 32768, 65536, 65537, 131072, 1 << 20 }) {
+        auto src = RandomPcm(rng, 512);
+        std::vector<int32_t> dst(src.size());
+        ScaleS16ToS32(src.data(), dst.data(), src.size(), gain);
+        for (size_t i = 0; i < src.size(); i++) {
+            int64_t value = static_cast<int64_t>(src[i]) * gain;
+            CHECK_EQ(dst[i], std::clamp<int64_t>(value, INT32_MIN, INT32_MAX));
+        }
+    }
+}
+
+static void TestNarrowToS16() {
+    std::mt19937 rng(5);
+    std::uniform_int_distribution<int32_t> dist(INT32_MIN, INT32_MAX);
+    std::vector<int32_t> src = { INT32_MIN, INT32_MIN + 1, -65536, -1, 0, 1, 65535, INT32_MAX };
+    while (src.size() < 512) {
+        src.push_back(dist(rng));
+    }
+    for (int shift : { 0, 8, 12, 14, 16 }) {
+        std::vector<int16_t> dst(src.size());
+        NarrowS32ToS16(src.data(), dst.data(), src.size(), shift);
+        for (size_t i = 0; i < src.size(); i++) {
+            CHECK_EQ(dst[i], RefSaturate(static_cast<int64_t>(src[i]) >> shift));
+        }
+    }
+}
+
+static void TestChannels() {
+    std::mt19937 rng(6);
+    const size_t frames = 257;
+    for (int channels : { 1, 2, 3, 4 }) {
+        auto src = RandomPcm(rng, frames * channels);
+        for (int channel = 0; channel < channels; channel++) {
+            std::vector<int16_t> dst(frames);
+            ExtractChannelS16(src.data(), dst.data(), frames, channels, channel);
+            for (size_t i = 0; i < frames; i++) {
+                CHECK_EQ(dst[i], src[i * channels + channel]);
+            }
+            // In place, as the audio testing path uses it
+            auto in_place = src;
+            ExtractChannelS16(in_place.data(), in_place.data(), frames, channels, channel);
+            CHECK(std::equal(dst.begin(), dst.end(), in_place.begin()));
+        }
+    }
+
+    auto stereo = RandomPcm(rng, frames * 2);
+    std::vector<int16_t> first(frames), second(frames), merged(frames * 2);
+    DeinterleaveS16(stereo.data(), first.data(), second.data(), frames);
+    for (size_t i = 0; i < frames; i++) {
+        CHECK_EQ(first[i], stereo[2 * i]);
+        CHECK_EQ(second[i], stereo[2 * i + 1]);
+    }
+    InterleaveS16(first.data(), second.data(), merged.data(), frames);
+    CHECK(merged == stereo);
+
+    // First may be the source
+    auto in_place = stereo;
+    DeinterleaveS16(in_place.data(), in_place.data(), second.data(), frames);
+    CHECK(std::equal(first.begin(), first.end(), in_place.begin()));
+}
+
+int main() {
+    RUN_TEST(TestMixSaturate);
+    RUN_TEST(TestGainRamp);
+    RUN_TEST(TestAmplify);
+    RUN_TEST(TestScaleToS32);
+    RUN_TEST(TestNarrowToS16);
+    RUN_TEST(TestChannels);
+    return HOST_TEST_RESULT();
+}